@@ -19,8 +19,9 @@
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include "hardware/timer.h"
+#include "pico/flash.h"
 #include "pico/multicore.h"
-#include "pico/mutex.h"
 
 #include "buttons.hpp"
 #include "cdc.hpp"
@@ -29,21 +30,21 @@
 #include "hid.hpp"
 #include "keys_config.hpp"
 #include "leds.hpp"
+#include "pico_flash.hpp"
 #include "storage.hpp"
 #include "terminal.hpp"
 #include "time.hpp"
 #include "tud.hpp"
+#include "work_queue.hpp"
 
 Leds* g_leds       = nullptr;
 Buttons* g_buttons = nullptr;
 
-mutex_t g_mutex;
-
 void leds_task_on_core1() {
+    /* Lets flash writes on core0 park this core instead of sharing a lock with it */
+    flash_safe_execute_core_init();
     while (1) {
-        mutex_enter_blocking(&g_mutex);
         leds_task(*g_leds, *g_buttons);
-        mutex_exit(&g_mutex);
         sleep_ms(80);
     }
 }
@@ -55,35 +56,53 @@ int main(void) {
         { 2, BUTTON_LEFT_GPIO, Modifier::LEFT_CMD, Color::Blue, true },
     };
 
-    mutex_init(&g_mutex);
+    BootTimings_t boot_timings = {};
+    uint64_t start_us          = time_us_64();
+    auto lap_us                = [&start_us]() {
+        const uint64_t now_us = time_us_64();
+        const uint32_t lap    = static_cast<uint32_t>(now_us - start_us);
+        start_us              = now_us;
+        return lap;
+    };
 
-    Storage storage(g_mutex);
+    PicoFlash flash(STORAGE_FLASH_OFFSET, STORAGE_SIZE);
+    Storage storage(flash);
     storage.init();
+    storage.enable_write_back();
+    boot_timings.storage_us = lap_us();
 
     KeysConfig keys(key_configs, storage);
-    Leds leds(3, keys);
-    leds.init();
-
     Buttons buttons(keys);
     buttons.init();
+    boot_timings.keys_us = lap_us();
 
+    Leds leds(3, keys);
+    leds.init();
     g_buttons = &buttons;
     g_leds    = &leds;
     multicore_launch_core1(leds_task_on_core1);
+    boot_timings.leds_us = lap_us();
 
     Time time;
+    WorkQueue work_queue(time_us_64);
 
-    FeaturesHandler f_handler(storage, keys, time);
+    FeaturesHandler f_handler(storage, keys, time, work_queue);
     f_handler.init();
+    boot_timings.features_us = lap_us();
 
-    Terminal t(storage, keys, f_handler, time);
+    Terminal t(storage, keys, f_handler, time, work_queue, boot_timings);
     CdcDevice cdc(t);
 
     initialize_tud();
+    boot_timings.usb_us = lap_us();
 
     while (1) {
         tud_task();
         hid_task(buttons, f_handler);
         cdc.task();
+        /* Work posted by interrupts, before the storage so its flash writes are staged right away */
+        work_queue.run();
+        /* Last, so sectors are erased in the background only once everything else had its turn */
+        storage.task();
     }
 }
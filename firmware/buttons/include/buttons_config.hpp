@@ -23,13 +23,17 @@
 
 #include <variant>
 
+#ifdef UNIT_TEST
+#include "mock_hid.hpp"
+#else
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpedantic"
 #include "class/hid/hid.h"
 #pragma GCC diagnostic pop
+#include "pico/stdlib.h"
+#endif
 
 #include "leds_config.hpp"
-#include "pico/stdlib.h"
 
 enum Key : uint8_t {
     C    = HID_KEY_C,
@@ -0,0 +1,33 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <sys/types.h>
+
+/* Values of the TinyUSB HID usages the buttons are configured with */
+#define HID_KEY_NONE 0x00
+#define HID_KEY_C 0x06
+#define HID_KEY_V 0x19
+
+#define KEYBOARD_MODIFIER_LEFTCTRL 0x01
+#define KEYBOARD_MODIFIER_LEFTGUI 0x08
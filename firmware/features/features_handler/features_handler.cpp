@@ -26,8 +26,8 @@
 #include "time.hpp"
 #include "time_tracker.hpp"
 
-FeaturesHandler::FeaturesHandler(Storage& storage_, KeysConfig& keys_config_, Time& time_)
-: storage(storage_), keys_config(keys_config_), time(time_) {}
+FeaturesHandler::FeaturesHandler(Storage& storage_, KeysConfig& keys_config_, Time& time_, WorkQueue& work_queue_)
+: storage(storage_), keys_config(keys_config_), time(time_), work_queue(work_queue_) {}
 
 void FeaturesHandler::init() {
     (void)storage.get_blob(BlobType::FEATURES_HANDLER_CONFIG, config);
@@ -44,7 +44,7 @@ void FeaturesHandler::init() {
 
 void FeaturesHandler::initialize_features() {
     features[FeatureType::CTRL_C_V]     = std::make_unique<CtrlCVFeature>(keys_config);
-    features[FeatureType::TIME_TRACKER] = std::make_unique<TimeTracker>(keys_config, storage, time);
+    features[FeatureType::TIME_TRACKER] = std::make_unique<TimeTracker>(keys_config, storage, time, work_queue);
 }
 
 void FeaturesHandler::factory_init() {
@@ -26,6 +26,7 @@
 #include "keys_config.hpp"
 #include "storage.hpp"
 #include "time.hpp"
+#include "work_queue.hpp"
 
 #include <memory>
 #include <string>
@@ -59,7 +60,7 @@ class Feature {
 
 class FeaturesHandler {
   public:
-    FeaturesHandler(Storage& storage, KeysConfig& keys_config, Time& time);
+    FeaturesHandler(Storage& storage, KeysConfig& keys_config, Time& time, WorkQueue& work_queue);
     ~FeaturesHandler() = default;
 
     void init();
@@ -80,6 +81,7 @@ class FeaturesHandler {
     std::unordered_map<FeatureType, std::unique_ptr<Feature>> features;
     KeysConfig& keys_config;
     Time& time;
+    WorkQueue& work_queue;
 
     void initialize_features();
     bool is_factory_required() const;
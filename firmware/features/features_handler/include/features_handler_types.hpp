@@ -52,6 +52,10 @@ struct SetTimeTrackerMediumThresholdCmd {
 struct SetTimeTrackerLongThresholdCmd {
     uint32_t threshold_ms;
 };
+struct GetTimeTrackerPersistencePolicyCmd {};
+struct SetTimeTrackerPersistencePolicyCmd {
+    TimeTrackerPersistencePolicy_t policy;
+};
 
 /* -------------------------------------------------------------------------- */
 
@@ -65,10 +69,12 @@ using FeatureCommand =
                  GetTimeTrackerCurrentActiveSessionIdCmd,
                  NewTimeTrackerSessionCmd,
                  SetTimeTrackerMediumThresholdCmd,
-                 SetTimeTrackerLongThresholdCmd>;
+                 SetTimeTrackerLongThresholdCmd,
+                 GetTimeTrackerPersistencePolicyCmd,
+                 SetTimeTrackerPersistencePolicyCmd>;
 
 // Define possible return types for get_cmd
-using FeatureCmdResultVariant = std::variant<std::monostate, TimeTrackingEntry_t, SessionId>;
+using FeatureCmdResultVariant = std::variant<std::monostate, TimeTrackingEntry_t, SessionId, TimeTrackerPersistencePolicy_t>;
 using FeatureCmdResult        = std::pair<FeatureCmdStatus, FeatureCmdResultVariant>;
 // clang-format on
 
@@ -85,3 +91,5 @@ typedef struct {
     FeatureType current_feature;
     bool is_feature_set;
 } FeaturesHandlerConfig_t;
+static_assert(sizeof(FeaturesHandlerConfig_t) <= get_blob_max_size(BlobType::FEATURES_HANDLER_CONFIG),
+    "FeaturesHandlerConfig_t exceeds its blob size.");
@@ -25,6 +25,7 @@
 #include "features_handler.hpp"
 #include "time.hpp"
 #include "time_tracker_types.hpp"
+#include "work_queue.hpp"
 #include <optional>
 #include <unordered_map>
 #include <variant>
@@ -34,8 +35,8 @@
 
 class TimeTracker : public Feature {
   public:
-    explicit TimeTracker(KeysConfig& keys_config_, Storage& storage_, Time& time_)
-    : Feature(keys_config_), storage(storage_), time(time_) {
+    explicit TimeTracker(KeysConfig& keys_config_, Storage& storage_, Time& time_, WorkQueue& work_queue_)
+    : Feature(keys_config_), storage(storage_), time(time_), work_queue(work_queue_) {
         initialize_key_color_map();
     }
     FeatureCmdResult get_cmd(const FeatureCommand& command) const override;
@@ -46,7 +47,12 @@ class TimeTracker : public Feature {
     TimeTrackerData_t data;
     Storage& storage;
     Time& time;
-    uint intervals_count       = 0;
+    WorkQueue& work_queue;
+    TrackingClock clock;
+    TrackingCheckpoint checkpoints;
+    uint64_t journal_update_us = 0;
+    alarm_id_t threshold_alarm = 0;
+    bool is_active             = false;
     bool awaiting_confirmation = false;
     std::vector<ButtonConfig> saved_buttons_state{};
     TrackingType previous_tracking_type = TrackingType::NONE;
@@ -81,36 +87,87 @@ class TimeTracker : public Feature {
     void initialize_new_session();
     void stop_tracking();
     void resume_tracking();
-    void save_tracking_data() { storage.save_blob(BlobType::TIME_TRACKER_DATA, data); };
-    bool is_time_to_save() const { return (intervals_count >= SAVE_INTERVALS_COUNT); }
-    void increment_intervals_count() { intervals_count++; }
-    void zero_intervals_count() { intervals_count = 0; }
+    void save_tracking_data() {
+        storage.save_blob(BlobType::TIME_TRACKER_DATA, data, offsetof(TimeTrackerData_t, thresholds_reached));
+    };
+    /* Checkpoints only change the active entry, switching sessions saves the whole blob */
+    void save_active_entry() {
+        const auto& entry = data.tracking_entries[data.active_session];
+        if (storage.patch(BlobType::TIME_TRACKER_DATA, data, entry) == StorageStatus::NOT_FOUND)
+            save_tracking_data();
+    }
+    void update_journal();
+    void invalidate_journal();
+    bool recover_from_journal();
+    void checkpoint(bool is_transition);
     bool is_next_slot_empty() const;
     void save_buttons_state();
     void restore_buttons_state();
 
+    bool is_threshold_reached(TimeTrackerThreshold threshold) const {
+        return data.thresholds_reached.is_set(get_threshold_flag(data.active_session, threshold));
+    }
     bool is_any_threshold_reached() const {
-        const auto& entry = data.tracking_entries[data.active_session];
-        return (entry.long_threshold_reached || entry.medium_threshold_reached);
+        return is_threshold_reached(TimeTrackerThreshold::LONG) || is_threshold_reached(TimeTrackerThreshold::MEDIUM);
+    }
+    /* Only clears a bit of the tail, programmed over the stored blob unless a checkpoint came after it */
+    void set_threshold_reached(TimeTrackerThreshold threshold) {
+        data.thresholds_reached.set(get_threshold_flag(data.active_session, threshold));
+        if (storage.patch(BlobType::TIME_TRACKER_DATA, data, data.thresholds_reached) == StorageStatus::NOT_FOUND)
+            save_tracking_data();
     }
     void check_thresholds();
+    void update_thresholds();
+    void schedule_threshold_alarm();
+    void cancel_threshold_alarm();
+    static int64_t threshold_alarm_callback(alarm_id_t id, void* user_data);
+    static void threshold_work(void* context) { static_cast<TimeTracker*>(context)->schedule_threshold_alarm(); }
+
+    static TrackingType get_tracking_type(const TimeTrackingEntry_t& entry) {
+        if (entry.tracking_work)
+            return TrackingType::WORK_TRACKING;
+        if (entry.tracking_meetings)
+            return TrackingType::MEETING_TRACKING;
+        return TrackingType::NONE;
+    }
+    /* Folds the running span into the active entry, counting on with whatever the entry tracks now */
+    void restart_clock(TrackingType type) {
+        auto& entry = data.tracking_entries[data.active_session];
+        clock.restart(type, time_us_64(), entry.work_time_us, entry.meeting_time_us);
+    }
+    void restart_clock() { restart_clock(get_tracking_type(data.tracking_entries[data.active_session])); }
+    /* The entry as of now, including the running span if it is the active one */
+    TimeTrackingEntry_t get_live_entry(SessionId session) const {
+        TimeTrackingEntry_t entry = data.tracking_entries[session];
+        entry.medium_threshold_reached =
+            data.thresholds_reached.is_set(get_threshold_flag(session, TimeTrackerThreshold::MEDIUM));
+        entry.long_threshold_reached =
+            data.thresholds_reached.is_set(get_threshold_flag(session, TimeTrackerThreshold::LONG));
+        if (session == data.active_session) {
+            const uint64_t now_us = time_us_64();
+            entry.work_time_us += clock.get_span_us(TrackingType::WORK_TRACKING, now_us);
+            entry.meeting_time_us += clock.get_span_us(TrackingType::MEETING_TRACKING, now_us);
+        }
+        return entry;
+    }
 
+    static uint64_t get_microseconds_tracked(const TimeTrackingEntry_t& entry) {
+        return (entry.work_time_us + entry.meeting_time_us);
+    }
+    static uint64_t get_threshold_us(uint64_t threshold_ms) {
+        constexpr uint64_t max_threshold_ms = UINT64_MAX / MICROSECONDS_IN_MILISECOND_COUNT;
+        return (threshold_ms > max_threshold_ms) ? UINT64_MAX : (threshold_ms * MICROSECONDS_IN_MILISECOND_COUNT);
+    }
     static uint64_t get_milliseconds_tracked(const TimeTrackingEntry_t& entry) {
         const uint64_t total_ms_work    = entry.work_time_us / MICROSECONDS_IN_MILISECOND_COUNT;
         const uint64_t total_ms_meeting = entry.meeting_time_us / MICROSECONDS_IN_MILISECOND_COUNT;
         return (total_ms_work + total_ms_meeting);
     }
     uint get_hours_tracked() const {
-        const uint64_t total_ms_work =
-            data.tracking_entries[data.active_session].work_time_us / MICROSECONDS_IN_MILISECOND_COUNT;
-        const uint64_t total_ms_meeting =
-            data.tracking_entries[data.active_session].meeting_time_us / MICROSECONDS_IN_MILISECOND_COUNT;
-        return static_cast<uint>(
-            (total_ms_work + total_ms_meeting) / (MILLISECONDS_IN_SECOND_COUNT * SECONDS_IN_HOUR_COUNT));
+        const uint64_t total_ms = get_milliseconds_tracked(get_live_entry(data.active_session));
+        return static_cast<uint>(total_ms / (MILLISECONDS_IN_SECOND_COUNT * SECONDS_IN_HOUR_COUNT));
     }
 
-    static bool timer_callback(repeating_timer_t* timer);
-
     /* -------------------------------------------------------------------------- */
     /*                            Key handling helpers                            */
     /* -------------------------------------------------------------------------- */
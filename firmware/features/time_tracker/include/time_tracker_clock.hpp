@@ -0,0 +1,60 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+enum class TrackingType : uint8_t {
+    WORK_TRACKING    = 0,
+    MEETING_TRACKING = 1,
+    NONE             = 2,
+};
+
+/*
+ * Tracked time is not counted by a periodic tick. The totals of a session hold the time up to the
+ * start of the running span, which is added whenever they are read and folded into them whenever
+ * tracking starts, stops or switches. The result only depends on the timestamps of those events, so
+ * a late or missed interrupt cannot make it drift.
+ */
+class TrackingClock {
+  public:
+    /* Folds the running span into the totals and starts a new one of `type`, NONE stops the clock */
+    void restart(TrackingType type, uint64_t now_us, uint64_t& work_time_us, uint64_t& meeting_time_us) {
+        work_time_us += get_span_us(TrackingType::WORK_TRACKING, now_us);
+        meeting_time_us += get_span_us(TrackingType::MEETING_TRACKING, now_us);
+        running_type  = type;
+        span_start_us = now_us;
+    }
+
+    /* Time of the running span if it is of `type`, a clock read before the span started gives none */
+    uint64_t get_span_us(TrackingType type, uint64_t now_us) const {
+        if ((type == TrackingType::NONE) || (type != running_type) || (now_us < span_start_us))
+            return 0;
+        return now_us - span_start_us;
+    }
+
+    TrackingType get_type() const { return running_type; }
+
+  private:
+    TrackingType running_type = TrackingType::NONE;
+    uint64_t span_start_us    = 0;
+};
@@ -0,0 +1,92 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#include "time_tracker_clock.hpp"
+
+/*
+ * When TimeTracker checkpoints the active session to flash. Each checkpoint is a record in the log
+ * and the log erases a sector every few dozen records, so the policy sets the wear of the storage.
+ * Transitions are starting, stopping and switching the tracking. Changes in between, tracked time
+ * included, are saved at the latest max_interval_ms after the first of them. A new session is
+ * always saved right away, a warm reset loses nothing either way (see TimeTrackerJournal_t).
+ */
+typedef struct {
+    uint32_t max_interval_ms;
+    bool save_on_transitions;
+} TimeTrackerPersistencePolicy_t;
+
+#define TIME_TRACKER_MIN_SAVE_INTERVAL_MS 1000UL
+#define TIME_TRACKER_MAX_SAVE_INTERVAL_MS (60UL * 60UL * 1000UL)
+
+constexpr TimeTrackerPersistencePolicy_t TIME_TRACKER_POLICY_DEFAULT = { 5UL * 60UL * 1000UL, true };
+
+constexpr bool is_policy_valid(const TimeTrackerPersistencePolicy_t& policy) {
+    return (policy.max_interval_ms >= TIME_TRACKER_MIN_SAVE_INTERVAL_MS) &&
+           (policy.max_interval_ms <= TIME_TRACKER_MAX_SAVE_INTERVAL_MS);
+}
+
+/* `unsaved_ms` is the time since the oldest change not saved yet */
+constexpr bool is_checkpoint_due(const TimeTrackerPersistencePolicy_t& policy, uint32_t unsaved_ms, bool is_transition) {
+    return (is_transition && policy.save_on_transitions) || (unsaved_ms >= policy.max_interval_ms);
+}
+
+/*
+ * Applies the policy to the active entry, shared by TimeTracker and the host tests. Every change, the
+ * clock running on included, goes through update(), which restarts the clock into the totals when the
+ * entry has to be checkpointed.
+ */
+class TrackingCheckpoint {
+  public:
+    /* Returns true when the totals have to be saved now, they then hold the time up to `now_us` */
+    bool update(const TimeTrackerPersistencePolicy_t& policy, bool is_transition, uint64_t now_us,
+        TrackingClock& clock, TrackingType type, uint64_t& work_time_us, uint64_t& meeting_time_us) {
+        if (!has_unsaved_changes) {
+            has_unsaved_changes = true;
+            unsaved_since_us    = now_us;
+        }
+
+        const uint32_t unsaved_ms =
+            static_cast<uint32_t>(std::min<uint64_t>((now_us - unsaved_since_us) / 1'000, UINT32_MAX));
+        if (!is_checkpoint_due(policy, unsaved_ms, is_transition))
+            return false;
+
+        clock.restart(type, now_us, work_time_us, meeting_time_us);
+        has_unsaved_changes = false;
+        return true;
+    }
+
+    /* Whatever saved the entry outside of update() */
+    void mark_saved() { has_unsaved_changes = false; }
+
+    /* Polled from the main loop, a running clock is a change in itself */
+    bool is_pending(const TrackingClock& clock) const {
+        return has_unsaved_changes || (clock.get_type() != TrackingType::NONE);
+    }
+
+  private:
+    uint64_t unsaved_since_us = 0; /* Of the oldest change not checkpointed yet */
+    bool has_unsaved_changes  = false;
+};
@@ -21,9 +21,14 @@
 
 #pragma once
 
-#include "buttons.hpp"
-#include "pico/stdlib.h"
+#include <cstddef>
+
+#include "buttons_config.hpp"
+#include "clear_only_counters.hpp"
+#include "storage.hpp"
 #include "time.hpp"
+#include "time_tracker_clock.hpp"
+#include "time_tracker_policy.hpp"
 
 #define MICROSECONDS_IN_SECOND_COUNT 1'000'000UL
 #define SECONDS_IN_HOUR_COUNT 3600UL
@@ -31,9 +36,9 @@
 #define MILLISECONDS_IN_SECOND_COUNT 1'000UL
 #define SECONDS_IN_MINUTE_COUNT 60UL
 
-#define TRACING_TIMER_INTERVAL_MS 250UL
+#define JOURNAL_INTERVAL_MS 250UL
 #define MAX_TIME_TRACKER_ENTRIES_COUNT 31
-#define SAVE_INTERVALS_COUNT 16
+#define TIME_TRACKER_JOURNAL_MAGIC 0x4C4E524A /* "JRNL" */
 
 #define MEDIUM_THRESHOLD_MS_DEFAULT (6 * SECONDS_IN_HOUR_COUNT * MILLISECONDS_IN_SECOND_COUNT)
 #define LONG_THRESHOLD_MS_DEFAULT (7.5 * SECONDS_IN_HOUR_COUNT * MILLISECONDS_IN_SECOND_COUNT)
@@ -50,10 +55,19 @@ enum class TimeTrackerCommand : uint8_t {
     GET_TIME_TRACKER_ENTRY = 0,
 };
 
-enum class TrackingType : uint8_t {
-    WORK_TRACKING    = 0,
-    MEETING_TRACKING = 1,
-    NONE             = 2,
+/* Type of the event appended to the storage event ring when a key starts or stops tracking */
+enum class TimeTrackerTransition : uint8_t {
+    START = 1,
+    STOP  = 2,
+};
+static_assert(static_cast<uint8_t>(TimeTrackerTransition::START) != EVENT_TYPE_TIME, "Transition taken by the ring.");
+static_assert(static_cast<uint8_t>(TimeTrackerTransition::STOP) != EVENT_TYPE_TIME, "Transition taken by the ring.");
+
+/* Thresholds reached by an entry while it was active, kept in TimeTrackerData_t::thresholds_reached */
+enum class TimeTrackerThreshold : uint {
+    MEDIUM = 0,
+    LONG   = 1,
+    COUNT,
 };
 
 constexpr uint WORK_TRACKING_KEY_ID    = 0;
@@ -66,20 +80,114 @@ typedef struct {
     uint64_t meeting_time_us;
     bool tracking_work;
     bool tracking_meetings;
-    bool medium_threshold_reached;
+    bool medium_threshold_reached; /* Filled in from TimeTrackerData_t::thresholds_reached when reported */
     bool long_threshold_reached;
     DateTime_t tracking_date;
 } TimeTrackingEntry_t;
 
+/* Appends a START or a STOP event for each activity whose tracking changed, keyed by its tracking key */
+inline void append_transition_events(
+    Storage& storage, uint64_t time_ms, const TimeTrackingEntry_t& entry, bool was_work, bool was_meeting) {
+    if (entry.tracking_work != was_work) {
+        const auto transition = entry.tracking_work ? TimeTrackerTransition::START : TimeTrackerTransition::STOP;
+        storage.append_event(time_ms, WORK_TRACKING_KEY_ID, static_cast<uint8_t>(transition));
+    }
+    if (entry.tracking_meetings != was_meeting) {
+        const auto transition = entry.tracking_meetings ? TimeTrackerTransition::START : TimeTrackerTransition::STOP;
+        storage.append_event(time_ms, MEETING_TRACKING_KEY_ID, static_cast<uint8_t>(transition));
+    }
+}
+
+/* A closed session keeps its tracking flags, what it was tracking still stops when it is closed */
+inline void append_session_close_events(Storage& storage, uint64_t time_ms, const TimeTrackingEntry_t& closed) {
+    TimeTrackingEntry_t stopped = closed;
+    stopped.tracking_work       = false;
+    stopped.tracking_meetings   = false;
+    append_transition_events(storage, time_ms, stopped, closed.tracking_work, closed.tracking_meetings);
+}
+
 struct KeyColorInfo {
     Key key;
     Color color;
 };
 
+using TimeTrackerThresholdFlags =
+    FlagBitmap<MAX_TIME_TRACKER_ENTRIES_COUNT * static_cast<size_t>(TimeTrackerThreshold::COUNT)>;
+
+constexpr size_t get_threshold_flag(SessionId session, TimeTrackerThreshold threshold) {
+    return (session * static_cast<size_t>(TimeTrackerThreshold::COUNT)) + static_cast<size_t>(threshold);
+}
+
+/* Schema 2, schema 1 ended with persistence_policy and schema 0 with long_threshold_ms */
 typedef struct {
     uint32_t magic;
     TimeTrackingEntry_t tracking_entries[MAX_TIME_TRACKER_ENTRIES_COUNT];
     SessionId active_session;
     uint64_t medium_threshold_ms;
     uint64_t long_threshold_ms;
+    TimeTrackerPersistencePolicy_t persistence_policy;
+    /* Clear-only tail, a threshold reached is programmed over the stored blob when it can be */
+    TimeTrackerThresholdFlags thresholds_reached;
 } TimeTrackerData_t;
+static_assert(sizeof(TimeTrackerData_t) <= get_blob_max_size(BlobType::TIME_TRACKER_DATA),
+    "TimeTrackerData_t exceeds its blob size.");
+static_assert(get_blob_schema(BlobType::TIME_TRACKER_DATA) == 2, "TIME_TRACKER_DATA schema changed without a migration.");
+
+/* Schema 1 ended where the flags start, there was no padding after the persistence policy */
+constexpr uint32_t TIME_TRACKER_DATA_V1_SIZE = offsetof(TimeTrackerData_t, thresholds_reached);
+static_assert((TIME_TRACKER_DATA_V1_SIZE % alignof(TimeTrackerData_t)) == 0, "Schema 1 size changed.");
+
+/* Schema 0 to 1, the persistence policy was not stored yet and gets its default */
+inline void migrate_time_tracker_data_v0(std::span<const uint8_t> old_blob, uint32_t offset, std::span<uint8_t> window) {
+    constexpr uint32_t policy_offset            = offsetof(TimeTrackerData_t, persistence_policy);
+    const TimeTrackerPersistencePolicy_t policy = TIME_TRACKER_POLICY_DEFAULT;
+
+    copy_to_window(window, offset, 0, old_blob.first(std::min<size_t>(old_blob.size(), policy_offset)));
+    copy_to_window(window, offset, policy_offset,
+        std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(&policy), sizeof(policy)));
+}
+
+/* Schema 1 to 2, the threshold flags move from the entries into the clear-only tail */
+inline void migrate_time_tracker_data_v1(std::span<const uint8_t> old_blob, uint32_t offset, std::span<uint8_t> window) {
+    constexpr uint32_t flags_offset = offsetof(TimeTrackerData_t, thresholds_reached);
+    constexpr bool cleared          = false;
+    const std::span<const uint8_t> cleared_bytes(reinterpret_cast<const uint8_t*>(&cleared), sizeof(cleared));
+    TimeTrackerThresholdFlags flags;
+    flags.reset();
+
+    copy_to_window(window, offset, 0, old_blob.first(std::min<size_t>(old_blob.size(), flags_offset)));
+    for (SessionId session = 0; session < MAX_TIME_TRACKER_ENTRIES_COUNT; ++session) {
+        const uint32_t entry = static_cast<uint32_t>(
+            offsetof(TimeTrackerData_t, tracking_entries) + (session * sizeof(TimeTrackingEntry_t)));
+        const uint32_t medium_offset = entry + offsetof(TimeTrackingEntry_t, medium_threshold_reached);
+        const uint32_t long_offset   = entry + offsetof(TimeTrackingEntry_t, long_threshold_reached);
+        if ((medium_offset < old_blob.size()) && (old_blob[medium_offset] != 0))
+            flags.set(get_threshold_flag(session, TimeTrackerThreshold::MEDIUM));
+        if ((long_offset < old_blob.size()) && (old_blob[long_offset] != 0))
+            flags.set(get_threshold_flag(session, TimeTrackerThreshold::LONG));
+        copy_to_window(window, offset, medium_offset, cleared_bytes);
+        copy_to_window(window, offset, long_offset, cleared_bytes);
+    }
+    copy_to_window(window, offset, flags_offset,
+        std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(&flags), sizeof(flags)));
+}
+
+constexpr BlobMigration_t TIME_TRACKER_DATA_MIGRATIONS[] = {
+    { 0, TIME_TRACKER_DATA_V1_SIZE, migrate_time_tracker_data_v0 },
+    { 1, sizeof(TimeTrackerData_t), migrate_time_tracker_data_v1 },
+};
+
+/*
+ * Kept in RAM which is not initialized at startup, so it survives a watchdog reset, a crash or a
+ * reboot without a power loss. Holds the totals of the active session as of the last refresh, at
+ * most JOURNAL_INTERVAL_MS ago, which may be ahead of the last checkpoint on flash. The check is
+ * written last, a reset in the middle of an update leaves the journal invalid.
+ */
+typedef struct {
+    uint32_t magic;
+    SessionId session;
+    TrackingType tracking_type;
+    uint64_t work_time_us;
+    uint64_t meeting_time_us;
+    uint32_t check;
+} TimeTrackerJournal_t;
@@ -0,0 +1,500 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <memory>
+
+#include "emulated_flash.hpp"
+#include "storage.hpp"
+#include "time_tracker_clock.hpp"
+#include "time_tracker_policy.hpp"
+#include "time_tracker_types.hpp"
+#include <vector>
+
+namespace {
+
+/* TimeTracker polls from the main loop every 10 ms, coarser here to keep the simulation quick */
+constexpr uint32_t POLL_MS = 250;
+
+enum class Activity {
+    WORK,
+    MEETING,
+    BREAK,
+};
+
+/* One hour of a working day, repeated: long stretches of work with a meeting and a short break */
+constexpr struct {
+    Activity activity;
+    uint32_t minutes;
+} DAY_PATTERN[] = {
+    { Activity::WORK, 25 },
+    { Activity::MEETING, 15 },
+    { Activity::WORK, 12 },
+    { Activity::BREAK, 8 },
+};
+
+/* Layout of the tracker blob before schemas, the same on the RP2040 and on the host */
+constexpr size_t TRACKER_V0_SIZE          = 1272;
+constexpr size_t TRACKER_V0_ENTRIES       = 8;
+constexpr size_t TRACKER_V0_ENTRY_SIZE    = 40;
+constexpr size_t TRACKER_V0_SESSION       = 1248;
+constexpr size_t TRACKER_V0_MEDIUM        = 1256;
+constexpr size_t TRACKER_V0_LONG          = 1264;
+constexpr uint64_t TRACKER_V0_WORK_US     = 23'400'000'000; /* 6 h 30 min */
+constexpr uint64_t TRACKER_V0_MEETINGS_US = 3'600'000'000;
+
+/* Tracker blob as the firmware before schemas stored it, session 2 past its medium threshold */
+constexpr std::array<uint8_t, TRACKER_V0_SIZE> TRACKER_V0_IMAGE = [] {
+    std::array<uint8_t, TRACKER_V0_SIZE> image{};
+    auto put = [&image](size_t offset, uint64_t value, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            image[offset + i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+    };
+    const size_t entry = TRACKER_V0_ENTRIES + (2 * TRACKER_V0_ENTRY_SIZE);
+
+    put(0, BLOB_MAGIC, 4);
+    put(entry + 8, TRACKER_V0_WORK_US, 8);      /* work_time_us */
+    put(entry + 16, TRACKER_V0_MEETINGS_US, 8); /* meeting_time_us */
+    put(entry + 24, 1, 1);                      /* tracking_work */
+    put(entry + 26, 1, 1);                      /* medium_threshold_reached */
+    put(entry + 28, 2025, 2);                   /* tracking_date: 2025-03-14 09:30:15 */
+    put(entry + 30, 3, 1);
+    put(entry + 31, 14, 1);
+    put(entry + 32, 9, 1);
+    put(entry + 33, 30, 1);
+    put(entry + 34, 15, 1);
+    put(TRACKER_V0_SESSION, 2, 4);
+    put(TRACKER_V0_MEDIUM, 6 * 3'600'000, 8);
+    put(TRACKER_V0_LONG, 27'000'000, 8);
+    return image;
+}();
+
+constexpr uint32_t LOG_START = STORAGE_LOG_FIRST_SECTOR * FLASH_SECTOR_SIZE;
+
+} // namespace
+
+class TimeTrackerPolicyTest : public ::testing::Test {
+  protected:
+    EmulatedFlash flash{ STORAGE_SIZE };
+
+    typedef struct {
+        double checkpoints;
+        double erases;
+    } PerHour_t;
+
+    /* Per tracked hour of days tracked the way TimeTracker does it, in write-back mode */
+    PerHour_t simulate(const TimeTrackerPersistencePolicy_t& policy, uint32_t hours) {
+        set_mock_time_us_64(0);
+        std::ranges::fill(flash.raw(), 0xFF);
+        Storage storage(flash);
+        EXPECT_EQ(storage.init(), StorageStatus::SUCCESS);
+        storage.enable_write_back();
+
+        TimeTrackerData_t data{};
+        data.magic              = BLOB_MAGIC;
+        data.persistence_policy = policy;
+        data.thresholds_reached.reset();
+        TimeTrackingEntry_t& entry = data.tracking_entries[0];
+        EXPECT_EQ(storage.save_blob(BlobType::TIME_TRACKER_DATA, data, offsetof(TimeTrackerData_t, thresholds_reached)),
+            StorageStatus::SUCCESS);
+        EXPECT_EQ(storage.flush(), StorageStatus::SUCCESS);
+
+        /* The same sequence as TimeTracker::checkpoint() and TimeTracker::handle() */
+        TrackingClock clock;
+        TrackingCheckpoint checkpoints;
+        uint32_t checkpoints_count = 0;
+        auto get_type              = [&]() {
+            if (entry.tracking_work)
+                return TrackingType::WORK_TRACKING;
+            return entry.tracking_meetings ? TrackingType::MEETING_TRACKING : TrackingType::NONE;
+        };
+        auto checkpoint = [&](bool is_transition) {
+            if (!checkpoints.update(policy, is_transition, time_us_64(), clock, get_type(), entry.work_time_us,
+                    entry.meeting_time_us))
+                return;
+            EXPECT_EQ(storage.patch(BlobType::TIME_TRACKER_DATA, data, entry), StorageStatus::SUCCESS);
+            checkpoints_count++;
+        };
+
+        const uint32_t erases_before = flash.get_erase_count();
+        for (uint32_t hour = 0; hour < hours; ++hour) {
+            for (const auto& step : DAY_PATTERN) {
+                entry.tracking_work     = (step.activity == Activity::WORK);
+                entry.tracking_meetings = (step.activity == Activity::MEETING);
+                clock.restart(get_type(), time_us_64(), entry.work_time_us, entry.meeting_time_us);
+                checkpoint(true);
+
+                for (uint32_t poll = 0; poll < (step.minutes * 60'000 / POLL_MS); ++poll) {
+                    set_mock_time_us_64(time_us_64() + (POLL_MS * 1000));
+                    if (checkpoints.is_pending(clock))
+                        checkpoint(false);
+                    storage.task();
+                }
+            }
+        }
+        clock.restart(TrackingType::NONE, time_us_64(), entry.work_time_us, entry.meeting_time_us);
+        EXPECT_EQ(storage.flush(), StorageStatus::SUCCESS);
+
+        const uint64_t tracked_us  = entry.work_time_us + entry.meeting_time_us;
+        const double tracked_hours = static_cast<double>(tracked_us) / 3'600'000'000.0;
+        return { checkpoints_count / tracked_hours, (flash.get_erase_count() - erases_before) / tracked_hours };
+    }
+};
+
+TEST_F(TimeTrackerPolicyTest, CheckpointIsDueOnTransitionOrAfterMaxInterval) {
+    const TimeTrackerPersistencePolicy_t policy = { 60'000, true };
+    EXPECT_TRUE(is_checkpoint_due(policy, 0, true));
+    EXPECT_FALSE(is_checkpoint_due(policy, 59'750, false));
+    EXPECT_TRUE(is_checkpoint_due(policy, 60'000, false));
+
+    const TimeTrackerPersistencePolicy_t interval_only = { 60'000, false };
+    EXPECT_FALSE(is_checkpoint_due(interval_only, 0, true));
+    EXPECT_TRUE(is_checkpoint_due(interval_only, 60'000, true));
+
+    EXPECT_TRUE(is_policy_valid(TIME_TRACKER_POLICY_DEFAULT));
+    EXPECT_FALSE(is_policy_valid({ 0, true }));
+    EXPECT_FALSE(is_policy_valid({ TIME_TRACKER_MAX_SAVE_INTERVAL_MS + 1, true }));
+}
+
+TEST_F(TimeTrackerPolicyTest, ErasesPerTrackedHourForEachPolicy) {
+    /* A working week, so that even the rarest checkpoints fill a few sectors */
+    constexpr uint32_t hours = 40;
+    constexpr struct {
+        const char* name;
+        TimeTrackerPersistencePolicy_t policy;
+    } policies[] = {
+        { "every 4 s (before the journal)", { 4'000, false } },
+        { "transitions + 1 min", { 60'000, true } },
+        { "transitions + 5 min (default)", TIME_TRACKER_POLICY_DEFAULT },
+        { "transitions + 15 min", { 15 * 60'000, true } },
+        { "every 5 min, no transitions", { 5 * 60'000, false } },
+    };
+
+    PerHour_t per_hour[std::size(policies)];
+    for (size_t i = 0; i < std::size(policies); ++i) {
+        per_hour[i] = simulate(policies[i].policy, hours);
+        std::printf("%-32s %7.1f checkpoints, %5.2f sector erases per tracked hour\n", policies[i].name,
+            per_hour[i].checkpoints, per_hour[i].erases);
+    }
+
+    /* Transitions only add a few checkpoints an hour, the interval sets the wear */
+    EXPECT_GT(per_hour[0].erases, 0);
+    EXPECT_LT(per_hour[2].erases * 10, per_hour[0].erases);
+    EXPECT_LT(per_hour[2].checkpoints * 10, per_hour[0].checkpoints);
+    EXPECT_LE(per_hour[3].checkpoints, per_hour[2].checkpoints);
+    EXPECT_LE(per_hour[2].checkpoints, per_hour[1].checkpoints);
+    EXPECT_LE(per_hour[4].checkpoints, per_hour[2].checkpoints);
+}
+
+class TrackingClockTest : public ::testing::Test {
+  protected:
+    static constexpr uint64_t DAY_US     = 10ULL * 3'600'000'000ULL;
+    static constexpr uint64_t TICK_US    = 250'000;
+    static constexpr uint64_t MAX_GAP_US = 40ULL * 60'000'000ULL;
+
+    typedef struct {
+        uint64_t at_us;
+        TrackingType type;
+    } Switch_t;
+
+    typedef struct {
+        uint64_t start_us;
+        uint64_t end_us;
+    } IrqOff_t;
+
+    std::vector<Switch_t> switches;
+    std::vector<IrqOff_t> irq_off;
+    uint64_t expected_work_us    = 0;
+    uint64_t expected_meeting_us = 0;
+
+    /* A day of switches at arbitrary microseconds, with interrupts held off for up to 2 s now and then */
+    void SetUp() override {
+        uint64_t seed = 12345;
+        auto random   = [&seed](uint64_t limit) {
+            seed = seed * 6'364'136'223'846'793'005ULL + 1'442'695'040'888'963'407ULL;
+            return (seed >> 16) % limit;
+        };
+
+        for (uint64_t at_us = 0; at_us < DAY_US; at_us += 1 + random(MAX_GAP_US)) {
+            switches.push_back({ at_us, static_cast<TrackingType>(random(3)) });
+        }
+        for (uint64_t at_us = random(60'000'000); at_us < DAY_US; at_us += 1 + random(120'000'000)) {
+            irq_off.push_back({ at_us, at_us + 1 + random(2'000'000) });
+        }
+
+        for (size_t i = 0; i < switches.size(); ++i) {
+            const uint64_t end_us  = (i + 1 < switches.size()) ? switches[i + 1].at_us : DAY_US;
+            const uint64_t span_us = end_us - switches[i].at_us;
+            if (switches[i].type == TrackingType::WORK_TRACKING)
+                expected_work_us += span_us;
+            if (switches[i].type == TrackingType::MEETING_TRACKING)
+                expected_meeting_us += span_us;
+        }
+    }
+
+    TrackingType get_type_at(uint64_t at_us) const {
+        TrackingType type = TrackingType::NONE;
+        for (const auto& entry : switches) {
+            if (entry.at_us > at_us)
+                break;
+            type = entry.type;
+        }
+        return type;
+    }
+
+    /* Where a tick due at `at_us` actually runs, interrupts being off delay it */
+    uint64_t get_tick_run_us(uint64_t at_us) const {
+        for (const auto& window : irq_off) {
+            if ((at_us >= window.start_us) && (at_us < window.end_us))
+                return window.end_us;
+        }
+        return at_us;
+    }
+};
+
+TEST_F(TrackingClockTest, NoDriftOverADay) {
+    uint64_t work_us    = 0;
+    uint64_t meeting_us = 0;
+    TrackingClock clock;
+
+    /* Switches and reads happen late while interrupts are off, the timestamps are still right */
+    size_t window = 0;
+    for (const auto& entry : switches) {
+        while ((window < irq_off.size()) && (irq_off[window].end_us <= entry.at_us)) {
+            const uint64_t read_us = irq_off[window].end_us;
+            const uint64_t live_us = work_us + clock.get_span_us(TrackingType::WORK_TRACKING, read_us);
+            EXPECT_LE(live_us, expected_work_us);
+            window++;
+        }
+        clock.restart(entry.type, entry.at_us, work_us, meeting_us);
+    }
+    EXPECT_EQ(work_us + clock.get_span_us(TrackingType::WORK_TRACKING, DAY_US), expected_work_us);
+    clock.restart(TrackingType::NONE, DAY_US, work_us, meeting_us);
+    EXPECT_EQ(work_us, expected_work_us);
+    EXPECT_EQ(meeting_us, expected_meeting_us);
+
+    /* The same day counted by a 250 ms tick, rescheduled from when each tick ran */
+    uint64_t tick_work_us    = 0;
+    uint64_t tick_meeting_us = 0;
+    for (uint64_t due_us = TICK_US; due_us < DAY_US;) {
+        const uint64_t run_us   = get_tick_run_us(due_us);
+        const TrackingType type = get_type_at(run_us);
+        if (type == TrackingType::WORK_TRACKING)
+            tick_work_us += TICK_US;
+        if (type == TrackingType::MEETING_TRACKING)
+            tick_meeting_us += TICK_US;
+        due_us = run_us + TICK_US;
+    }
+
+    const auto drift_s = [](uint64_t counted_us, uint64_t real_us) {
+        return (static_cast<double>(counted_us) - static_cast<double>(real_us)) / 1'000'000.0;
+    };
+    std::printf("%zu switches, %zu periods with interrupts off\n", switches.size(), irq_off.size());
+    std::printf("%-10s %12s %14s\n", "", "work drift", "meeting drift");
+    std::printf("%-10s %11.3fs %13.3fs\n", "tick", drift_s(tick_work_us, expected_work_us),
+        drift_s(tick_meeting_us, expected_meeting_us));
+    std::printf("%-10s %11.3fs %13.3fs\n", "timestamps", drift_s(work_us, expected_work_us),
+        drift_s(meeting_us, expected_meeting_us));
+    EXPECT_NE(tick_work_us + tick_meeting_us, expected_work_us + expected_meeting_us);
+}
+
+TEST_F(TrackingClockTest, ReadsDoNotChangeTheTotals) {
+    uint64_t work_us    = 0;
+    uint64_t meeting_us = 0;
+    TrackingClock clock;
+
+    clock.restart(TrackingType::WORK_TRACKING, 1'000, work_us, meeting_us);
+    EXPECT_EQ(clock.get_span_us(TrackingType::WORK_TRACKING, 501'000), 500'000U);
+    EXPECT_EQ(clock.get_span_us(TrackingType::MEETING_TRACKING, 501'000), 0U);
+    EXPECT_EQ(clock.get_span_us(TrackingType::WORK_TRACKING, 0), 0U);
+    EXPECT_EQ(work_us, 0U);
+
+    clock.restart(TrackingType::MEETING_TRACKING, 1'001'000, work_us, meeting_us);
+    clock.restart(TrackingType::NONE, 1'001'999, work_us, meeting_us);
+    EXPECT_EQ(work_us, 1'000'000U);
+    EXPECT_EQ(meeting_us, 999U);
+    EXPECT_EQ(clock.get_span_us(TrackingType::NONE, 5'000'000), 0U);
+}
+
+class TimeTrackerDataTest : public ::testing::Test {
+  protected:
+    EmulatedFlash flash{ STORAGE_SIZE };
+
+    /* Runs a migration the way Storage::migrate() does, a page of the new blob at a time */
+    static TimeTrackerData_t migrate(const BlobMigration_t& migration, std::span<const uint8_t> old_blob) {
+        TimeTrackerData_t data;
+        auto* bytes = reinterpret_cast<uint8_t*>(&data);
+        for (uint32_t position = 0; position < migration.new_size; position += FLASH_PAGE_SIZE) {
+            const std::span<uint8_t> window(bytes + position, std::min(FLASH_PAGE_SIZE, migration.new_size - position));
+            std::ranges::fill(window, 0xFF);
+            migration.migrate(old_blob, position, window);
+        }
+        return data;
+    }
+};
+
+TEST_F(TimeTrackerDataTest, SchemaOneThresholdFlagsMoveToTheTail) {
+    TimeTrackerData_t old{};
+    old.magic                                        = BLOB_MAGIC;
+    old.active_session                               = 5;
+    old.tracking_entries[3].work_time_us             = 8 * 3'600'000'000ULL;
+    old.tracking_entries[3].medium_threshold_reached = true;
+    old.tracking_entries[3].long_threshold_reached   = true;
+    old.tracking_entries[5].medium_threshold_reached = true;
+    old.persistence_policy                           = { 60'000, false };
+    const std::span<const uint8_t> old_blob(reinterpret_cast<const uint8_t*>(&old), TIME_TRACKER_DATA_V1_SIZE);
+
+    const TimeTrackerData_t data = migrate(TIME_TRACKER_DATA_MIGRATIONS[1], old_blob);
+    EXPECT_EQ(TIME_TRACKER_DATA_MIGRATIONS[1].from_schema, 1);
+    EXPECT_EQ(data.magic, BLOB_MAGIC);
+    EXPECT_EQ(data.active_session, 5u);
+    EXPECT_EQ(data.tracking_entries[3].work_time_us, old.tracking_entries[3].work_time_us);
+    EXPECT_EQ(data.persistence_policy.max_interval_ms, 60'000u);
+    for (SessionId session = 0; session < MAX_TIME_TRACKER_ENTRIES_COUNT; ++session) {
+        const auto& entry = data.tracking_entries[session];
+        EXPECT_FALSE(entry.medium_threshold_reached || entry.long_threshold_reached);
+        EXPECT_EQ(data.thresholds_reached.is_set(get_threshold_flag(session, TimeTrackerThreshold::MEDIUM)),
+            (session == 3) || (session == 5));
+        EXPECT_EQ(data.thresholds_reached.is_set(get_threshold_flag(session, TimeTrackerThreshold::LONG)), session == 3);
+    }
+}
+
+TEST_F(TimeTrackerDataTest, ReachedThresholdIsProgrammedInPlace) {
+    constexpr size_t flags_offset = offsetof(TimeTrackerData_t, thresholds_reached);
+    Storage storage(flash);
+    ASSERT_EQ(storage.init(), StorageStatus::SUCCESS);
+
+    TimeTrackerData_t data{};
+    data.magic = BLOB_MAGIC;
+    data.thresholds_reached.reset();
+    ASSERT_EQ(storage.save_blob(BlobType::TIME_TRACKER_DATA, data, flags_offset), StorageStatus::SUCCESS);
+
+    data.thresholds_reached.set(get_threshold_flag(0, TimeTrackerThreshold::MEDIUM));
+    ASSERT_EQ(storage.patch(BlobType::TIME_TRACKER_DATA, data, data.thresholds_reached), StorageStatus::SUCCESS);
+    data.thresholds_reached.set(get_threshold_flag(0, TimeTrackerThreshold::LONG));
+    ASSERT_EQ(storage.patch(BlobType::TIME_TRACKER_DATA, data, data.thresholds_reached), StorageStatus::SUCCESS);
+    EXPECT_EQ(storage.get_stats().writes_in_place, 2u);
+
+    Storage rebooted(flash);
+    ASSERT_EQ(rebooted.init(), StorageStatus::SUCCESS);
+    TimeTrackerData_t restored;
+    ASSERT_EQ(rebooted.get_blob(BlobType::TIME_TRACKER_DATA, restored), StorageStatus::SUCCESS);
+    EXPECT_TRUE(restored.thresholds_reached.is_set(get_threshold_flag(0, TimeTrackerThreshold::MEDIUM)));
+    EXPECT_TRUE(restored.thresholds_reached.is_set(get_threshold_flag(0, TimeTrackerThreshold::LONG)));
+
+    /* A new session on the same entry sets the bits back, that save is appended */
+    restored.thresholds_reached.clear(get_threshold_flag(0, TimeTrackerThreshold::MEDIUM));
+    restored.thresholds_reached.clear(get_threshold_flag(0, TimeTrackerThreshold::LONG));
+    ASSERT_EQ(rebooted.save_blob(BlobType::TIME_TRACKER_DATA, restored, flags_offset), StorageStatus::SUCCESS);
+    EXPECT_EQ(rebooted.get_stats().writes_in_place, 0u);
+    ASSERT_EQ(rebooted.get_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+    EXPECT_FALSE(data.thresholds_reached.is_set(get_threshold_flag(0, TimeTrackerThreshold::MEDIUM)));
+}
+
+TEST_F(TimeTrackerDataTest, SchemaZeroImageIsMigrated) {
+    static_assert(offsetof(TimeTrackerData_t, tracking_entries) == TRACKER_V0_ENTRIES);
+    static_assert(sizeof(TimeTrackingEntry_t) == TRACKER_V0_ENTRY_SIZE);
+    static_assert(offsetof(TimeTrackingEntry_t, tracking_date) == 28);
+    static_assert(offsetof(TimeTrackerData_t, active_session) == TRACKER_V0_SESSION);
+    static_assert(offsetof(TimeTrackerData_t, long_threshold_ms) == TRACKER_V0_LONG);
+    static_assert(offsetof(TimeTrackerData_t, persistence_policy) == TRACKER_V0_SIZE);
+
+    /* The tracker slot of the fixed 2 KB layout, imported as schema 0 on boot */
+    std::ranges::copy(TRACKER_V0_IMAGE, flash.raw().begin() + LOG_START + 3 * BLOB_SLOT_SIZE_BYTES);
+    Storage storage(flash);
+    ASSERT_EQ(storage.init(), StorageStatus::SUCCESS);
+    ASSERT_EQ(storage.migrate(BlobType::TIME_TRACKER_DATA, TIME_TRACKER_DATA_MIGRATIONS), StorageStatus::SUCCESS);
+
+    TimeTrackerData_t data;
+    ASSERT_EQ(storage.get_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+    const auto& entry = data.tracking_entries[2];
+    EXPECT_EQ(data.magic, BLOB_MAGIC);
+    EXPECT_EQ(data.active_session, 2u);
+    EXPECT_EQ(data.medium_threshold_ms, 21'600'000u);
+    EXPECT_EQ(data.long_threshold_ms, 27'000'000u);
+    EXPECT_EQ(entry.work_time_us, TRACKER_V0_WORK_US);
+    EXPECT_EQ(entry.meeting_time_us, TRACKER_V0_MEETINGS_US);
+    EXPECT_TRUE(entry.tracking_work);
+    EXPECT_FALSE(entry.tracking_meetings);
+    EXPECT_EQ(entry.tracking_date.year, 2025);
+    EXPECT_EQ(entry.tracking_date.day, 14);
+    EXPECT_EQ(entry.tracking_date.second, 15);
+
+    /* Schema 1 added the policy, schema 2 moved the threshold flags */
+    EXPECT_EQ(data.persistence_policy.max_interval_ms, TIME_TRACKER_POLICY_DEFAULT.max_interval_ms);
+    EXPECT_EQ(data.persistence_policy.save_on_transitions, TIME_TRACKER_POLICY_DEFAULT.save_on_transitions);
+    EXPECT_FALSE(entry.medium_threshold_reached);
+    EXPECT_TRUE(data.thresholds_reached.is_set(get_threshold_flag(2, TimeTrackerThreshold::MEDIUM)));
+    EXPECT_FALSE(data.thresholds_reached.is_set(get_threshold_flag(2, TimeTrackerThreshold::LONG)));
+    for (SessionId session = 0; session < MAX_TIME_TRACKER_ENTRIES_COUNT; ++session) {
+        if (session != 2) {
+            EXPECT_FALSE(data.thresholds_reached.is_set(get_threshold_flag(session, TimeTrackerThreshold::MEDIUM)));
+        }
+    }
+}
+
+TEST_F(TimeTrackerDataTest, SessionMoveStopsTheTimeline) {
+    Storage storage(flash);
+    ASSERT_EQ(storage.init(), StorageStatus::SUCCESS);
+
+    /* Work starts, then a long press moves into an empty slot, the closed entry keeps tracking_work */
+    TimeTrackingEntry_t closed{};
+    closed.tracking_work = true;
+    append_transition_events(storage, 1'000, closed, false, false);
+    append_session_close_events(storage, 9'000, closed);
+    EXPECT_TRUE(closed.tracking_work);
+
+    /* A meeting in the new session */
+    TimeTrackingEntry_t next{};
+    next.tracking_meetings = true;
+    append_transition_events(storage, 10'000, next, false, false);
+    next.tracking_meetings = false;
+    append_transition_events(storage, 12'000, next, false, true);
+
+    /* The timeline as an export rebuilds it from the ring */
+    std::array<StorageEvent_t, 8> events;
+    uint32_t next_sequence = 0;
+    const uint32_t count   = storage.read_events(0, events, next_sequence);
+    ASSERT_EQ(count, 4u);
+
+    std::array<uint64_t, 2> started_ms = { UINT64_MAX, UINT64_MAX };
+    std::array<uint64_t, 2> tracked_ms = {};
+    for (uint32_t i = 0; i < count; ++i) {
+        const auto& event = events[i];
+        ASSERT_LT(event.key, started_ms.size());
+        if (event.type == static_cast<uint8_t>(TimeTrackerTransition::START)) {
+            EXPECT_EQ(started_ms[event.key], UINT64_MAX) << "Event " << i;
+            started_ms[event.key] = event.time_ms;
+        } else {
+            ASSERT_NE(started_ms[event.key], UINT64_MAX) << "Event " << i;
+            tracked_ms[event.key] += event.time_ms - started_ms[event.key];
+            started_ms[event.key] = UINT64_MAX;
+        }
+    }
+    EXPECT_EQ(started_ms[WORK_TRACKING_KEY_ID], UINT64_MAX);
+    EXPECT_EQ(started_ms[MEETING_TRACKING_KEY_ID], UINT64_MAX);
+    EXPECT_EQ(tracked_ms[WORK_TRACKING_KEY_ID], 8'000u);
+    EXPECT_EQ(tracked_ms[MEETING_TRACKING_KEY_ID], 2'000u);
+}
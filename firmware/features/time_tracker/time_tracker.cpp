@@ -19,6 +19,8 @@
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <limits>
 #include <pico/types.h>
 
@@ -30,73 +32,157 @@
 #include "time_tracker.hpp"
 #include "time_tracker_types.hpp"
 
-repeating_timer_t* tracking_timer = nullptr;
+static TimeTrackerJournal_t __uninitialized_ram(journal);
 
-bool TimeTracker::timer_callback(repeating_timer_t* timer) {
-    auto* tracker = static_cast<TimeTracker*>(timer->user_data);
-    if (!tracker)
-        return false;
+static uint32_t get_journal_check(const TimeTrackerJournal_t& j) {
+    const uint32_t type = static_cast<uint32_t>(j.tracking_type);
+    return j.magic ^ j.session ^ (type << 16) ^ static_cast<uint32_t>(j.work_time_us) ^
+           static_cast<uint32_t>(j.work_time_us >> 32) ^ static_cast<uint32_t>(j.meeting_time_us) ^
+           static_cast<uint32_t>(j.meeting_time_us >> 32) ^ UINT32_MAX;
+}
 
-    constexpr uint64_t elapsed_time_us = (TRACING_TIMER_INTERVAL_MS * MICROSECONDS_IN_MILISECOND_COUNT);
-    auto& entry = tracker->data.tracking_entries[tracker->data.active_session];
-    if (entry.tracking_work) {
-        entry.work_time_us += elapsed_time_us;
-    } else if (entry.tracking_meetings) {
-        entry.meeting_time_us += elapsed_time_us;
-    }
+void TimeTracker::checkpoint(bool is_transition) {
+    auto& entry = data.tracking_entries[data.active_session];
+    if (checkpoints.update(data.persistence_policy, is_transition, time_us_64(), clock, get_tracking_type(entry),
+            entry.work_time_us, entry.meeting_time_us))
+        save_active_entry();
+}
 
-    const uint64_t total_tracked_time_ms = get_milliseconds_tracked(entry);
-    const uint64_t medium_threshold      = tracker->data.medium_threshold_ms;
-    const uint64_t long_threshold        = tracker->data.long_threshold_ms;
-    if ((total_tracked_time_ms >= medium_threshold) && !entry.medium_threshold_reached) {
-        tracker->led_enable(FUNCTION_KEY_ID, Color::Yellow);
-        entry.medium_threshold_reached = true;
-    } else if ((total_tracked_time_ms >= long_threshold) && !entry.long_threshold_reached) {
-        tracker->led_enable(FUNCTION_KEY_ID, Color::Red);
-        entry.long_threshold_reached = true;
-    }
+void TimeTracker::update_thresholds() {
+    if (is_threshold_reached(TimeTrackerThreshold::LONG))
+        return;
 
-    if (tracker->is_time_to_save()) {
-        tracker->save_tracking_data();
-        tracker->zero_intervals_count();
-    } else {
-        tracker->increment_intervals_count();
+    /* In microseconds, the M0+ has no 64-bit divide */
+    const uint64_t tracked_us = get_microseconds_tracked(get_live_entry(data.active_session));
+    const bool is_medium      = is_threshold_reached(TimeTrackerThreshold::MEDIUM);
+    if ((tracked_us >= get_threshold_us(data.medium_threshold_ms)) && !is_medium) {
+        led_enable(FUNCTION_KEY_ID, Color::Yellow);
+        set_threshold_reached(TimeTrackerThreshold::MEDIUM);
+    }
+    if (is_threshold_reached(TimeTrackerThreshold::MEDIUM) &&
+        (tracked_us >= get_threshold_us(data.long_threshold_ms))) {
+        led_enable(FUNCTION_KEY_ID, Color::Red);
+        set_threshold_reached(TimeTrackerThreshold::LONG);
     }
+}
 
-    return true;
+/*
+ * The time left until the next threshold is known whenever tracking starts, so instead of polling an
+ * alarm is set for the instant it is crossed. It has to be set again whenever tracking starts, stops
+ * or switches and whenever a threshold changes.
+ */
+void TimeTracker::schedule_threshold_alarm() {
+    cancel_threshold_alarm();
+    if (!is_active)
+        return;
+
+    update_thresholds();
+    if (is_threshold_reached(TimeTrackerThreshold::LONG) || (clock.get_type() == TrackingType::NONE))
+        return;
+
+    const uint64_t threshold_ms =
+        is_threshold_reached(TimeTrackerThreshold::MEDIUM) ? data.long_threshold_ms : data.medium_threshold_ms;
+    const uint64_t threshold_us = get_threshold_us(threshold_ms);
+    const uint64_t tracked_us   = get_microseconds_tracked(get_live_entry(data.active_session));
+    if (tracked_us < threshold_us)
+        threshold_alarm = add_alarm_in_us(threshold_us - tracked_us, TimeTracker::threshold_alarm_callback, this, true);
+}
+
+void TimeTracker::cancel_threshold_alarm() {
+    /* Harmless if it has fired already */
+    if (threshold_alarm > 0)
+        cancel_alarm(threshold_alarm);
+    threshold_alarm = 0;
+}
+
+int64_t TimeTracker::threshold_alarm_callback(alarm_id_t id, void* user_data) {
+    (void)id;
+    auto* tracker = static_cast<TimeTracker*>(user_data);
+    /* The LEDs and the entry belong to the main loop */
+    tracker->work_queue.post(TimeTracker::threshold_work, tracker);
+    return 0;
 }
 
 void TimeTracker::init() {
+    (void)storage.migrate(BlobType::TIME_TRACKER_DATA, TIME_TRACKER_DATA_MIGRATIONS);
     storage.get_blob(BlobType::TIME_TRACKER_DATA, data);
     if (is_factory_required())
         factory_init();
 
     disable_all_leds();
     stop_tracking();
+    /* After a warm reset tracking goes on where it was, a power loss stops it */
+    if (recover_from_journal())
+        resume_tracking();
     check_thresholds();
 
     keys_config.switch_leds_mode(LedsMode::HANDLED_BY_FEATURE);
     set_tracking_date();
 
-    tracking_timer = new repeating_timer_t;
-    add_repeating_timer_ms(TRACING_TIMER_INTERVAL_MS, TimeTracker::timer_callback, this, tracking_timer);
+    restart_clock();
+    update_journal();
+    is_active = true;
+    schedule_threshold_alarm();
 }
 
 void TimeTracker::deinit() {
     keys_config.switch_leds_mode(LedsMode::WHEN_BUTTON_PRESSED);
     disable_all_leds();
 
-    if (tracking_timer) {
-        cancel_repeating_timer(tracking_timer);
-        delete tracking_timer;
-        tracking_timer = nullptr;
+    if (is_active) {
+        cancel_threshold_alarm();
+        restart_clock(TrackingType::NONE);
+        save_tracking_data();
+        checkpoints.mark_saved();
+        is_active           = false;
     }
+
+    /* Nothing is tracked until the feature is enabled again */
+    invalidate_journal();
+}
+
+void TimeTracker::update_journal() {
+    const TimeTrackingEntry_t entry = get_live_entry(data.active_session);
+    const TrackingType type         = get_tracking_type(entry);
+    journal_update_us               = time_us_64();
+
+    /* Only the order of the stores matters, a reset is all that can interrupt them */
+    journal.check = 0;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    journal.magic           = TIME_TRACKER_JOURNAL_MAGIC;
+    journal.session         = data.active_session;
+    journal.tracking_type   = type;
+    journal.work_time_us    = entry.work_time_us;
+    journal.meeting_time_us = entry.meeting_time_us;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    journal.check = get_journal_check(journal);
+}
+
+void TimeTracker::invalidate_journal() {
+    journal.magic = 0;
+    journal.check = 0;
+}
+
+bool TimeTracker::recover_from_journal() {
+    const bool is_valid = (journal.magic == TIME_TRACKER_JOURNAL_MAGIC) &&
+                          (journal.check == get_journal_check(journal)) && (journal.session == data.active_session);
+    if (!is_valid)
+        return false;
+
+    /* The journal is never behind the checkpoint, which may have been staged and lost with the reset */
+    auto& entry            = data.tracking_entries[data.active_session];
+    entry.work_time_us     = std::max(entry.work_time_us, journal.work_time_us);
+    entry.meeting_time_us  = std::max(entry.meeting_time_us, journal.meeting_time_us);
+    previous_tracking_type = journal.tracking_type;
+    return true;
 }
 
 void TimeTracker::factory_init() {
     data.magic               = BLOB_MAGIC;
     data.medium_threshold_ms = MEDIUM_THRESHOLD_MS_DEFAULT;
     data.long_threshold_ms   = LONG_THRESHOLD_MS_DEFAULT;
+    data.persistence_policy  = TIME_TRACKER_POLICY_DEFAULT;
+    data.thresholds_reached.reset();
 
     for (auto& entry : data.tracking_entries) {
         entry.start_time_us            = 0;
@@ -112,6 +198,7 @@ void TimeTracker::factory_init() {
     data.active_session = 0;
 
     save_tracking_data();
+    invalidate_journal();
 }
 
 bool TimeTracker::is_factory_required() const {
@@ -146,11 +233,10 @@ void TimeTracker::resume_tracking() {
 }
 
 void TimeTracker::check_thresholds() {
-    const auto& entry = data.tracking_entries[data.active_session];
-    if (entry.medium_threshold_reached) {
+    if (is_threshold_reached(TimeTrackerThreshold::MEDIUM)) {
         led_enable(FUNCTION_KEY_ID, Color::Yellow);
     }
-    if (entry.long_threshold_reached) {
+    if (is_threshold_reached(TimeTrackerThreshold::LONG)) {
         led_enable(FUNCTION_KEY_ID, Color::Red);
     }
 }
@@ -284,18 +370,21 @@ void TimeTracker::handle_key_2_press(const bool is_long_press) {
 }
 
 void TimeTracker::initialize_new_session() {
-    auto& entry                    = data.tracking_entries[data.active_session];
-    entry.start_time_us            = 0;
-    entry.work_time_us             = 0;
-    entry.meeting_time_us          = 0;
-    entry.tracking_work            = false;
-    entry.tracking_meetings        = false;
-    entry.tracking_date            = time.get_current_date_and_time();
-    entry.medium_threshold_reached = false;
-    entry.long_threshold_reached   = false;
+    auto& entry             = data.tracking_entries[data.active_session];
+    entry.start_time_us     = 0;
+    entry.work_time_us      = 0;
+    entry.meeting_time_us   = 0;
+    entry.tracking_work     = false;
+    entry.tracking_meetings = false;
+    entry.tracking_date     = time.get_current_date_and_time();
+    data.thresholds_reached.clear(get_threshold_flag(data.active_session, TimeTrackerThreshold::MEDIUM));
+    data.thresholds_reached.clear(get_threshold_flag(data.active_session, TimeTrackerThreshold::LONG));
 }
 
 void TimeTracker::move_to_next_session(bool animate) {
+    /* The time tracked until now belongs to the session being closed */
+    restart_clock(TrackingType::NONE);
+    append_session_close_events(storage, time.get_current_time_ms(), data.tracking_entries[data.active_session]);
     if (data.active_session < (MAX_TIME_TRACKER_ENTRIES_COUNT - 1)) {
         data.active_session++;
     } else {
@@ -304,13 +393,19 @@ void TimeTracker::move_to_next_session(bool animate) {
     stop_tracking();
     disable_all_leds();
     initialize_new_session();
+    save_tracking_data();
+    checkpoints.mark_saved();
+    update_journal();
     if (animate) {
         next_session_animation(Color::Green);
     }
 }
 
 void TimeTracker::tracker(const uint key_id, const bool is_long_press) {
-    auto& entry = data.tracking_entries[data.active_session];
+    const SessionId session = data.active_session;
+    auto& entry             = data.tracking_entries[session];
+    const bool was_work     = entry.tracking_work;
+    const bool was_meeting  = entry.tracking_meetings;
 
     set_tracking_date();
 
@@ -321,6 +416,17 @@ void TimeTracker::tracker(const uint key_id, const bool is_long_press) {
         /* Unexpected key_id */
         default: return;
     }
+
+    restart_clock();
+    update_journal();
+    schedule_threshold_alarm();
+    /* Wall clock time, the storage rebases the ring if it was not synchronized yet */
+    append_transition_events(storage, time.get_current_time_ms(), entry, was_work, was_meeting);
+
+    /* A new session has been saved already */
+    const bool is_transition = (entry.tracking_work != was_work) || (entry.tracking_meetings != was_meeting);
+    if ((data.active_session == session) && is_transition)
+        checkpoint(true);
 }
 
 void TimeTracker::handle(Buttons& buttons) {
@@ -331,11 +437,17 @@ void TimeTracker::handle(Buttons& buttons) {
         const bool is_long_press         = button_state.is_long_press;
         tracker(key_id, is_long_press);
     }
+
+    /* Nothing counts the time in the background, it is read when needed */
+    if ((time_us_64() - journal_update_us) >= (JOURNAL_INTERVAL_MS * MICROSECONDS_IN_MILISECOND_COUNT))
+        update_journal();
+    if (checkpoints.is_pending(clock))
+        checkpoint(false);
 }
 
 std::string TimeTracker::get_log(uint log_id) const {
     std::string log;
-    auto& entry = data.tracking_entries[data.active_session];
+    const TimeTrackingEntry_t entry = get_live_entry(data.active_session);
     switch (static_cast<TimeTrackerLog>(log_id)) {
         case TimeTrackerLog::CURRENT_WORK_TIME_REPORT: {
             const uint64_t total_seconds = entry.work_time_us / MICROSECONDS_IN_SECOND_COUNT;
@@ -373,15 +485,17 @@ FeatureCmdResult TimeTracker::get_cmd(const FeatureCommand& command) const {
         const uint32_t session_id = std::get<GetTimeTrackerEntryCmd>(command).session_id;
         /* Current session case */
         if (session_id == uint32_t(-1)) {
-            return { FeatureCmdStatus::SUCCESS, data.tracking_entries[data.active_session] };
+            return { FeatureCmdStatus::SUCCESS, get_live_entry(data.active_session) };
         } else {
             if (session_id >= MAX_TIME_TRACKER_ENTRIES_COUNT) {
                 return { FeatureCmdStatus::INVALID_PAYLOAD, std::monostate{} };
             }
-            return { FeatureCmdStatus::SUCCESS, data.tracking_entries[session_id] };
+            return { FeatureCmdStatus::SUCCESS, get_live_entry(session_id) };
         }
     } else if (std::holds_alternative<GetTimeTrackerCurrentActiveSessionIdCmd>(command)) {
         return { FeatureCmdStatus::SUCCESS, data.active_session };
+    } else if (std::holds_alternative<GetTimeTrackerPersistencePolicyCmd>(command)) {
+        return { FeatureCmdStatus::SUCCESS, data.persistence_policy };
     }
     return { FeatureCmdStatus::INVALID_COMMAND, std::monostate{} };
 }
@@ -389,6 +503,7 @@ FeatureCmdResult TimeTracker::get_cmd(const FeatureCommand& command) const {
 FeatureCmdStatus TimeTracker::set_cmd(const FeatureCommand& command) {
     if (std::holds_alternative<NewTimeTrackerSessionCmd>(command)) {
         move_to_next_session(false);
+        schedule_threshold_alarm();
         return FeatureCmdStatus::SUCCESS;
     } else if (std::holds_alternative<SetTimeTrackerMediumThresholdCmd>(command)) {
         const auto threshold_ms = std::get<SetTimeTrackerMediumThresholdCmd>(command).threshold_ms;
@@ -397,6 +512,7 @@ FeatureCmdStatus TimeTracker::set_cmd(const FeatureCommand& command) {
         }
         data.medium_threshold_ms = threshold_ms;
         save_tracking_data();
+        schedule_threshold_alarm();
         return FeatureCmdStatus::SUCCESS;
     } else if (std::holds_alternative<SetTimeTrackerLongThresholdCmd>(command)) {
         const auto threshold_ms = std::get<SetTimeTrackerLongThresholdCmd>(command).threshold_ms;
@@ -405,10 +521,20 @@ FeatureCmdStatus TimeTracker::set_cmd(const FeatureCommand& command) {
         }
         data.long_threshold_ms = threshold_ms;
         save_tracking_data();
+        schedule_threshold_alarm();
+        return FeatureCmdStatus::SUCCESS;
+    } else if (std::holds_alternative<SetTimeTrackerPersistencePolicyCmd>(command)) {
+        const auto& policy = std::get<SetTimeTrackerPersistencePolicyCmd>(command).policy;
+        if (!is_policy_valid(policy)) {
+            return FeatureCmdStatus::INVALID_PAYLOAD;
+        }
+        data.persistence_policy = policy;
+        save_tracking_data();
         return FeatureCmdStatus::SUCCESS;
     } else if (std::holds_alternative<GetTimeTrackerEntryCmd>(command)) {
         return FeatureCmdStatus::SET_COMMAND_UNSUPPORTED;
-    } else if (std::holds_alternative<GetTimeTrackerCurrentActiveSessionIdCmd>(command)) {
+    } else if (std::holds_alternative<GetTimeTrackerCurrentActiveSessionIdCmd>(command) ||
+               std::holds_alternative<GetTimeTrackerPersistencePolicyCmd>(command)) {
         return FeatureCmdStatus::GET_COMMAND_UNSUPPORTED;
     }
     return FeatureCmdStatus::INVALID_COMMAND;
@@ -26,6 +26,7 @@
 
 #include "buttons_config.hpp"
 #include "buttons_interrupt.hpp"
+#include "keys_config_types.hpp"
 #include "leds_config.hpp"
 #include "pico/stdlib.h"
 #include "storage.hpp"
@@ -36,7 +37,6 @@ typedef struct {
     Color color;
 } KeyConfigTableEntry_t;
 
-constexpr uint MAX_KEYS_COUNT              = 10;
 constexpr uint LONG_PRESS_DELAY_MS_DEFAULT = 800;
 
 enum class LedsMode {
@@ -45,12 +45,6 @@ enum class LedsMode {
     NONE,
 };
 
-typedef struct {
-    uint32_t magic;
-    ButtonConfig keys[MAX_KEYS_COUNT];
-    uint32_t keys_count;
-} KeysConfig_t;
-
 class KeysConfig {
   public:
     KeysConfig(std::vector<ButtonConfig> keys_default, Storage& storage_)
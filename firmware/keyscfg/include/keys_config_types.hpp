@@ -0,0 +1,35 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "buttons_config.hpp"
+#include "storage.hpp"
+
+constexpr uint MAX_KEYS_COUNT = 10;
+
+typedef struct {
+    uint32_t magic;
+    ButtonConfig keys[MAX_KEYS_COUNT];
+    uint32_t keys_count;
+} KeysConfig_t;
+static_assert(sizeof(KeysConfig_t) <= get_blob_max_size(BlobType::KEYS_CONFIG), "KeysConfig_t exceeds its blob size.");
+static_assert(get_blob_schema(BlobType::KEYS_CONFIG) == 0, "KEYS_CONFIG schema changed without a migration.");
@@ -0,0 +1,115 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <array>
+#include <bit>
+#include <gtest/gtest.h>
+
+#include "emulated_flash.hpp"
+#include "keys_config_types.hpp"
+#include "storage.hpp"
+
+namespace {
+
+/* The image below is laid out for the 20 bytes the RP2040 build gives a ButtonConfig */
+static_assert(sizeof(ButtonConfig) == 20, "ButtonConfig layout differs from the firmware build.");
+
+constexpr size_t KEYS_CONFIG_V0_SIZE = 208;
+
+/* Keys blob as the firmware before schemas stored it for its three default keys */
+constexpr std::array<uint8_t, KEYS_CONFIG_V0_SIZE> KEYS_CONFIG_V0_IMAGE = [] {
+    std::array<uint8_t, KEYS_CONFIG_V0_SIZE> image{};
+    /* button_id, gpio, key_value with its variant index and padding, color, enabled with padding */
+    const std::array<uint8_t, 64> head = {
+        0xEF, 0xBE, 0xAD, 0xDE, /* magic */
+        0x00, 0x00, 0x00, 0x00, 0x0C, 0x00, 0x00, 0x00, 0x19, 0x00, 0x00, 0x00, /* Key::V on gpio 12 */
+        0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,                         /* Color::Red */
+        0x01, 0x00, 0x00, 0x00, 0x0D, 0x00, 0x00, 0x00, 0x06, 0x00, 0x00, 0x00, /* Key::C on gpio 13 */
+        0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,                         /* Color::Green */
+        0x02, 0x00, 0x00, 0x00, 0x0E, 0x00, 0x00, 0x00, 0x08, 0x01, 0x00, 0x00, /* Modifier::LEFT_CMD on gpio 14 */
+        0x02, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,                         /* Color::Blue */
+    };
+    std::ranges::copy(head, image.begin());
+    /* keys[3..9] stay zeroed, keys_count closes the blob */
+    image[KEYS_CONFIG_V0_SIZE - 4] = 0x03;
+    return image;
+}();
+
+constexpr uint32_t LOG_START = STORAGE_LOG_FIRST_SECTOR * FLASH_SECTOR_SIZE;
+
+} // namespace
+
+class KeysConfigTest : public ::testing::Test {
+  protected:
+    EmulatedFlash flash{ STORAGE_SIZE };
+
+    void expect_default_keys(const KeysConfig_t& config) {
+        const ButtonConfig expected[] = {
+            { 0, 12, Key::V, Color::Red, true },
+            { 1, 13, Key::C, Color::Green, true },
+            { 2, 14, Modifier::LEFT_CMD, Color::Blue, true },
+        };
+
+        EXPECT_EQ(config.magic, BLOB_MAGIC);
+        ASSERT_EQ(config.keys_count, std::size(expected));
+        for (uint i = 0; i < config.keys_count; ++i) {
+            EXPECT_EQ(config.keys[i].button_id, expected[i].button_id);
+            EXPECT_EQ(config.keys[i].gpio, expected[i].gpio);
+            EXPECT_EQ(config.keys[i].key_value, expected[i].key_value);
+            EXPECT_EQ(config.keys[i].color, expected[i].color);
+            EXPECT_EQ(config.keys[i].enabled, expected[i].enabled);
+        }
+    }
+};
+
+TEST_F(KeysConfigTest, SchemaZeroImageMatchesTheLayout) {
+    static_assert(sizeof(KeysConfig_t) == KEYS_CONFIG_V0_SIZE, "KEYS_CONFIG layout changed without a migration.");
+
+    expect_default_keys(std::bit_cast<KeysConfig_t>(KEYS_CONFIG_V0_IMAGE));
+}
+
+TEST_F(KeysConfigTest, SchemaZeroSlotIsImported) {
+    /* The keys slot of the fixed 2 KB layout, imported as schema 0 on boot */
+    std::ranges::copy(KEYS_CONFIG_V0_IMAGE, flash.raw().begin() + LOG_START + 2 * BLOB_SLOT_SIZE_BYTES);
+
+    Storage storage(flash);
+    ASSERT_EQ(storage.init(), StorageStatus::SUCCESS);
+
+    std::array<uint8_t, sizeof(KeysConfig_t)> bytes;
+    ASSERT_EQ(storage.get_blob(BlobType::KEYS_CONFIG, bytes), StorageStatus::SUCCESS);
+    EXPECT_EQ(bytes, KEYS_CONFIG_V0_IMAGE);
+    expect_default_keys(std::bit_cast<KeysConfig_t>(bytes));
+}
+
+TEST_F(KeysConfigTest, ImportedKeysSurviveReboot) {
+    std::ranges::copy(KEYS_CONFIG_V0_IMAGE, flash.raw().begin() + LOG_START + 2 * BLOB_SLOT_SIZE_BYTES);
+    {
+        Storage storage(flash);
+        ASSERT_EQ(storage.init(), StorageStatus::SUCCESS);
+    }
+
+    Storage storage(flash);
+    ASSERT_EQ(storage.init(), StorageStatus::SUCCESS);
+
+    std::array<uint8_t, sizeof(KeysConfig_t)> bytes;
+    ASSERT_EQ(storage.get_blob(BlobType::KEYS_CONFIG, bytes), StorageStatus::SUCCESS);
+    EXPECT_EQ(bytes, KEYS_CONFIG_V0_IMAGE);
+}
@@ -21,7 +21,11 @@
 
 #pragma once
 
+#ifdef UNIT_TEST
+#include <cstdint>
+#else
 #include "pico/stdlib.h"
+#endif
 
 #define DEFAULT_LED_PIN 18
 #define DEFAULT_FREQ 800000
@@ -19,8 +19,6 @@
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include <ranges>
-
 #include "keys_config.hpp"
 #include "leds.hpp"
 #include "leds_config.hpp"
@@ -83,16 +81,17 @@ void Leds::disable_all(bool r) {
         refresh();
 }
 
-void Leds::push_led(const Led& led) const {
+/* In RAM only to shorten the XIP fetches of core1, the flash lockout is what keeps them safe during writes */
+void __not_in_flash_func(Leds::push_led)(const Led& led) const {
     const uint32_t color = (static_cast<uint32_t>(led.red) << 16) |
         (static_cast<uint32_t>(led.green) << 8) | (static_cast<uint32_t>(led.blue));
 
     pio_sm_put_blocking(pio, sm, color << 8u);
 }
 
-void Leds::refresh() const {
-    for (const auto led : std::ranges::reverse_view(leds)) {
-        push_led(led);
+void __not_in_flash_func(Leds::refresh)() const {
+    for (size_t i = leds.size(); i > 0; i--) {
+        push_led(leds[i - 1]);
     }
 }
 
@@ -129,7 +128,7 @@ void Leds::update_led_states() {
     }
 }
 
-void leds_task(Leds& leds, const Buttons& buttons) {
+void __not_in_flash_func(leds_task)(Leds& leds, const Buttons& buttons) {
     switch (leds.mode()) {
         case LedsMode::WHEN_BUTTON_PRESSED: {
             const std::vector<Button> btns = buttons.get_btns();
@@ -0,0 +1,106 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <array>
+
+#include "crc32.hpp"
+
+#ifndef UNIT_TEST
+#include "hardware/dma.h"
+#endif
+
+namespace {
+
+constexpr uint32_t CRC32_POLYNOMIAL = 0xEDB88320;
+
+constexpr std::array<uint32_t, 256> make_crc32_table() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t byte = 0; byte < table.size(); ++byte) {
+        uint32_t crc = byte;
+        for (uint32_t bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLYNOMIAL : 0);
+        }
+        table[byte] = crc;
+    }
+    return table;
+}
+
+constexpr auto CRC32_TABLE = make_crc32_table();
+
+uint32_t crc32_table_update(uint32_t crc, std::span<const uint8_t> data) {
+    crc = ~crc;
+    for (const uint8_t byte : data) {
+        crc = CRC32_TABLE[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#ifndef UNIT_TEST
+/* Below this length setting up the transfer costs more than the lookup table */
+constexpr size_t CRC32_DMA_MIN_LENGTH = 64;
+
+uint32_t reverse_bits(uint32_t value) {
+    uint32_t reversed = 0;
+    for (uint bit = 0; bit < 32; ++bit) {
+        reversed = (reversed << 1) | ((value >> bit) & 1);
+    }
+    return reversed;
+}
+
+/*
+ * The sniffer works on bit reversed data with a non-reflected register, so the seed is reversed
+ * on the way in and the result on the way out (done by the hardware) to match the table variant.
+ */
+uint32_t crc32_dma_update(uint channel, uint32_t crc, std::span<const uint8_t> data) {
+    static uint8_t sink;
+
+    dma_channel_config config = dma_channel_get_default_config(channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_sniff_enable(&config, true);
+
+    dma_sniffer_enable(channel, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+    dma_sniffer_set_output_reverse_enabled(true);
+    dma_sniffer_set_output_invert_enabled(true);
+    dma_sniffer_set_data_accumulator(reverse_bits(~crc));
+
+    dma_channel_configure(channel, &config, &sink, data.data(), data.size(), true);
+    dma_channel_wait_for_finish_blocking(channel);
+
+    const uint32_t result = dma_sniffer_get_data_accumulator();
+    dma_sniffer_disable();
+
+    return result;
+}
+#endif
+
+} // namespace
+
+uint32_t crc32_update(uint32_t crc, std::span<const uint8_t> data) {
+#ifndef UNIT_TEST
+    static const int channel = dma_claim_unused_channel(false);
+    if ((channel >= 0) && (data.size() >= CRC32_DMA_MIN_LENGTH)) {
+        return crc32_dma_update(static_cast<uint>(channel), crc, data);
+    }
+#endif
+    return crc32_table_update(crc, data);
+}
@@ -0,0 +1,74 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Encodings for blob fields which NOR flash can update without erasing, see
+ * Storage::save_blob() with a clear-only offset. Both start erased (all bits set) and every update
+ * only clears bits, so a program cut short by a power loss leaves a value between the old and the
+ * new one. Place them at the end of the blob, after all the regular fields.
+ */
+
+/* Counts up to `Bytes` * 8 as the number of cleared bits */
+template <size_t Bytes> struct ThermometerCounter {
+    static constexpr uint32_t capacity = Bytes * 8;
+
+    std::array<uint8_t, Bytes> bits;
+
+    void reset() { bits.fill(0xFF); }
+
+    uint32_t get() const {
+        uint32_t count = 0;
+        for (const uint8_t byte : bits) {
+            count += static_cast<uint32_t>(8 - std::popcount(byte));
+        }
+        return count;
+    }
+
+    bool is_full() const { return get() == capacity; }
+
+    /* Returns false, leaving the counter full, when it cannot count that far */
+    bool increment(uint32_t count = 1) {
+        for (uint8_t& byte : bits) {
+            for (; (count > 0) && (byte != 0); --count) {
+                byte &= static_cast<uint8_t>(byte - 1); /* The lowest set bit */
+            }
+        }
+        return count == 0;
+    }
+};
+
+/* One-way flags, set by clearing their bit */
+template <size_t Flags> struct FlagBitmap {
+    std::array<uint8_t, (Flags + 7) / 8> bits;
+
+    void reset() { bits.fill(0xFF); }
+    bool is_set(size_t flag) const { return (bits[flag / 8] & (1u << (flag % 8))) == 0; }
+    void set(size_t flag) { bits[flag / 8] &= static_cast<uint8_t>(~(1u << (flag % 8))); }
+    /* Sets the bit back, so the save doing it cannot be programmed in place */
+    void clear(size_t flag) { bits[flag / 8] |= static_cast<uint8_t>(1u << (flag % 8)); }
+};
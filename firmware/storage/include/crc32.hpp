@@ -0,0 +1,32 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+/*
+ * CRC-32 (IEEE 802.3 polynomial, reflected, as used by zlib), continued from a previous crc.
+ * Pass 0 to start a new checksum. Long buffers go through the DMA sniffer when a DMA channel
+ * is available, everything else is computed with a lookup table.
+ */
+uint32_t crc32_update(uint32_t crc, std::span<const uint8_t> data);
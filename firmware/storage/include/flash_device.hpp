@@ -0,0 +1,51 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include "flash_timing.hpp"
+
+/*
+ * Raw access to the flash region backing the Storage.
+ * Offsets are relative to the beginning of the region. Erase works on whole sectors
+ * (FLASH_SECTOR_SIZE), program on whole pages (FLASH_PAGE_SIZE) and, as on NOR flash,
+ * programming can only clear bits - bytes written as 0xFF leave the flash untouched.
+ * Implementations record how long each operation took into timings.
+ */
+class FlashDevice {
+  public:
+    virtual ~FlashDevice() = default;
+
+    /* Memory-mapped view of the whole region */
+    virtual const uint8_t* data() const = 0;
+    virtual uint32_t size() const       = 0;
+
+    virtual void erase(uint32_t offset, uint32_t count)                  = 0;
+    virtual void program(uint32_t offset, std::span<const uint8_t> data) = 0;
+
+    const FlashTimings& get_timings() const { return timings; }
+
+  protected:
+    FlashTimings timings;
+};
@@ -0,0 +1,87 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+enum class FlashTimingType : uint8_t {
+    ERASE, /* Interrupts are disabled for the whole erase or program, they are that window */
+    PROGRAM,
+    CORE_LOCKOUT, /* The other core parked, entering and leaving the lockout included */
+    TYPES_COUNT,
+};
+
+/* Bucket 0 counts durations below FLASH_TIMING_FIRST_BUCKET_US, each next one doubles the limit */
+#define FLASH_TIMING_BUCKETS_COUNT 12
+#define FLASH_TIMING_FIRST_BUCKET_US 128
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_us; /* Worst case since boot */
+    uint64_t total_us;
+    uint32_t buckets[FLASH_TIMING_BUCKETS_COUNT]; /* The last one is open ended */
+} FlashTimingHistogram_t;
+
+static_assert(sizeof(FlashTimingHistogram_t) == 64, "FlashTimingHistogram_t is sent as is over the binary protocol.");
+
+class FlashTimings {
+  public:
+    void record(FlashTimingType type, uint32_t duration_us) {
+        add_sample(histograms[static_cast<size_t>(type)], duration_us);
+    }
+
+    static void add_sample(FlashTimingHistogram_t& histogram, uint32_t duration_us) {
+        histogram.count++;
+        histogram.max_us = std::max(histogram.max_us, duration_us);
+        histogram.total_us += duration_us;
+        histogram.buckets[get_bucket(duration_us)]++;
+    }
+
+    const FlashTimingHistogram_t& get(FlashTimingType type) const { return histograms[static_cast<size_t>(type)]; }
+
+    static constexpr size_t get_bucket(uint32_t duration_us) {
+        const size_t bucket = static_cast<size_t>(std::bit_width(duration_us / FLASH_TIMING_FIRST_BUCKET_US));
+        return std::min(bucket, static_cast<size_t>(FLASH_TIMING_BUCKETS_COUNT - 1));
+    }
+
+    /* Upper limit of a bucket, the last one has none */
+    static constexpr uint32_t get_bucket_limit_us(size_t bucket) { return FLASH_TIMING_FIRST_BUCKET_US << bucket; }
+
+    /* Upper limit of the bucket holding the given percentile, never above the worst case */
+    static uint32_t get_percentile_us(const FlashTimingHistogram_t& histogram, uint32_t percent) {
+        const uint64_t rank = ((static_cast<uint64_t>(histogram.count) * percent) + 99) / 100;
+        uint64_t count      = 0;
+        for (size_t bucket = 0; bucket < (FLASH_TIMING_BUCKETS_COUNT - 1); ++bucket) {
+            count += histogram.buckets[bucket];
+            if ((count >= rank) && (count > 0))
+                return std::min(get_bucket_limit_us(bucket), histogram.max_us);
+        }
+        return histogram.max_us;
+    }
+
+  private:
+    std::array<FlashTimingHistogram_t, static_cast<size_t>(FlashTimingType::TYPES_COUNT)> histograms{};
+};
@@ -0,0 +1,62 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "hardware/flash.h"
+#include "hardware/timer.h"
+#include "pico/flash.h"
+
+#include "flash_device.hpp"
+
+/*
+ * Storage region placed in the on-board QSPI flash, read through XIP.
+ * Erases and programs go through flash_safe_execute(), which disables interrupts and parks core1
+ * in its RAM lockout handler for the duration of the operation. Core1 has to call
+ * flash_safe_execute_core_init() before the first flash write made while it runs.
+ */
+class PicoFlash : public FlashDevice {
+  public:
+    PicoFlash(uint32_t flash_offset_, uint32_t size_) : flash_offset(flash_offset_), region_size(size_) {}
+    ~PicoFlash() override = default;
+
+    const uint8_t* data() const override {
+        return reinterpret_cast<const uint8_t*>(XIP_BASE + flash_offset);
+    }
+    uint32_t size() const override { return region_size; }
+
+    void erase(uint32_t offset, uint32_t count) override;
+    void program(uint32_t offset, std::span<const uint8_t> data) override;
+
+  private:
+    typedef struct {
+        uint32_t offset; /* From the beginning of the flash */
+        uint32_t count;
+        const uint8_t* data; /* nullptr for an erase */
+        uint32_t duration_us;
+    } FlashOperation_t;
+
+    const uint32_t flash_offset;
+    const uint32_t region_size;
+
+    void execute(FlashTimingType type, FlashOperation_t& operation);
+    static void run_operation(void* param);
+};
@@ -21,65 +21,380 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <optional>
 #include <span>
-#include <vector>
 
+#ifdef UNIT_TEST
+#include "mock_flash.hpp"
+#else
 #include "hardware/flash.h"
-#include "hardware/sync.h"
+#include "hardware/timer.h"
 #include "pico/mutex.h"
+#endif
 
+#include "flash_device.hpp"
 #include "storage_config.hpp"
+#include "storage_types.hpp"
 
 enum StorageStatus {
     SUCCESS,
     INVALID_ID,
     INVALID_INPUT,
+    NOT_FOUND,
+    NO_SPACE,
     ERROR,
 };
 
-using BlobBuff_t = std::array<uint8_t, BLOB_SLOT_SIZE_BYTES>;
+typedef struct {
+    uint32_t writes_performed;
+    uint32_t writes_elided;    /* Saves identical to the stored blob */
+    uint32_t writes_coalesced; /* Saves replaced by a newer one before being committed */
+    uint32_t inline_erases;    /* Sectors a save had to erase itself, the spare pool ran dry */
+    uint32_t writes_in_place;  /* Saves programmed over the stored record, see save_blob() */
+} StorageStats_t;
 
+typedef struct {
+    uint32_t validation_us;     /* Scanning and checking the whole log */
+    uint32_t corrupted_records; /* Records failing their CRC, torn writes included */
+    uint32_t recovered_blobs;   /* Blobs rolled back to their newest intact version */
+    uint32_t erases;            /* Sectors init() had to erase, normally none */
+} StorageBootReport_t;
+
+typedef struct {
+    uint32_t max_erase_count; /* Of the most worn sector */
+    uint32_t total_erases;
+    uint32_t boot_erases; /* Since boot, the rate the projection is based on */
+    uint32_t hours_left;  /* Until a sector reaches FLASH_ENDURANCE_CYCLES, UINT32_MAX if unknown */
+} StorageWearReport_t;
+
+/* A record of the event ring as read back, see append_event() */
+typedef struct {
+    uint32_t sequence;
+    uint8_t key;
+    uint8_t type;
+    uint64_t time_ms;
+} StorageEvent_t;
+
+typedef struct {
+    uint32_t oldest_sequence; /* Of the oldest record still in the ring */
+    uint32_t next_sequence;   /* The next record will get */
+} StorageEventRange_t;
+
+typedef struct {
+    uint32_t quiet_ms;         /* Commit once no blob was saved for this long */
+    uint32_t max_staleness_ms; /* Commit at the latest this long after the oldest pending save */
+} WriteBackPolicy_t;
+
+/*
+ * Upgrade of a blob from `from_schema` to the next schema. migrate() produces the bytes
+ * [offset, offset + window.size()) of the new layout out of the old blob, which is read in place
+ * from the flash. The window comes filled with 0xFF, see copy_to_window().
+ */
+typedef struct {
+    uint8_t from_schema;
+    uint32_t new_size;
+    void (*migrate)(std::span<const uint8_t> old_blob, uint32_t offset, std::span<uint8_t> window);
+} BlobMigration_t;
+
+/* Copies the part of `bytes`, placed at `position` of a blob, which falls into the window at `offset` */
+inline void copy_to_window(
+    std::span<uint8_t> window, uint32_t offset, uint32_t position, std::span<const uint8_t> bytes) {
+    const uint32_t first = std::max(offset, position);
+    const uint32_t last  = std::min(offset + static_cast<uint32_t>(window.size()),
+         position + static_cast<uint32_t>(bytes.size()));
+    if (first < last)
+        std::copy(bytes.begin() + (first - position), bytes.begin() + (last - position), window.begin() + (first - offset));
+}
+
+/*
+ * Log-structured blob store.
+ *
+ * Saving a blob appends a versioned record to the head of a log kept in pre-erased sectors, so a
+ * save normally costs a single page program. Only the difference against the stored version is
+ * written when it is small enough. Sectors are reclaimed one at a time from the tail of the log
+ * by relocating the blobs that still live there. Each zone of STORAGE_LAYOUT is a separate log.
+ *
+ * Reclaimed sectors and retired extent slots are only marked dirty, task() erases them one sector
+ * at a time while the firmware is idle. Saves find the sectors they need pre-erased and pay for
+ * programming only, unless they outrun the background erasing.
+ *
+ * In write-back mode saves only update a RAM copy of the blob. Pending blobs are committed by
+ * task() when the policy says so or by flush(), atomically for all blobs of a zone.
+ *
+ * Counters and flags encoded to only ever clear bits (see clear_only_counters.hpp) are programmed
+ * over the stored record, without appending anything, see save_blob().
+ *
+ * Boots and erases of every sector are counted in the wear sectors, see WearSectorHeader_t, so a
+ * boot normally programs a single bit and erases nothing.
+ *
+ * Blobs stored with an older schema than the one in BLOB_LAYOUT read as missing until migrate()
+ * upgrades them.
+ */
 class Storage {
   public:
-    Storage(mutex_t& mutex_);
+    explicit Storage(FlashDevice& flash_);
     ~Storage() = default;
     StorageStatus init();
     StorageStatus factory_init();
 
   private:
+    static constexpr uint blobs_count = static_cast<uint>(BlobType::BLOBS_COUNT);
+    static_assert(blobs_count <= 32, "Blob bit masks do not fit into uint32_t.");
+
+    typedef struct {
+        uint32_t base_offset; /* Latest FULL record */
+        uint32_t version;
+        uint32_t size;
+        uint8_t schema;
+    } BlobIndexEntry_t;
+
+    typedef struct {
+        StorageZone_t layout;
+        uint32_t sequence;
+        uint head_sector;
+        uint tail_sector;
+        uint32_t head_offset; /* LOG_OFFSET_NONE until the first record opens the head sector */
+    } LogZone_t;
+
+    typedef struct {
+        std::array<uint32_t, blobs_count> max_version; /* Dropped records included */
+        uint32_t damaged_blobs;                        /* Bit per blob to rewrite */
+    } ScanState_t;
+
+    typedef struct {
+        LogRecordKind kind;
+        uint16_t offset;
+        uint16_t length;
+        bool in_place; /* Programmed over the clear-only tail of the stored FULL record */
+    } RecordPlan_t;
+
+    static constexpr uint16_t clear_only_none = UINT16_MAX;
+
+
+    FlashDevice& flash;
+    /*
+     * Only the core0 main loop uses the storage, timer callbacks post to the WorkQueue and core1 runs the LEDs.
+     * The mutex keeps a caller on core1 from interleaving with an operation, it never guards against interrupts.
+     */
+    mutex_t mutex;
     StorageConfig_t s_config;
-    static constexpr uint blobs_per_sector = FLASH_SECTOR_SIZE / BLOB_SLOT_SIZE_BYTES;
-    std::vector<BlobBuff_t> sector;
-    uint32_t max_blob_id;
-    const uint8_t* storage_start_addr;
-    mutex_t& mutex;
-
-    const uint8_t* get_blob_address(uint blob_id) const;
-    uint get_sector_id(BlobType blob_type) const;
-    StorageStatus update_blob_in_sector(BlobType blob_type, std::span<uint8_t> blob);
-    StorageStatus read_sector(uint sector_id);
-    void save_sector(uint sector_id) const;
-    StorageStatus _get_blob(uint blob_id, std::span<uint8_t> blob) const;
+    std::array<BlobIndexEntry_t, blobs_count> index;
+    std::array<LogZone_t, STORAGE_ZONES_COUNT> zones;
+    std::array<uint32_t, STORAGE_SECTORS_COUNT> sector_end; /* End of the valid records */
+    std::array<bool, STORAGE_SECTORS_COUNT> dirty_sectors;  /* Unused, waiting to be erased by task() */
+    bool compacting;
+    StorageStats_t stats;
+    StorageBootReport_t boot_report;
+    std::optional<WriteBackPolicy_t> write_back;
+    uint32_t pending_blobs; /* Bit per blob staged in RAM */
+    uint64_t first_pending_ms;
+    uint64_t last_save_ms;
+    std::array<uint16_t, blobs_count> staged_size;
+    std::array<uint16_t, blobs_count> clear_only_offsets; /* Given to the latest save, clear_only_none if none */
+    std::array<uint8_t, STORAGE_STAGING_SIZE> staging;
+    std::array<uint8_t, FLASH_PAGE_SIZE> page; /* The only buffer used for writing and comparing */
+    FlashTimingHistogram_t save_latency;
+    std::array<uint32_t, STORAGE_SECTORS_COUNT> erase_counts;
+    std::array<uint32_t, STORAGE_SECTORS_COUNT> boot_erase_counts;
+    uint64_t boot_time_us;
+    uint wear_sector;
+    uint32_t wear_sequence;
+    uint32_t wear_offset; /* Next journal byte, LOG_OFFSET_NONE while folding */
+    uint32_t boot_count;  /* Since the last erase() or factory_init() */
+    uint32_t boot_bits;   /* Cleared in the boot page of the current wear sector */
+    uint event_head_sector;
+    uint32_t event_head_offset; /* Of the next record, LOG_OFFSET_NONE while the ring is empty */
+    uint32_t event_next_sequence;
+    uint64_t event_last_ms; /* Time of the newest record */
+
+    LogZone_t& get_zone(uint blob_id) { return zones[get_blob_zone(blob_id)]; }
+    const LogZone_t& get_zone(uint blob_id) const { return zones[get_blob_zone(blob_id)]; }
+    static uint32_t get_sector_start(uint sector_id) { return sector_id * FLASH_SECTOR_SIZE; }
+    static uint get_sector_id(uint32_t offset) { return offset / FLASH_SECTOR_SIZE; }
+    static uint next_sector(const LogZone_t& zone, uint sector_id) {
+        const uint first = zone.layout.first_sector;
+        return first + ((sector_id - first + 1) % zone.layout.sectors_count);
+    }
+    static uint used_sectors(const LogZone_t& zone) {
+        const uint count = zone.layout.sectors_count;
+        return ((zone.head_sector + count - zone.tail_sector) % count) + 1;
+    }
+    static uint free_sectors(const LogZone_t& zone) { return zone.layout.sectors_count - used_sectors(zone); }
+    static bool is_head_full(const LogZone_t& zone, uint32_t record_size) {
+        return (zone.head_offset + record_size) > get_sector_start(zone.head_sector + 1);
+    }
+    static uint64_t get_time_ms() { return time_us_64() / 1000; }
+    static uint32_t get_crc_length(const LogRecordHeader_t& record) {
+        return (record.flags & LOG_RECORD_FLAG_CLEAR_ONLY) ? record.offset : record.length;
+    }
+    bool is_pending(uint blob_id) const { return (pending_blobs & (1u << blob_id)) != 0; }
+    bool is_current_schema(uint blob_id) const { return index[blob_id].schema == BLOB_LAYOUT[blob_id].schema; }
+    std::span<uint8_t> get_staged(uint blob_id) {
+        return std::span<uint8_t>(staging.data() + get_blob_staging_offset(blob_id), staged_size[blob_id]);
+    }
+
+    void reset_index();
+    void reset_zone(LogZone_t& zone, uint first_sector);
+    bool scan_zone(LogZone_t& zone);
+    void scan_sector(const LogZone_t& zone, uint sector_id, ScanState_t& state);
+    void verify_extents(const LogZone_t& zone, ScanState_t& state);
+    void repair_blobs(const LogZone_t& zone, const ScanState_t& state);
+    bool import_legacy_slots();
+    bool is_erased(uint32_t offset, uint32_t count) const;
+    void erase_sector(uint sector_id);
+    void retire_sector(uint sector_id);
+    void prepare_sector(uint sector_id);
+    bool erase_dirty_sector();
+
+    static uint32_t calculate_wear_crc(const WearSectorHeader_t& header);
+    bool read_wear_header(uint sector_id, WearSectorHeader_t& header) const;
+    void load_wear_counters();
+    void count_boot();
+    void count_erase(uint sector_id);
+    void fold_wear_counters();
+
+    static uint next_event_sector(uint sector_id) {
+        const uint position = sector_id - STORAGE_EVENT_FIRST_SECTOR + 1;
+        return STORAGE_EVENT_FIRST_SECTOR + (position % STORAGE_EVENT_SECTORS_COUNT);
+    }
+    static uint16_t calculate_event_check(const EventRecord_t& record);
+    static uint64_t get_event_time(uint64_t previous_ms, const EventRecord_t& record);
+    bool read_event_header(uint sector_id, EventSectorHeader_t& header) const;
+    EventRecord_t read_event(uint32_t offset) const;
+    void load_events();
+    void open_event_sector(uint sector_id, uint64_t time_ms);
+    void program_event(uint32_t delta_ms, uint8_t key, uint8_t type);
+
+    LogRecordHeader_t read_record(uint32_t offset) const;
+    bool is_record_valid(const LogRecordHeader_t& record, uint32_t offset, uint32_t limit) const;
+    bool is_record_intact(const LogRecordHeader_t& record, uint32_t offset) const;
+    bool get_next_record(const LogZone_t& zone, uint32_t& offset) const;
+    uint32_t get_record_blob_size(const LogRecordHeader_t& record, uint32_t offset) const;
+    LogExtent_t read_extent(uint blob_id) const;
+    std::span<const uint8_t> get_base_payload(uint blob_id) const; /* Latest FULL record or the extent slot */
+    uint32_t materialize(uint blob_id, std::span<uint8_t> blob) const;
+    void materialize_range(uint blob_id, uint32_t start, std::span<uint8_t> window) const;
+
+    void open_sector(LogZone_t& zone, uint sector_id);
+    void drop_log(const LogZone_t& zone);
+    StorageStatus reserve(LogZone_t& zone, uint32_t record_size);
+    void compact_tail(LogZone_t& zone);
+    template <typename Fill> void write_record(uint32_t offset, const LogRecordHeader_t& header, Fill&& fill_payload);
+    template <typename Fill>
+    StorageStatus commit_record(uint blob_id, LogRecordKind kind, uint16_t offset, uint16_t length, uint8_t flags,
+        uint32_t min_version, Fill&& fill_payload);
+    StorageStatus append_record(uint blob_id, LogRecordKind kind, uint16_t offset, std::span<const uint8_t> payload,
+        uint8_t flags = LOG_RECORD_FLAG_NONE);
+    StorageStatus append_copy(uint blob_id, uint32_t min_version = 0);
+
+    static uint32_t get_extent_slot_start(uint blob_id, uint slot);
+    template <typename Fill> StorageStatus write_extent(uint blob_id, uint32_t size, uint8_t flags, Fill&& fill_content);
+    bool is_extent_identical(uint blob_id, std::span<const uint8_t> blob) const;
+    void retire_extent_slot(uint blob_id, uint32_t slot_start);
+
+    std::optional<RecordPlan_t> plan_record(uint blob_id, std::span<const uint8_t> blob);
+    bool is_clear_only_base(uint blob_id, uint16_t tail_offset) const;
+    bool can_program_in_place(uint blob_id, uint16_t offset, std::span<const uint8_t> bytes) const;
+    void program_in_place(uint blob_id, uint16_t offset, std::span<const uint8_t> bytes);
+    bool is_patch_identical(uint blob_id, uint16_t offset, std::span<const uint8_t> bytes);
+    StorageStatus stage_blob(uint blob_id, uint16_t size, uint16_t offset, std::span<const uint8_t> bytes);
+    StorageStatus write_plan(uint blob_id, const RecordPlan_t& plan, std::span<const uint8_t> blob, uint8_t flags);
+    StorageStatus commit_zone(LogZone_t& zone);
+    StorageStatus commit_pending();
+
     StorageStatus _get_blob(BlobType blob_type, std::span<uint8_t> blob) const;
-    StorageStatus _save_blob(BlobType blob_type, std::span<uint8_t> blob);
+    StorageStatus _save_blob(BlobType blob_type, std::span<uint8_t> blob, size_t clear_only_offset);
+    StorageStatus _patch_blob(BlobType blob_type, std::span<const uint8_t> blob, std::ptrdiff_t offset, size_t length);
+
+
+    static uint32_t calculate_record_crc(const LogRecordHeader_t& header, std::span<const uint8_t> payload);
 
     bool is_factory_required();
 
   public:
-    void erase() const;
-    void erase(uint sector_id) const;
+    /*
+     * Drops all blobs right away, the sectors holding them are only marked dirty and get erased by
+     * task(), one per call. Erase counters are kept.
+     */
+    void erase();
     uint32_t get_init_count() const;
+    StorageStats_t get_stats() const;
+    StorageBootReport_t get_boot_report() const;
+    StorageWearReport_t get_wear_report() const;
+    std::span<const uint32_t> get_erase_counts() const { return erase_counts; }
+    const FlashTimings& get_flash_timings() const { return flash.get_timings(); }
+    uint get_spare_sectors() const; /* Pre-erased sectors the logs can open without erasing */
+    uint get_dirty_sectors() const;
+    bool has_pending_blobs() const { return pending_blobs != 0; } /* Saved in write-back mode, not committed yet */
+    const FlashTimingHistogram_t& get_save_latency() const { return save_latency; } /* Of save_blob() and flush() */
+
+    /*
+     * Appends a record to the event ring, `type` being anything but EVENT_TYPE_TIME. Programs the
+     * record and erases nothing, only moving on to the next sector may erase inline when task() did
+     * not get to it yet. Returns INVALID_INPUT for EVENT_TYPE_TIME.
+     */
+    StorageStatus append_event(uint64_t time_ms, uint8_t key, uint8_t type);
+    /*
+     * Reads the records from `first_sequence` on, oldest first and without the time records, as many
+     * as fit into `events`. `next_sequence` is where the next page starts. Returns the count read.
+     */
+    uint32_t read_events(uint32_t first_sequence, std::span<StorageEvent_t> events, uint32_t& next_sequence) const;
+    StorageEventRange_t get_event_range() const;
+
+    void enable_write_back(
+        WriteBackPolicy_t policy = { STORAGE_WRITE_BACK_QUIET_MS, STORAGE_WRITE_BACK_MAX_STALENESS_MS });
+    StorageStatus disable_write_back();
+    StorageStatus flush();
+    void task();
+
+    /*
+     * Upgrades a blob stored with an older schema, one migration at a time. Every step is a single
+     * FULL record, a power loss in the middle leaves the previous schema to be migrated on the next
+     * boot. Returns INVALID_INPUT when no migration leads from the stored schema to the current one.
+     */
+    StorageStatus migrate(BlobType blob_type, std::span<const BlobMigration_t> migrations);
 
     template <typename T> StorageStatus save_blob(BlobType blob_type, T& config) {
-        static_assert(sizeof(T) <= BLOB_SLOT_SIZE_BYTES, "Blob size exceeds the maximum blob slot size.");
+        static_assert(sizeof(T) <= get_max_blob_size(), "Blob size exceeds the biggest blob in BLOB_LAYOUT.");
+        std::span<uint8_t> blob_span(reinterpret_cast<uint8_t*>(&config), sizeof(T));
+
+        return _save_blob(blob_type, blob_span, clear_only_none);
+    }
+
+    /*
+     * Saves a blob whose bytes from `clear_only_offset` to the end only ever get bits cleared, like
+     * ThermometerCounter or FlagBitmap. As long as the bytes before stay the same, the save is
+     * programmed in place over the stored FULL record. That tail is not covered by the CRC, a power
+     * loss halfway through the program leaves it between the old and the new content. Changes
+     * before the offset or setting bits of the tail write a new FULL record. Ignored for extent
+     * blobs and within a write-back commit of several blobs, which has to stay atomic.
+     */
+    template <typename T> StorageStatus save_blob(BlobType blob_type, T& config, size_t clear_only_offset) {
+        static_assert(sizeof(T) <= get_max_blob_size(), "Blob size exceeds the biggest blob in BLOB_LAYOUT.");
         std::span<uint8_t> blob_span(reinterpret_cast<uint8_t*>(&config), sizeof(T));
 
-        return _save_blob(blob_type, blob_span);
+        return _save_blob(blob_type, blob_span, clear_only_offset);
+    }
+
+    /*
+     * Saves only `member`, a field of `blob`, as a single DELTA record, without comparing the rest of
+     * the blob against the stored version. The blob has to be stored already, with the size of T and
+     * the current schema, NOT_FOUND otherwise. In write-back mode the staged copy is patched, the
+     * stored version is staged first when there is none.
+     */
+    template <typename T, typename M> StorageStatus patch(BlobType blob_type, const T& blob, const M& member) {
+        static_assert(sizeof(T) <= get_max_blob_size(), "Blob size exceeds the biggest blob in BLOB_LAYOUT.");
+        const auto* blob_bytes   = reinterpret_cast<const uint8_t*>(&blob);
+        const auto* member_bytes = reinterpret_cast<const uint8_t*>(&member);
+
+        return _patch_blob(
+            blob_type, std::span<const uint8_t>(blob_bytes, sizeof(T)), member_bytes - blob_bytes, sizeof(M));
     }
 
     template <typename T> StorageStatus get_blob(BlobType blob_type, T& config) const {
-        static_assert(sizeof(T) <= BLOB_SLOT_SIZE_BYTES, "Blob size exceeds the maximum blob slot size.");
+        static_assert(sizeof(T) <= get_max_blob_size(), "Blob size exceeds the biggest blob in BLOB_LAYOUT.");
         std::span<uint8_t> blob_span(reinterpret_cast<uint8_t*>(&config), sizeof(T));
 
         return _get_blob(blob_type, blob_span);
@@ -21,16 +21,33 @@
 
 #pragma once
 
+#ifdef UNIT_TEST
+#include "mock_flash.hpp"
+#else
 #include "hardware/flash.h"
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iterator>
 
 #define BLOB_SLOTS_COUNT 16
 #define BLOB_SLOT_SIZE_BYTES 2048
 #define BLOB_MAGIC 0xDEADBEEF
 
-#define STORAGE_SIZE (BLOB_SLOTS_COUNT * BLOB_SLOT_SIZE_BYTES)
-static_assert((STORAGE_SIZE % FLASH_SECTOR_SIZE) == 0, "The size of the storage must be multiple of sector size.");
+/* The log took over the fixed slots used by earlier firmware, at the very end of the flash */
+#define STORAGE_LOG_SIZE (BLOB_SLOTS_COUNT * BLOB_SLOT_SIZE_BYTES)
+static_assert((STORAGE_LOG_SIZE % FLASH_SECTOR_SIZE) == 0, "The size of the log must be multiple of sector size.");
+#define STORAGE_LOG_SECTORS_COUNT (STORAGE_LOG_SIZE / FLASH_SECTOR_SIZE)
 
-#define STORAGE_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - STORAGE_SIZE)
+/* Log records (see storage_types.hpp) start with a single LOG_RECORD_ALIGN sized header */
+#define LOG_RECORD_ALIGN 16
+#define LOG_SECTOR_CAPACITY (FLASH_SECTOR_SIZE - LOG_RECORD_ALIGN)
+
+constexpr uint32_t get_log_record_size(uint32_t length) {
+    return (LOG_RECORD_ALIGN + length + LOG_RECORD_ALIGN - 1) & ~(LOG_RECORD_ALIGN - 1u);
+}
 
 typedef struct {
     uint32_t magic;
@@ -42,5 +59,238 @@ enum class BlobType : uint {
     FEATURES_HANDLER_CONFIG,
     KEYS_CONFIG,
     TIME_TRACKER_DATA,
+#ifdef UNIT_TEST
+    TEST_EXTENT_DATA, /* Covers extents until a firmware blob needs them */
+    TEST_SCHEMA_DATA, /* Covers migrations with a layout changed once */
+#endif
     BLOBS_COUNT,
 };
+
+/* -------------------------------------------------------------------------- */
+/*                                 Blob layout                                */
+/* -------------------------------------------------------------------------- */
+
+enum class WriteClass : uint8_t {
+    COLD,   /* Written on user request or factory init */
+    HOT,    /* Written periodically while the device is running */
+    EXTENT, /* Too big for the log, written rarely, see get_extent_first_sector() */
+};
+
+typedef struct {
+    uint32_t max_size;
+    WriteClass write_class;
+    uint8_t schema; /* Bumped with every change of the blob's struct layout, see Storage::migrate() */
+} BlobLayout_t;
+
+/* Indexed by BlobType */
+constexpr BlobLayout_t BLOB_LAYOUT[] = {
+    /* STORAGE_CONFIG          */ { 64, WriteClass::COLD, 0 },
+    /* FEATURES_HANDLER_CONFIG */ { 64, WriteClass::COLD, 0 },
+    /* KEYS_CONFIG             */ { 512, WriteClass::COLD, 0 },
+    /* TIME_TRACKER_DATA       */ { BLOB_SLOT_SIZE_BYTES, WriteClass::HOT, 2 },
+#ifdef UNIT_TEST
+    /* TEST_EXTENT_DATA        */ { 10000, WriteClass::EXTENT, 0 },
+    /* TEST_SCHEMA_DATA        */ { 512, WriteClass::COLD, 1 },
+#endif
+};
+static_assert(std::size(BLOB_LAYOUT) == static_cast<size_t>(BlobType::BLOBS_COUNT), "Missing blob layout entry.");
+
+constexpr uint32_t get_blob_max_size(BlobType blob_type) {
+    return BLOB_LAYOUT[static_cast<uint>(blob_type)].max_size;
+}
+
+constexpr uint8_t get_blob_schema(BlobType blob_type) {
+    return BLOB_LAYOUT[static_cast<uint>(blob_type)].schema;
+}
+
+constexpr bool is_extent_blob(uint blob_id) {
+    return BLOB_LAYOUT[blob_id].write_class == WriteClass::EXTENT;
+}
+
+constexpr uint32_t get_max_blob_size() {
+    uint32_t size = 0;
+    for (const auto& blob : BLOB_LAYOUT) {
+        size = std::max(size, blob.max_size);
+    }
+    return size;
+}
+
+/*
+ * Blobs saved in write-back mode wait in RAM one after another, in BlobType order. Extent blobs
+ * are always written right away.
+ */
+constexpr uint32_t get_blob_staging_offset(uint blob_id) {
+    uint32_t offset = 0;
+    for (uint id = 0; id < blob_id; ++id) {
+        offset += is_extent_blob(id) ? 0 : BLOB_LAYOUT[id].max_size;
+    }
+    return offset;
+}
+
+#define STORAGE_STAGING_SIZE get_blob_staging_offset(static_cast<uint>(BlobType::BLOBS_COUNT))
+
+/* Default write-back policy, see Storage::enable_write_back() */
+#define STORAGE_WRITE_BACK_QUIET_MS 1000
+#define STORAGE_WRITE_BACK_MAX_STALENESS_MS 5000
+
+/*
+ * Extent blobs live outside of the log, each in two slots of whole sectors used in turns. A save
+ * erases and programs the slot not in use and then points the blob at it with a small EXTENT
+ * record in the log, so a blob of any size is switched atomically. The slots of all extent blobs
+ * come one after another at the beginning of the storage, in BlobType order.
+ */
+#define STORAGE_EXTENT_SLOTS_COUNT 2
+
+constexpr uint get_extent_slot_sectors(uint blob_id) {
+    return is_extent_blob(blob_id) ? ((BLOB_LAYOUT[blob_id].max_size + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE) : 0;
+}
+
+constexpr uint get_extent_first_sector(uint blob_id) {
+    uint sector = 0;
+    for (uint id = 0; id < blob_id; ++id) {
+        sector += STORAGE_EXTENT_SLOTS_COUNT * get_extent_slot_sectors(id);
+    }
+    return sector;
+}
+
+#define STORAGE_EXTENT_SECTORS_COUNT get_extent_first_sector(static_cast<uint>(BlobType::BLOBS_COUNT))
+
+/*
+ * Erase counters of all storage sectors, see WearSectorHeader_t. Two sectors used in turns, so the
+ * counters survive the erase of the one they were folded out of.
+ */
+#define STORAGE_WEAR_SECTORS_COUNT 2
+#define STORAGE_WEAR_FIRST_SECTOR STORAGE_EXTENT_SECTORS_COUNT
+#define STORAGE_WEAR_END_SECTOR (STORAGE_WEAR_FIRST_SECTOR + STORAGE_WEAR_SECTORS_COUNT)
+
+/*
+ * Ring of small records appended one after another, see EventRecord_t. An append programs a single
+ * record over erased flash. The sector after the head is kept free, so the ring moves on without
+ * waiting for an erase and drops its oldest sector a sector ahead of time.
+ */
+#define STORAGE_EVENT_SECTORS_COUNT 4
+#define STORAGE_EVENT_FIRST_SECTOR STORAGE_WEAR_END_SECTOR
+
+/* Erase cycles every sector is rated for, W25Q-class datasheets guarantee at least 100k */
+#define FLASH_ENDURANCE_CYCLES 100'000
+
+/* The region grows downwards with extents, wear counters and events, the log stays at the end of the flash */
+#define STORAGE_LOG_FIRST_SECTOR (STORAGE_EVENT_FIRST_SECTOR + STORAGE_EVENT_SECTORS_COUNT)
+#define STORAGE_SECTORS_COUNT (STORAGE_LOG_FIRST_SECTOR + STORAGE_LOG_SECTORS_COUNT)
+#define STORAGE_SIZE (STORAGE_SECTORS_COUNT * FLASH_SECTOR_SIZE)
+#define STORAGE_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - STORAGE_SIZE)
+
+/* Largest region the storage may take from the end of the flash, the rest is left to the firmware */
+#ifndef STORAGE_REGION_MAX_SIZE
+#define STORAGE_REGION_MAX_SIZE (1024 * 1024)
+#endif
+static_assert(STORAGE_SIZE <= STORAGE_REGION_MAX_SIZE, "Extent blobs do not fit into the storage region.");
+
+/* Payload of an EXTENT record, see LogExtent_t */
+#define LOG_EXTENT_LENGTH 12
+
+/* Bytes a blob takes in the log */
+constexpr uint32_t get_blob_log_size(uint blob_id) {
+    return is_extent_blob(blob_id) ? LOG_EXTENT_LENGTH : BLOB_LAYOUT[blob_id].max_size;
+}
+
+/*
+ * Blobs are split into zones, each of them being a separate log over its own sectors. All cold
+ * blobs share zone 0 and every hot blob gets a zone of its own, so checkpoints of a hot blob never
+ * relocate (and erase) the cold ones. Sectors left after giving each zone its minimum are spread
+ * over the hot zones to level their wear.
+ */
+typedef struct {
+    uint first_sector;
+    uint sectors_count;
+    uint reserved_sectors; /* Kept erased to relocate live blobs before reclaiming a sector */
+} StorageZone_t;
+
+constexpr uint get_hot_blobs_count() {
+    uint count = 0;
+    for (const auto& blob : BLOB_LAYOUT) {
+        count += (blob.write_class == WriteClass::HOT) ? 1 : 0;
+    }
+    return count;
+}
+
+#define STORAGE_ZONES_COUNT (1 + get_hot_blobs_count())
+
+constexpr uint get_blob_zone(uint blob_id) {
+    uint zone = 0;
+    for (uint id = 0; id <= blob_id; ++id) {
+        zone += (BLOB_LAYOUT[id].write_class == WriteClass::HOT) ? 1 : 0;
+    }
+    return (BLOB_LAYOUT[blob_id].write_class == WriteClass::HOT) ? zone : 0;
+}
+
+constexpr uint get_zone_reserved_sectors(uint zone) {
+    uint32_t size = 0;
+    for (uint id = 0; id < std::size(BLOB_LAYOUT); ++id) {
+        size += (get_blob_zone(id) == zone) ? get_log_record_size(get_blob_log_size(id)) : 0;
+    }
+    return (size + LOG_SECTOR_CAPACITY - 1) / LOG_SECTOR_CAPACITY;
+}
+
+constexpr std::array<StorageZone_t, STORAGE_ZONES_COUNT> make_storage_layout() {
+    std::array<StorageZone_t, STORAGE_ZONES_COUNT> zones{};
+    uint spare = STORAGE_LOG_SECTORS_COUNT;
+
+    /* Reserved sectors, the head and at least one sector to reclaim */
+    for (uint zone = 0; zone < zones.size(); ++zone) {
+        zones[zone].reserved_sectors = get_zone_reserved_sectors(zone);
+        zones[zone].sectors_count    = zones[zone].reserved_sectors + 2;
+        spare -= std::min(spare, zones[zone].sectors_count);
+    }
+
+    const uint hot_zones = zones.size() - 1;
+    for (uint zone = 0; zone < zones.size(); ++zone) {
+        if (hot_zones == 0) {
+            zones[zone].sectors_count += spare;
+        } else if (zone > 0) {
+            zones[zone].sectors_count += (spare / hot_zones) + ((zone <= (spare % hot_zones)) ? 1 : 0);
+        }
+    }
+
+    uint first_sector = STORAGE_LOG_FIRST_SECTOR;
+    for (auto& zone : zones) {
+        zone.first_sector = first_sector;
+        first_sector += zone.sectors_count;
+    }
+
+    return zones;
+}
+
+constexpr auto STORAGE_LAYOUT = make_storage_layout();
+
+constexpr bool is_storage_layout_valid() {
+    uint sectors = 0;
+    for (const auto& zone : STORAGE_LAYOUT) {
+        if (zone.sectors_count < (zone.reserved_sectors + 2))
+            return false;
+        sectors += zone.sectors_count;
+    }
+    return (sectors == STORAGE_LOG_SECTORS_COUNT);
+}
+static_assert(is_storage_layout_valid(), "Blob layout does not fit into the storage.");
+
+constexpr bool are_blob_sizes_valid() {
+    for (uint id = 0; id < std::size(BLOB_LAYOUT); ++id) {
+        const uint32_t size = get_blob_log_size(id);
+        if ((size > BLOB_SLOT_SIZE_BYTES) || (get_log_record_size(size) > LOG_SECTOR_CAPACITY))
+            return false;
+    }
+    return true;
+}
+static_assert(are_blob_sizes_valid(), "Blob does not fit into a single log sector.");
+
+constexpr bool are_zone_commits_valid() {
+    for (uint zone = 0; zone < STORAGE_ZONES_COUNT; ++zone) {
+        if (get_zone_reserved_sectors(zone) > 1)
+            return false;
+    }
+    return true;
+}
+static_assert(are_zone_commits_valid(), "All blobs of a zone have to fit into one sector to be committed atomically.");
+
+static_assert(sizeof(StorageConfig_t) <= get_blob_max_size(BlobType::STORAGE_CONFIG), "StorageConfig_t too big.");
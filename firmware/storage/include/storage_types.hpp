@@ -0,0 +1,161 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "storage_config.hpp"
+
+/*
+ * On-flash format of the blob log.
+ *
+ * Every sector starts with a LogSectorHeader_t followed by records appended one after another.
+ * A record is a LogRecordHeader_t and its payload, padded to LOG_RECORD_ALIGN bytes. FULL records
+ * carry the whole blob, DELTA records only the bytes [offset, offset + length) which changed
+ * since the previous version. The newest state of a blob is its latest FULL record with all the
+ * later DELTA records applied in log order.
+ *
+ * Records of several blobs committed together are written back to back within one sector, all but
+ * the last one carrying LOG_RECORD_FLAG_CHAINED. A chain cut short by a power loss is discarded.
+ *
+ * An extent blob (see WriteClass::EXTENT) has EXTENT records instead, pointing at the slot holding
+ * its content.
+ *
+ * A FULL record with LOG_RECORD_FLAG_CLEAR_ONLY keeps the payload from `offset` to the end out of
+ * its CRC. Saves which only clear bits of that tail program it in place instead of appending a new
+ * record, see Storage::save_blob(). Such a record only counts once its header, which is programmed
+ * last, is there.
+ *
+ * The upper bits of the flags hold the schema of the blob (see BLOB_LAYOUT), records written before
+ * schemas were introduced read as schema 0. A DELTA always has the schema of the FULL it applies to.
+ *
+ * Storage::erase() drops a log by clearing the `dropped` word of its sector headers, the newest one
+ * first. A log whose newest sector is older than a dropped one is gone as a whole, the next log of
+ * the zone carries a higher sequence than any of them.
+ */
+
+#define LOG_SECTOR_MAGIC 0x31474F4C /* "LOG1" */
+#define LOG_RECORD_MAGIC 0x52       /* "R" */
+#define LOG_OFFSET_NONE UINT32_MAX
+#define LOG_SECTOR_DROPPED 0
+
+#define LOG_RECORD_FLAG_NONE 0x00
+#define LOG_RECORD_FLAG_CHAINED 0x01    /* The next record belongs to the same commit */
+#define LOG_RECORD_FLAG_CLEAR_ONLY 0x02 /* The payload from `offset` on is cleared in place */
+#define LOG_RECORD_SCHEMA_SHIFT 4
+#define LOG_RECORD_SCHEMA_MASK 0xF0
+
+constexpr uint8_t get_schema_flags(uint8_t schema) {
+    return static_cast<uint8_t>(schema << LOG_RECORD_SCHEMA_SHIFT);
+}
+
+constexpr uint8_t get_record_schema(uint8_t flags) {
+    return static_cast<uint8_t>((flags & LOG_RECORD_SCHEMA_MASK) >> LOG_RECORD_SCHEMA_SHIFT);
+}
+
+enum class LogRecordKind : uint8_t {
+    FULL   = 0x01,
+    DELTA  = 0x02,
+    EXTENT = 0x03,
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t dropped; /* LOG_SECTOR_DROPPED once erased by Storage::erase(), programmed without an erase */
+    uint32_t reserved;
+} LogSectorHeader_t;
+
+typedef struct {
+    uint8_t magic;
+    uint8_t flags;
+    uint8_t blob_id;
+    LogRecordKind kind;
+    uint16_t offset;
+    uint16_t length;
+    uint32_t version;
+    uint32_t crc; /* Header fields above and the payload */
+} LogRecordHeader_t;
+
+/*
+ * Erase and boot counters, see STORAGE_WEAR_FIRST_SECTOR. The header holds the counters folded at
+ * the time the wear sector was opened. Every later boot clears the next bit of the boot page and
+ * every erase appends the id of the erased sector as a single byte to the journal after it, both
+ * programmed over erased flash without erasing anything. A full boot page or journal is folded into
+ * a new header in the other wear sector.
+ */
+#define WEAR_SECTOR_MAGIC 0x52414557 /* "WEAR" */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t crc; /* Of the counters below */
+    uint32_t boot_count;
+    uint32_t erase_counts[STORAGE_SECTORS_COUNT];
+} WearSectorHeader_t;
+
+#define WEAR_BOOT_PAGE_START ((sizeof(WearSectorHeader_t) + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1))
+#define WEAR_BOOTS_PER_SECTOR (FLASH_PAGE_SIZE * 8)
+#define WEAR_JOURNAL_START (WEAR_BOOT_PAGE_START + FLASH_PAGE_SIZE)
+
+/*
+ * Records of the event ring, see STORAGE_EVENT_FIRST_SECTOR. Every sector starts with a header and
+ * an EVENT_TYPE_TIME record, which holds the absolute time in seconds instead of a delta. The delta
+ * of every other record is the time since the record before it. A time record is also appended
+ * whenever the next delta does not fit, the clock was set back or was not set before. The sequence
+ * of a record is the first sequence of its sector plus its position, time records count too.
+ */
+#define EVENT_SECTOR_MAGIC 0x31545645 /* "EVT1" */
+#define EVENT_TYPE_TIME 0x00
+
+typedef struct {
+    uint32_t magic;
+    uint32_t first_sequence;
+} EventSectorHeader_t;
+
+typedef struct {
+    uint32_t delta_ms; /* Seconds since the epoch for EVENT_TYPE_TIME */
+    uint8_t key;
+    uint8_t type;
+    uint16_t check; /* Lower half of the CRC of the fields above, a torn record fails it */
+} EventRecord_t;
+
+#define EVENT_RECORDS_PER_SECTOR ((FLASH_SECTOR_SIZE - sizeof(EventSectorHeader_t)) / sizeof(EventRecord_t))
+
+typedef struct {
+    uint32_t offset; /* Of the slot from the beginning of the storage */
+    uint32_t size;
+    uint32_t crc; /* Of the slot content */
+} LogExtent_t;
+
+static_assert(sizeof(LogExtent_t) == LOG_EXTENT_LENGTH, "Unexpected extent record size.");
+static_assert(sizeof(LogSectorHeader_t) == (FLASH_SECTOR_SIZE - LOG_SECTOR_CAPACITY), "Unexpected sector header size.");
+static_assert(sizeof(LogRecordHeader_t) == LOG_RECORD_ALIGN, "Unexpected record header size.");
+static_assert(WEAR_JOURNAL_START < FLASH_SECTOR_SIZE, "Wear counters do not fit into a wear sector.");
+static_assert(sizeof(EventRecord_t) == 8, "Unexpected event record size.");
+static_assert((FLASH_PAGE_SIZE % sizeof(EventRecord_t)) == 0, "Event records must not straddle page boundary.");
+static_assert((sizeof(EventSectorHeader_t) % sizeof(EventRecord_t)) == 0, "Event records must stay aligned.");
+static_assert(STORAGE_SECTORS_COUNT < 0xFF, "Sector ids have to fit into a journal byte other than 0xFF.");
+static_assert(FLASH_PAGE_SIZE % LOG_RECORD_ALIGN == 0, "Record headers must not straddle page boundary.");
+static_assert(std::all_of(std::begin(BLOB_LAYOUT), std::end(BLOB_LAYOUT),
+                  [](const BlobLayout_t& blob) { return blob.schema <= get_record_schema(LOG_RECORD_SCHEMA_MASK); }),
+    "Blob schema does not fit into the record flags.");
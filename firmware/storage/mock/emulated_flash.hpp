@@ -0,0 +1,183 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <fcntl.h>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include "flash_device.hpp"
+#include "mock_flash.hpp"
+
+/* Typical W25Q16JV timings, the flash on the Raspberry Pi Pico */
+typedef struct {
+    uint32_t sector_erase_us;
+    uint32_t page_program_us;
+} FlashTiming_t;
+
+constexpr FlashTiming_t W25Q16JV_TIMING = { 45'000, 400 };
+
+/*
+ * Host flash region with NOR semantics: erase works on whole sectors and programming can only
+ * clear bits. The memory is either anonymous or an mmap'd image file, which keeps its contents
+ * between test runs and can be inspected with any hex viewer. Every operation is counted per
+ * sector and its typical duration is accumulated and passes on the mock clock, power can be cut
+ * halfway through any of them.
+ */
+class EmulatedFlash : public FlashDevice {
+  public:
+    explicit EmulatedFlash(uint32_t size_, const std::string& image_path = "", FlashTiming_t timing_ = W25Q16JV_TIMING)
+    : region_size(size_), timing(timing_), sector_erases(size_ / FLASH_SECTOR_SIZE, 0),
+      sector_programs(size_ / FLASH_SECTOR_SIZE, 0) {
+        if (image_path.empty()) {
+            map(MAP_PRIVATE | MAP_ANONYMOUS, -1);
+            std::fill_n(memory, region_size, 0xFF);
+            return;
+        }
+
+        const int fd = open(image_path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open flash image " + image_path);
+
+        /* A new image starts erased */
+        const bool is_new = (lseek(fd, 0, SEEK_END) == 0);
+        if (ftruncate(fd, region_size) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot resize flash image " + image_path);
+        }
+        map(MAP_SHARED, fd);
+        close(fd);
+        if (is_new)
+            std::fill_n(memory, region_size, 0xFF);
+    }
+
+    ~EmulatedFlash() override { munmap(memory, region_size); }
+
+    EmulatedFlash(const EmulatedFlash&)            = delete;
+    EmulatedFlash& operator=(const EmulatedFlash&) = delete;
+
+    const uint8_t* data() const override { return memory; }
+    uint32_t size() const override { return region_size; }
+
+    void erase(uint32_t offset, uint32_t count) override {
+        assert((offset % FLASH_SECTOR_SIZE) == 0 && (count % FLASH_SECTOR_SIZE) == 0);
+        assert(offset + count <= region_size);
+        if (!is_powered)
+            return;
+        if (is_power_cut()) {
+            std::fill_n(memory + offset, count / 2, 0xFF);
+            return;
+        }
+        std::fill_n(memory + offset, count, 0xFF);
+        erases += count / FLASH_SECTOR_SIZE;
+        for (uint32_t sector = offset / FLASH_SECTOR_SIZE; sector < (offset + count) / FLASH_SECTOR_SIZE; ++sector) {
+            sector_erases[sector]++;
+            busy_time_us += timing.sector_erase_us;
+        }
+        record_timing(FlashTimingType::ERASE, (count / FLASH_SECTOR_SIZE) * timing.sector_erase_us);
+    }
+
+    void program(uint32_t offset, std::span<const uint8_t> data) override {
+        assert((offset % FLASH_PAGE_SIZE) == 0 && (data.size() % FLASH_PAGE_SIZE) == 0);
+        assert(offset + data.size() <= region_size);
+        if (!is_powered)
+            return;
+        const size_t length = is_power_cut() ? (data.size() / 2) : data.size();
+        for (size_t i = 0; i < length; ++i) {
+            /* 0xFF leaves a byte untouched, anything else has to end up stored as given */
+            assert(((data[i] == 0xFF) || ((memory[offset + i] & data[i]) == data[i])) && "Programming cannot set bits");
+            memory[offset + i] &= data[i];
+        }
+        if (length != data.size())
+            return;
+        const uint32_t pages = static_cast<uint32_t>(data.size() / FLASH_PAGE_SIZE);
+        programs += pages;
+        sector_programs[offset / FLASH_SECTOR_SIZE] += pages;
+        busy_time_us += static_cast<uint64_t>(pages) * timing.page_program_us;
+        record_timing(FlashTimingType::PROGRAM, pages * timing.page_program_us);
+    }
+
+    uint32_t get_erase_count() const { return erases; }
+    uint32_t get_program_count() const { return programs; }
+    uint32_t get_sector_erase_count(uint sector_id) const { return sector_erases[sector_id]; }
+    uint32_t get_sector_program_count(uint sector_id) const { return sector_programs[sector_id]; }
+    uint32_t get_max_sector_erase_count() const {
+        return *std::max_element(sector_erases.begin(), sector_erases.end());
+    }
+    /* Time the chip would have been busy for, with interrupts disabled on the RP2040 */
+    uint64_t get_busy_time_us() const { return busy_time_us; }
+
+    /* Power is lost halfway through the operation following the next `operations` ones */
+    void cut_power_after(uint32_t operations) { power_budget = operations; }
+    void restore_power() {
+        power_budget = UINT32_MAX;
+        is_powered   = true;
+    }
+    bool is_power_lost() const { return !is_powered; }
+
+    /* Direct access for tests preparing flash images */
+    std::span<uint8_t> raw() { return std::span<uint8_t>(memory, region_size); }
+
+  private:
+    uint8_t* memory = nullptr;
+    uint32_t region_size;
+    FlashTiming_t timing;
+    std::vector<uint32_t> sector_erases;
+    std::vector<uint32_t> sector_programs;
+    uint32_t erases       = 0;
+    uint32_t programs     = 0;
+    uint64_t busy_time_us = 0;
+    uint32_t power_budget = UINT32_MAX;
+    bool is_powered       = true;
+
+    /*
+     * The modeled duration stands in for the measured one, core1 is paused for all of it.
+     * The caller is kept busy as long, so the mock clock moves on.
+     */
+    void record_timing(FlashTimingType type, uint32_t duration_us) {
+        set_mock_time_us_64(time_us_64() + duration_us);
+        timings.record(type, duration_us);
+        timings.record(FlashTimingType::CORE_LOCKOUT, duration_us);
+    }
+
+    void map(int flags, int fd) {
+        void* address = mmap(nullptr, region_size, PROT_READ | PROT_WRITE, flags, fd, 0);
+        if (address == MAP_FAILED)
+            throw std::runtime_error("Cannot map flash memory");
+        memory = static_cast<uint8_t*>(address);
+    }
+
+    bool is_power_cut() {
+        if (power_budget == UINT32_MAX)
+            return false;
+        if (power_budget-- > 0)
+            return false;
+        is_powered = false;
+        return true;
+    }
+};
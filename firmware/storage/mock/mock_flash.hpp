@@ -0,0 +1,55 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <sys/types.h>
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+#define PICO_FLASH_SIZE_BYTES (16 * 1024 * 1024)
+
+typedef struct {
+    bool locked;
+} mutex_t;
+
+inline void mutex_init(mutex_t* mutex) {
+    mutex->locked = false;
+}
+
+inline void mutex_enter_blocking(mutex_t* mutex) {
+    mutex->locked = true;
+}
+
+inline void mutex_exit(mutex_t* mutex) {
+    mutex->locked = false;
+}
+
+inline uint64_t mock_time_us_64 = 0;
+
+inline void set_mock_time_us_64(uint64_t time_us) {
+    mock_time_us_64 = time_us;
+}
+
+inline uint64_t time_us_64() {
+    return mock_time_us_64;
+}
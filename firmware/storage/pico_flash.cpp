@@ -0,0 +1,53 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "pico_flash.hpp"
+
+void PicoFlash::erase(uint32_t offset, uint32_t count) {
+    FlashOperation_t operation = { flash_offset + offset, count, nullptr, 0 };
+    execute(FlashTimingType::ERASE, operation);
+}
+
+void PicoFlash::program(uint32_t offset, std::span<const uint8_t> data) {
+    FlashOperation_t operation = { flash_offset + offset, static_cast<uint32_t>(data.size()), data.data(), 0 };
+    execute(FlashTimingType::PROGRAM, operation);
+}
+
+void PicoFlash::execute(FlashTimingType type, FlashOperation_t& operation) {
+    const uint64_t start_us = time_us_64();
+    const int status        = flash_safe_execute(run_operation, &operation, UINT32_MAX);
+    const uint64_t end_us   = time_us_64();
+    hard_assert(status == PICO_OK);
+
+    timings.record(type, operation.duration_us);
+    timings.record(FlashTimingType::CORE_LOCKOUT, static_cast<uint32_t>(end_us - start_us));
+}
+
+void PicoFlash::run_operation(void* param) {
+    FlashOperation_t& operation = *static_cast<FlashOperation_t*>(param);
+    const uint64_t start_us     = time_us_64();
+    if (operation.data == nullptr) {
+        flash_range_erase(operation.offset, operation.count);
+    } else {
+        flash_range_program(operation.offset, operation.data, operation.count);
+    }
+    operation.duration_us = static_cast<uint32_t>(time_us_64() - start_us);
+}
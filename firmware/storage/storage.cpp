@@ -19,179 +19,1610 @@
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <bit>
+#include <cstddef>
 #include <cstring>
-#include <limits>
-#include <pico/mutex.h>
 
+#include "crc32.hpp"
 #include "storage.hpp"
 #include "storage_config.hpp"
+#include "storage_types.hpp"
 
-Storage::Storage(mutex_t& mutex_) : mutex(mutex_) {
-    sector.resize(blobs_per_sector);
-    max_blob_id        = (STORAGE_SIZE / BLOB_SLOT_SIZE_BYTES) - 1;
-    storage_start_addr = reinterpret_cast<const uint8_t*>(XIP_BASE + STORAGE_FLASH_OFFSET);
+Storage::Storage(FlashDevice& flash_) : flash(flash_), dirty_sectors{}, compacting(false), stats{}, boot_report{},
+  pending_blobs(0), first_pending_ms(0), last_save_ms(0), staged_size{}, save_latency{},
+  erase_counts{}, boot_erase_counts{}, boot_time_us(0), wear_sector(STORAGE_WEAR_FIRST_SECTOR), wear_sequence(0),
+  wear_offset(LOG_OFFSET_NONE), boot_count(0), boot_bits(0), event_head_sector(STORAGE_EVENT_FIRST_SECTOR),
+  event_head_offset(LOG_OFFSET_NONE), event_next_sequence(0), event_last_ms(0) {
+    mutex_init(&mutex);
+    clear_only_offsets.fill(clear_only_none);
+    for (uint id = 0; id < zones.size(); ++id) {
+        zones[id] = { STORAGE_LAYOUT[id], 0, STORAGE_LAYOUT[id].first_sector, STORAGE_LAYOUT[id].first_sector, 0 };
+    }
+    reset_index();
 }
 
 StorageStatus Storage::init() {
-    StorageStatus status = StorageStatus::ERROR;
+    StorageStatus status  = StorageStatus::SUCCESS;
+    const uint32_t erases = flash.get_timings().get(FlashTimingType::ERASE).count;
+
+    mutex_enter_blocking(&mutex);
+    reset_index();
+    dirty_sectors.fill(false);
+    boot_report = {};
+    load_wear_counters();
+    load_events();
+
+    const uint64_t scan_start_us = time_us_64();
+    std::array<bool, STORAGE_ZONES_COUNT> found{};
+    for (uint id = 0; id < zones.size(); ++id) {
+        found[id] = scan_zone(zones[id]);
+    }
+    boot_report.validation_us = static_cast<uint32_t>(time_us_64() - scan_start_us);
+
+    if (!import_legacy_slots()) {
+        for (uint id = 0; id < zones.size(); ++id) {
+            if (found[id])
+                continue;
+            const StorageZone_t& layout = zones[id].layout;
+            for (uint sector_id = layout.first_sector; sector_id < layout.first_sector + layout.sectors_count;
+                 ++sector_id) {
+                if (!is_erased(get_sector_start(sector_id), FLASH_SECTOR_SIZE))
+                    retire_sector(sector_id);
+            }
+            reset_zone(zones[id], layout.first_sector);
+        }
+    }
+
+    /* Extent slots the log does not point at are free, whatever they still hold */
+    for (uint blob_id = 0; blob_id < blobs_count; ++blob_id) {
+        if (!is_extent_blob(blob_id))
+            continue;
+        const uint32_t in_use = (index[blob_id].base_offset != LOG_OFFSET_NONE) ? read_extent(blob_id).offset : 0;
+        for (uint slot = 0; slot < STORAGE_EXTENT_SLOTS_COUNT; ++slot) {
+            if ((index[blob_id].base_offset == LOG_OFFSET_NONE) || (get_extent_slot_start(blob_id, slot) != in_use))
+                retire_extent_slot(blob_id, get_extent_slot_start(blob_id, slot));
+        }
+    }
+    mutex_exit(&mutex);
+
     (void)get_blob(BlobType::STORAGE_CONFIG, s_config);
 
     if (is_factory_required()) {
         status = factory_init();
-        if (status != StorageStatus::SUCCESS)
-            return status;
     }
 
-    s_config.init_count += 1;
+    /* The stored config is not rewritten, its init_count keeps boots counted before wear sectors */
+    if (status == StorageStatus::SUCCESS) {
+        mutex_enter_blocking(&mutex);
+        count_boot();
+        mutex_exit(&mutex);
+    }
 
-    return save_blob(BlobType::STORAGE_CONFIG, s_config);
+    boot_report.erases = flash.get_timings().get(FlashTimingType::ERASE).count - erases;
+
+    return status;
 }
 
 StorageStatus Storage::factory_init() {
     s_config.magic      = BLOB_MAGIC;
     s_config.init_count = 0;
+
+    mutex_enter_blocking(&mutex);
+    if (boot_count != 0) {
+        boot_count = 0;
+        fold_wear_counters();
+    }
+    mutex_exit(&mutex);
+
     return save_blob(BlobType::STORAGE_CONFIG, s_config);
 }
 
 uint32_t Storage::get_init_count() const {
-    return s_config.init_count;
+    return s_config.init_count + boot_count;
+}
+
+StorageStats_t Storage::get_stats() const {
+    return stats;
+}
+
+StorageBootReport_t Storage::get_boot_report() const {
+    return boot_report;
 }
 
 bool Storage::is_factory_required() {
     return (s_config.magic != BLOB_MAGIC);
 }
 
-void Storage::erase() const {
+void Storage::erase() {
     mutex_enter_blocking(&mutex);
-    const uint32_t interrupts = save_and_disable_interrupts();
-    flash_range_erase(STORAGE_FLASH_OFFSET & ~(FLASH_SECTOR_SIZE - 1), STORAGE_SIZE);
-    restore_interrupts(interrupts);
+    pending_blobs = 0;
+
+    /* Each log starts over after its head. The sector is only opened by the first record, task() erases it
+       in the meantime, so nothing here waits for an erase */
+    for (auto& zone : zones) {
+        drop_log(zone);
+        reset_zone(zone, next_sector(zone, zone.head_sector));
+    }
+    reset_index();
+
+    /* Clearing the magic drops an event sector right away, a power cut cannot bring it back */
+    for (uint sector_id = STORAGE_EVENT_FIRST_SECTOR; sector_id < STORAGE_LOG_FIRST_SECTOR; ++sector_id) {
+        EventSectorHeader_t header;
+        if (!read_event_header(sector_id, header))
+            continue;
+        page.fill(0xFF);
+        std::fill_n(page.begin(), sizeof(header.magic), 0);
+        flash.program(get_sector_start(sector_id), page);
+    }
+    event_head_offset = LOG_OFFSET_NONE;
+
+    /* Everything else but the erase counters is erased by task(), a sector at a time */
+    for (uint sector_id = 0; sector_id < STORAGE_SECTORS_COUNT; ++sector_id) {
+        const bool is_wear_sector = (sector_id >= STORAGE_WEAR_FIRST_SECTOR) && (sector_id < STORAGE_WEAR_END_SECTOR);
+        if (!is_wear_sector && !is_erased(get_sector_start(sector_id), FLASH_SECTOR_SIZE))
+            retire_sector(sector_id);
+    }
+    boot_count = 0;
+    fold_wear_counters();
     mutex_exit(&mutex);
 }
 
-void Storage::erase(uint sector_id) const {
-    const uint32_t interrupts   = save_and_disable_interrupts();
-    const uintptr_t sector_addr = STORAGE_FLASH_OFFSET + (sector_id * FLASH_SECTOR_SIZE);
-    flash_range_erase(sector_addr & ~(FLASH_SECTOR_SIZE - 1), FLASH_SECTOR_SIZE);
-    restore_interrupts(interrupts);
+void Storage::erase_sector(uint sector_id) {
+    flash.erase(get_sector_start(sector_id), FLASH_SECTOR_SIZE);
+    dirty_sectors[sector_id] = false;
+    count_erase(sector_id);
+}
+
+void Storage::retire_sector(uint sector_id) {
+    dirty_sectors[sector_id] = true;
+}
+
+/* Called right before programming a sector which is not in use */
+void Storage::prepare_sector(uint sector_id) {
+    if (!dirty_sectors[sector_id])
+        return;
+
+    erase_sector(sector_id);
+    stats.inline_erases++;
 }
 
-const uint8_t* Storage::get_blob_address(uint blob_id) const {
-    if (blob_id > max_blob_id) {
-        return nullptr;
+bool Storage::erase_dirty_sector() {
+    /* Log sectors first, they are what the saves run out of */
+    for (uint i = 0; i < STORAGE_SECTORS_COUNT; ++i) {
+        const uint sector_id = (STORAGE_LOG_FIRST_SECTOR + i) % STORAGE_SECTORS_COUNT;
+        if (dirty_sectors[sector_id]) {
+            erase_sector(sector_id);
+            return true;
+        }
     }
+    return false;
+}
 
-    return (storage_start_addr + (blob_id * BLOB_SLOT_SIZE_BYTES));
+uint Storage::get_spare_sectors() const {
+    uint count = 0;
+    for (const auto& zone : zones) {
+        for (uint id = next_sector(zone, zone.head_sector); id != zone.tail_sector; id = next_sector(zone, id)) {
+            if (!dirty_sectors[id])
+                count++;
+        }
+    }
+    return count;
 }
 
-StorageStatus Storage::_get_blob(BlobType blob_type, std::span<uint8_t> blob) const {
-    const uint blob_id = static_cast<uint>(blob_type);
-    if (blob_id > max_blob_id) {
-        return StorageStatus::INVALID_ID;
+uint Storage::get_dirty_sectors() const {
+    return static_cast<uint>(std::count(dirty_sectors.begin(), dirty_sectors.end(), true));
+}
+
+bool Storage::is_erased(uint32_t offset, uint32_t count) const {
+    const uint8_t* data = flash.data() + offset;
+    return std::all_of(data, data + count, [](uint8_t byte) { return byte == 0xFF; });
+}
+
+/* -------------------------------------------------------------------------- */
+/*                                    Wear                                    */
+/* -------------------------------------------------------------------------- */
+
+uint32_t Storage::calculate_wear_crc(const WearSectorHeader_t& header) {
+    constexpr size_t start  = offsetof(WearSectorHeader_t, boot_count);
+    const uint8_t* counters = reinterpret_cast<const uint8_t*>(&header) + start;
+    return crc32_update(0, std::span<const uint8_t>(counters, sizeof(header) - start));
+}
+
+bool Storage::read_wear_header(uint sector_id, WearSectorHeader_t& header) const {
+    std::memcpy(&header, flash.data() + get_sector_start(sector_id), sizeof(header));
+    return (header.magic == WEAR_SECTOR_MAGIC) && (calculate_wear_crc(header) == header.crc);
+}
+
+void Storage::load_wear_counters() {
+    WearSectorHeader_t newest = {};
+    bool found                = false;
+    for (uint id = STORAGE_WEAR_FIRST_SECTOR; id < STORAGE_WEAR_END_SECTOR; ++id) {
+        WearSectorHeader_t header;
+        if (read_wear_header(id, header) && (!found || (header.sequence > newest.sequence))) {
+            newest      = header;
+            wear_sector = id;
+            found       = true;
+        }
     }
 
-    const uint8_t* blob_addr = get_blob_address(blob_id);
-    if (!blob_addr)
-        return StorageStatus::ERROR;
+    if (found) {
+        std::copy(std::begin(newest.erase_counts), std::end(newest.erase_counts), erase_counts.begin());
+        wear_sequence = newest.sequence;
 
-    std::memcpy(blob.data(), blob_addr, blob.size());
+        const uint8_t* wear = flash.data() + get_sector_start(wear_sector);
+        boot_bits           = 0;
+        for (uint32_t offset = WEAR_BOOT_PAGE_START; offset < WEAR_JOURNAL_START; ++offset) {
+            boot_bits += static_cast<uint32_t>(std::popcount(static_cast<uint8_t>(~wear[offset])));
+        }
+        boot_count = newest.boot_count + boot_bits;
 
-    return StorageStatus::SUCCESS;
+        /* A torn journal byte reads as an id out of range, it is only lost */
+        uint32_t offset = WEAR_JOURNAL_START;
+        while ((offset < FLASH_SECTOR_SIZE) && (wear[offset] != 0xFF)) {
+            if (wear[offset] < STORAGE_SECTORS_COUNT)
+                erase_counts[wear[offset]]++;
+            offset++;
+        }
+        wear_offset = get_sector_start(wear_sector) + offset;
+    } else {
+        /* Counting starts over, erases done by firmware without wear sectors were never recorded */
+        erase_counts.fill(0);
+        boot_count    = 0;
+        wear_sequence = 0;
+        wear_sector   = STORAGE_WEAR_END_SECTOR - 1;
+        fold_wear_counters();
+    }
+
+    for (uint id = STORAGE_WEAR_FIRST_SECTOR; id < STORAGE_WEAR_END_SECTOR; ++id) {
+        if ((id != wear_sector) && !is_erased(get_sector_start(id), FLASH_SECTOR_SIZE))
+            retire_sector(id);
+    }
+
+    boot_erase_counts = erase_counts;
+    boot_time_us      = time_us_64();
 }
 
-StorageStatus Storage::_get_blob(uint blob_id, std::span<uint8_t> blob) const {
-    if (blob_id > max_blob_id) {
-        return StorageStatus::INVALID_ID;
+void Storage::count_boot() {
+    boot_count++;
+    if (boot_bits == WEAR_BOOTS_PER_SECTOR) {
+        fold_wear_counters();
+        return;
     }
 
-    const uint8_t* blob_addr = get_blob_address(blob_id);
-    if (!blob_addr)
-        return StorageStatus::ERROR;
+    /* Bits are cleared one after another, so a byte only ever loses its next set bit */
+    page.fill(0xFF);
+    page[boot_bits / 8] = static_cast<uint8_t>(0xFF << ((boot_bits % 8) + 1));
+    flash.program(get_sector_start(wear_sector) + WEAR_BOOT_PAGE_START, page);
+    boot_bits++;
+}
 
-    std::memcpy(blob.data(), blob_addr, blob.size());
+void Storage::count_erase(uint sector_id) {
+    erase_counts[sector_id]++;
+    if (wear_offset == LOG_OFFSET_NONE)
+        return;
 
-    return StorageStatus::SUCCESS;
+    if (wear_offset == get_sector_start(wear_sector + 1)) {
+        fold_wear_counters();
+        return;
+    }
+
+    /* Programming a single byte leaves the rest of the page as it is */
+    page.fill(0xFF);
+    page[wear_offset % FLASH_PAGE_SIZE] = static_cast<uint8_t>(sector_id);
+    flash.program(wear_offset & ~(FLASH_PAGE_SIZE - 1), page);
+    wear_offset++;
 }
 
-uint Storage::get_sector_id(BlobType blob_type) const {
-    const uint blob_id = static_cast<uint>(blob_type);
-    if (blob_id > max_blob_id) {
-        return std::numeric_limits<unsigned int>::max();
+void Storage::fold_wear_counters() {
+    const uint wear_count = STORAGE_WEAR_SECTORS_COUNT;
+    const uint previous   = wear_sector;
+    const uint target     = STORAGE_WEAR_FIRST_SECTOR + ((previous - STORAGE_WEAR_FIRST_SECTOR + 1) % wear_count);
+
+    /* The previous counters stay valid until the new header is complete */
+    wear_offset = LOG_OFFSET_NONE;
+    if (!is_erased(get_sector_start(target), FLASH_SECTOR_SIZE))
+        erase_sector(target);
+
+    WearSectorHeader_t header = { WEAR_SECTOR_MAGIC, ++wear_sequence, 0, boot_count, {} };
+    std::copy(erase_counts.begin(), erase_counts.end(), std::begin(header.erase_counts));
+    header.crc = calculate_wear_crc(header);
+
+    const uint8_t* header_bytes = reinterpret_cast<const uint8_t*>(&header);
+    for (uint32_t position = 0; position < sizeof(header); position += FLASH_PAGE_SIZE) {
+        const uint32_t length = std::min<uint32_t>(FLASH_PAGE_SIZE, sizeof(header) - position);
+        page.fill(0xFF);
+        std::copy_n(header_bytes + position, length, page.begin());
+        flash.program(get_sector_start(target) + position, page);
+    }
+
+    wear_sector = target;
+    wear_offset = get_sector_start(target) + WEAR_JOURNAL_START;
+    boot_bits   = 0;
+    if ((previous != target) && !is_erased(get_sector_start(previous), FLASH_SECTOR_SIZE))
+        retire_sector(previous);
+}
+
+StorageWearReport_t Storage::get_wear_report() const {
+    constexpr uint64_t ms_in_hour = 3'600'000;
+    StorageWearReport_t report    = { 0, 0, 0, UINT32_MAX };
+    const uint64_t elapsed_ms     = (time_us_64() - boot_time_us) / 1000;
+
+    for (uint sector_id = 0; sector_id < STORAGE_SECTORS_COUNT; ++sector_id) {
+        const uint32_t count = erase_counts[sector_id];
+        const uint32_t since = count - boot_erase_counts[sector_id];
+        report.max_erase_count = std::max(report.max_erase_count, count);
+        report.total_erases += count;
+        report.boot_erases += since;
+        if (since == 0)
+            continue;
+
+        /* The sector keeps being erased as often as since boot */
+        const uint64_t cycles_left = (count < FLASH_ENDURANCE_CYCLES) ? (FLASH_ENDURANCE_CYCLES - count) : 0;
+        const uint64_t hours       = (cycles_left * elapsed_ms) / since / ms_in_hour;
+        report.hours_left          = static_cast<uint32_t>(std::min<uint64_t>(report.hours_left, hours));
     }
 
-    return (blob_id / blobs_per_sector);
+    return report;
+}
+
+/* -------------------------------------------------------------------------- */
+/*                                   Events                                   */
+/* -------------------------------------------------------------------------- */
+
+uint16_t Storage::calculate_event_check(const EventRecord_t& record) {
+    const auto* bytes = reinterpret_cast<const uint8_t*>(&record);
+    return static_cast<uint16_t>(crc32_update(0, std::span<const uint8_t>(bytes, offsetof(EventRecord_t, check))));
+}
+
+uint64_t Storage::get_event_time(uint64_t previous_ms, const EventRecord_t& record) {
+    return (record.type == EVENT_TYPE_TIME) ? (record.delta_ms * 1000ULL) : (previous_ms + record.delta_ms);
 }
 
-StorageStatus Storage::read_sector(uint sector_id) {
-    const uint start_blob_id = sector_id * blobs_per_sector;
-    for (uint i = 0; i < blobs_per_sector; i++) {
-        StorageStatus status = _get_blob(start_blob_id + i, sector[i]);
-        if (status != StorageStatus::SUCCESS) {
-            return status;
+bool Storage::read_event_header(uint sector_id, EventSectorHeader_t& header) const {
+    std::memcpy(&header, flash.data() + get_sector_start(sector_id), sizeof(header));
+    return (header.magic == EVENT_SECTOR_MAGIC);
+}
+
+EventRecord_t Storage::read_event(uint32_t offset) const {
+    EventRecord_t record;
+    std::memcpy(&record, flash.data() + offset, sizeof(record));
+    return record;
+}
+
+void Storage::load_events() {
+    bool found                 = false;
+    EventSectorHeader_t newest = {};
+    event_head_offset          = LOG_OFFSET_NONE;
+    event_next_sequence        = 0;
+    for (uint id = STORAGE_EVENT_FIRST_SECTOR; id < STORAGE_LOG_FIRST_SECTOR; ++id) {
+        EventSectorHeader_t header;
+        if (read_event_header(id, header)) {
+            if (!found || (header.first_sequence > newest.first_sequence)) {
+                newest            = header;
+                event_head_sector = id;
+                found             = true;
+            }
+        } else if (!is_erased(get_sector_start(id), FLASH_SECTOR_SIZE)) {
+            retire_sector(id);
         }
     }
+    if (!found)
+        return;
+
+    /* The time of the newest record, a torn one is skipped but keeps its sequence */
+    const uint32_t start = get_sector_start(event_head_sector) + sizeof(EventSectorHeader_t);
+    uint32_t offset      = start;
+    for (; offset < get_sector_start(event_head_sector + 1); offset += sizeof(EventRecord_t)) {
+        const EventRecord_t record = read_event(offset);
+        if (is_erased(offset, sizeof(record)))
+            break;
+        if (record.check != calculate_event_check(record))
+            continue;
+        event_last_ms = get_event_time(event_last_ms, record);
+    }
+    event_head_offset   = offset;
+    event_next_sequence = newest.first_sequence + ((offset - start) / sizeof(EventRecord_t));
+
+    const uint next = next_event_sector(event_head_sector);
+    if (!is_erased(get_sector_start(next), FLASH_SECTOR_SIZE))
+        retire_sector(next);
+}
+
+void Storage::open_event_sector(uint sector_id, uint64_t time_ms) {
+    const uint32_t time_s            = static_cast<uint32_t>(std::min<uint64_t>(time_ms / 1000, UINT32_MAX));
+    const EventSectorHeader_t header = { EVENT_SECTOR_MAGIC, event_next_sequence };
+    EventRecord_t time_record        = { time_s, 0, EVENT_TYPE_TIME, 0 };
+    time_record.check                = calculate_event_check(time_record);
+
+    prepare_sector(sector_id);
+    page.fill(0xFF);
+    std::memcpy(page.data(), &header, sizeof(header));
+    std::memcpy(page.data() + sizeof(header), &time_record, sizeof(time_record));
+    flash.program(get_sector_start(sector_id), page);
+
+    event_head_sector = sector_id;
+    event_head_offset = get_sector_start(sector_id) + sizeof(header) + sizeof(time_record);
+    event_next_sequence++;
+    event_last_ms = time_s * 1000ULL;
+
+    /* The oldest sector goes now, so moving on to the next one finds it erased */
+    const uint next = next_event_sector(sector_id);
+    if (!dirty_sectors[next] && !is_erased(get_sector_start(next), FLASH_SECTOR_SIZE))
+        retire_sector(next);
+}
+
+void Storage::program_event(uint32_t delta_ms, uint8_t key, uint8_t type) {
+    EventRecord_t record = { delta_ms, key, type, 0 };
+    record.check         = calculate_event_check(record);
+
+    /* Programming a single record leaves the rest of the page as it is */
+    page.fill(0xFF);
+    std::memcpy(page.data() + (event_head_offset % FLASH_PAGE_SIZE), &record, sizeof(record));
+    flash.program(event_head_offset & ~(FLASH_PAGE_SIZE - 1), page);
+
+    event_head_offset += sizeof(record);
+    event_next_sequence++;
+    event_last_ms = get_event_time(event_last_ms, record);
+}
+
+StorageStatus Storage::append_event(uint64_t time_ms, uint8_t key, uint8_t type) {
+    if (type == EVENT_TYPE_TIME)
+        return StorageStatus::INVALID_INPUT;
+
+    mutex_enter_blocking(&mutex);
+    const bool is_open      = (event_head_offset != LOG_OFFSET_NONE);
+    const bool is_delta_set = is_open && (time_ms >= event_last_ms) && ((time_ms - event_last_ms) <= UINT32_MAX);
+    const uint32_t needed   = (is_delta_set ? 1 : 2) * sizeof(EventRecord_t);
+    if (!is_open) {
+        open_event_sector(STORAGE_EVENT_FIRST_SECTOR, time_ms);
+    } else if ((event_head_offset + needed) > get_sector_start(event_head_sector + 1)) {
+        open_event_sector(next_event_sector(event_head_sector), time_ms);
+    } else if (!is_delta_set) {
+        program_event(static_cast<uint32_t>(std::min<uint64_t>(time_ms / 1000, UINT32_MAX)), 0, EVENT_TYPE_TIME);
+    }
+
+    const uint64_t delta_ms = (time_ms >= event_last_ms) ? (time_ms - event_last_ms) : 0;
+    program_event(static_cast<uint32_t>(std::min<uint64_t>(delta_ms, UINT32_MAX)), key, type);
+    mutex_exit(&mutex);
 
     return StorageStatus::SUCCESS;
 }
 
-StorageStatus Storage::update_blob_in_sector(BlobType blob_type, std::span<uint8_t> blob) {
-    const uint blob_id = static_cast<uint>(blob_type);
-    if (blob_id > max_blob_id) {
-        return StorageStatus::INVALID_ID;
+uint32_t Storage::read_events(uint32_t first_sequence, std::span<StorageEvent_t> events,
+    uint32_t& next_sequence) const {
+    /* Sectors of the ring, oldest first */
+    std::array<uint, STORAGE_EVENT_SECTORS_COUNT> sectors;
+    std::array<EventSectorHeader_t, STORAGE_EVENT_SECTORS_COUNT> headers;
+    uint sectors_count = 0;
+    for (uint id = STORAGE_EVENT_FIRST_SECTOR; id < STORAGE_LOG_FIRST_SECTOR; ++id) {
+        EventSectorHeader_t header;
+        if (!dirty_sectors[id] && read_event_header(id, header)) {
+            sectors[sectors_count] = id;
+            headers[sectors_count] = header;
+            sectors_count++;
+        }
+    }
+    std::array<uint, STORAGE_EVENT_SECTORS_COUNT> order;
+    for (uint i = 0; i < sectors_count; ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.begin() + sectors_count,
+        [&headers](uint a, uint b) { return headers[a].first_sequence < headers[b].first_sequence; });
+
+    uint32_t count = 0;
+    next_sequence  = std::max(first_sequence, (sectors_count > 0) ? headers[order[0]].first_sequence : 0);
+    for (uint i = 0; (i < sectors_count) && (count < events.size()); ++i) {
+        const uint sector_id = sectors[order[i]];
+        const uint32_t start = get_sector_start(sector_id) + sizeof(EventSectorHeader_t);
+        const uint32_t end   = (sector_id == event_head_sector) ? event_head_offset : get_sector_start(sector_id + 1);
+        uint32_t sequence    = headers[order[i]].first_sequence;
+        uint64_t time_ms     = 0;
+
+        /* Times are deltas, so the sector is walked from its start even when reading begins later */
+        for (uint32_t offset = start; (offset < end) && (count < events.size()); offset += sizeof(EventRecord_t)) {
+            const EventRecord_t record = read_event(offset);
+            if (is_erased(offset, sizeof(record)))
+                break;
+            sequence++;
+            if (record.check != calculate_event_check(record))
+                continue;
+            time_ms = get_event_time(time_ms, record);
+            if ((sequence <= next_sequence) || (record.type == EVENT_TYPE_TIME))
+                continue;
+            events[count++] = { sequence - 1, record.key, record.type, time_ms };
+        }
+        next_sequence = std::max(next_sequence, sequence);
+    }
+
+    return count;
+}
+
+StorageEventRange_t Storage::get_event_range() const {
+    StorageEventRange_t range = { event_next_sequence, event_next_sequence };
+    for (uint id = STORAGE_EVENT_FIRST_SECTOR; id < STORAGE_LOG_FIRST_SECTOR; ++id) {
+        EventSectorHeader_t header;
+        if (!dirty_sectors[id] && read_event_header(id, header))
+            range.oldest_sequence = std::min(range.oldest_sequence, header.first_sequence);
+    }
+    return range;
+}
+
+/* -------------------------------------------------------------------------- */
+/*                                 Log layout                                 */
+/* -------------------------------------------------------------------------- */
+
+void Storage::reset_index() {
+    index.fill({ LOG_OFFSET_NONE, 0, 0, 0 });
+    sector_end.fill(0);
+}
+
+/*
+ * The first record opens the sector, its sequence goes on from the logs scan_zone() found dropped.
+ * An erased sector is preferred so that opening it does not wait for an erase.
+ */
+void Storage::reset_zone(LogZone_t& zone, uint first_sector) {
+    zone.head_sector = first_sector;
+    for (uint i = 0, id = first_sector; i < zone.layout.sectors_count; ++i, id = next_sector(zone, id)) {
+        if (is_erased(get_sector_start(id), FLASH_SECTOR_SIZE)) {
+            zone.head_sector = id;
+            break;
+        }
+    }
+    zone.tail_sector = zone.head_sector;
+    zone.head_offset = LOG_OFFSET_NONE;
+}
+
+void Storage::open_sector(LogZone_t& zone, uint sector_id) {
+    const LogSectorHeader_t header = { LOG_SECTOR_MAGIC, ++zone.sequence, UINT32_MAX, UINT32_MAX };
+
+    prepare_sector(sector_id);
+    page.fill(0xFF);
+    std::memcpy(page.data(), &header, sizeof(header));
+    flash.program(get_sector_start(sector_id), page);
+
+    zone.head_sector      = sector_id;
+    zone.head_offset      = get_sector_start(sector_id) + sizeof(LogSectorHeader_t);
+    sector_end[sector_id] = zone.head_offset;
+}
+
+/* The newest sector goes first, once it is dropped the older ones are gone as well, even if a power cut
+   stops this halfway. The rest still gets dropped, task() may erase the newest one before them */
+void Storage::drop_log(const LogZone_t& zone) {
+    const uint first = zone.layout.first_sector;
+    const uint count = zone.layout.sectors_count;
+    for (uint i = 0; i < count; ++i) {
+        const uint id = first + ((zone.head_sector - first + count - i) % count);
+        LogSectorHeader_t header;
+        std::memcpy(&header, flash.data() + get_sector_start(id), sizeof(header));
+        if ((header.magic != LOG_SECTOR_MAGIC) || (header.dropped == LOG_SECTOR_DROPPED))
+            continue;
+
+        page.fill(0xFF);
+        std::fill_n(page.begin() + offsetof(LogSectorHeader_t, dropped), sizeof(header.dropped), 0);
+        flash.program(get_sector_start(id), page);
+        retire_sector(id);
+    }
+}
+
+bool Storage::scan_zone(LogZone_t& zone) {
+    const uint first = zone.layout.first_sector;
+    const uint count = zone.layout.sectors_count;
+    std::array<uint32_t, STORAGE_SECTORS_COUNT> sequences{};
+    uint32_t dropped_sequence = 0;
+    bool found                = false;
+
+    for (uint id = first; id < first + count; ++id) {
+        LogSectorHeader_t header;
+        std::memcpy(&header, flash.data() + get_sector_start(id), sizeof(header));
+        if ((header.magic == LOG_SECTOR_MAGIC) && (header.dropped == LOG_SECTOR_DROPPED)) {
+            dropped_sequence = std::max(dropped_sequence, header.sequence);
+            continue;
+        }
+        sequences[id] = (header.magic == LOG_SECTOR_MAGIC) ? header.sequence : 0;
+        if ((sequences[id] != 0) && (!found || (sequences[id] > sequences[zone.head_sector]))) {
+            zone.head_sector = id;
+            found            = true;
+        }
+    }
+
+    /* A power cut stopped erase() after it dropped the newest sector, the older ones follow it */
+    if (found && (sequences[zone.head_sector] < dropped_sequence)) {
+        drop_log(zone);
+        found = false;
+    }
+
+    zone.sequence = found ? sequences[zone.head_sector] : dropped_sequence;
+    if (!found)
+        return false;
+
+    /* The log occupies consecutive sectors ending at the head */
+    zone.tail_sector = zone.head_sector;
+    for (uint i = 1; i < count; ++i) {
+        const uint prev = first + ((zone.tail_sector - first + count - 1) % count);
+        if ((sequences[prev] == 0) || (sequences[prev] != sequences[zone.tail_sector] - 1))
+            break;
+        zone.tail_sector = prev;
+    }
+
+    /* Everything outside of the log has to be erased before new records go there */
+    for (uint id = next_sector(zone, zone.head_sector); id != zone.tail_sector; id = next_sector(zone, id)) {
+        if (!is_erased(get_sector_start(id), FLASH_SECTOR_SIZE))
+            retire_sector(id);
+    }
+
+    ScanState_t state = {};
+    for (uint id = zone.tail_sector;; id = next_sector(zone, id)) {
+        scan_sector(zone, id, state);
+        if (id == zone.head_sector)
+            break;
+    }
+
+    /* Never program over a partially written record */
+    const uint32_t head_end = get_sector_start(zone.head_sector + 1);
+    zone.head_offset        = sector_end[zone.head_sector];
+    if (!is_erased(zone.head_offset, head_end - zone.head_offset)) {
+        zone.head_offset = head_end;
+    }
+
+    verify_extents(zone, state);
+    repair_blobs(zone, state);
+
+    return true;
+}
+
+void Storage::scan_sector(const LogZone_t& zone, uint sector_id, ScanState_t& state) {
+    const uint32_t limit = get_sector_start(sector_id + 1);
+    uint32_t offset      = get_sector_start(sector_id) + sizeof(LogSectorHeader_t);
+
+    /* Index as it was before the commit which is being read */
+    uint32_t chain_start = LOG_OFFSET_NONE;
+    uint32_t chain_blobs = 0;
+    bool is_chain_intact = true;
+    std::array<BlobIndexEntry_t, blobs_count> chain_index;
+
+    while (offset + sizeof(LogRecordHeader_t) <= limit) {
+        const LogRecordHeader_t record = read_record(offset);
+        if (!is_record_valid(record, offset, limit))
+            break;
+
+        const bool is_chained = (record.flags & LOG_RECORD_FLAG_CHAINED) != 0;
+        if ((chain_start == LOG_OFFSET_NONE) && is_chained) {
+            chain_start     = offset;
+            chain_blobs     = 0;
+            is_chain_intact = true;
+            chain_index     = index;
+        }
+
+        /* Records of blobs moved to another zone or class by a layout change are left behind */
+        const uint blob_id      = record.blob_id;
+        BlobIndexEntry_t& entry = index[blob_id];
+        const bool is_zone_blob = (&get_zone(blob_id) == &zone) &&
+                                  (is_extent_blob(blob_id) == (record.kind == LogRecordKind::EXTENT));
+        state.max_version[blob_id] = std::max(state.max_version[blob_id], record.version);
+        chain_blobs |= (1u << blob_id);
+
+        if (!is_record_intact(record, offset)) {
+            /* Skipped, the blob stays at its previous version and gets rewritten after the scan */
+            boot_report.corrupted_records++;
+            state.damaged_blobs |= (1u << blob_id);
+            is_chain_intact = false;
+        } else if (is_zone_blob && (record.kind != LogRecordKind::DELTA)) {
+            entry.base_offset = offset;
+            entry.size        = get_record_blob_size(record, offset);
+            entry.version     = record.version;
+            entry.schema      = get_record_schema(record.flags);
+            state.damaged_blobs &= ~(1u << blob_id);
+        } else if (is_zone_blob && (entry.base_offset != LOG_OFFSET_NONE) && (record.version == entry.version + 1) &&
+                   (get_record_schema(record.flags) == entry.schema)) {
+            entry.version = record.version;
+        } else if (is_zone_blob) {
+            /* A DELTA whose predecessor was lost */
+            state.damaged_blobs |= (1u << blob_id);
+        }
+
+        offset += get_log_record_size(record.length);
+        if (!is_chained && (chain_start != LOG_OFFSET_NONE)) {
+            if (!is_chain_intact) {
+                index = chain_index;
+                state.damaged_blobs |= chain_blobs;
+            }
+            chain_start = LOG_OFFSET_NONE;
+        }
+    }
+
+    /* An incomplete commit is dropped as a whole, the head gets sealed by scan_zone() */
+    if (chain_start != LOG_OFFSET_NONE) {
+        index  = chain_index;
+        offset = chain_start;
+    }
+
+    sector_end[sector_id] = offset;
+}
+
+void Storage::repair_blobs(const LogZone_t& zone, const ScanState_t& state) {
+    for (uint blob_id = 0; blob_id < blobs_count; ++blob_id) {
+        if (!(state.damaged_blobs & (1u << blob_id)) || (&get_zone(blob_id) != &zone))
+            continue;
+
+        /* The newest intact version is written again above every version found in the log */
+        BlobIndexEntry_t& entry = index[blob_id];
+        if (entry.base_offset == LOG_OFFSET_NONE) {
+            entry.version = std::max(entry.version, state.max_version[blob_id]);
+            continue;
+        }
+
+        if (append_copy(blob_id, state.max_version[blob_id]) == StorageStatus::SUCCESS)
+            boot_report.recovered_blobs++;
+    }
+}
+
+bool Storage::import_legacy_slots() {
+    /* Fixed 2 KB slots written by the firmware before the log was introduced, where the log is now */
+    constexpr uint legacy_blobs_count = static_cast<uint>(BlobType::TIME_TRACKER_DATA) + 1;
+    constexpr uint legacy_end         = STORAGE_LOG_FIRST_SECTOR +
+        (legacy_blobs_count * BLOB_SLOT_SIZE_BYTES + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
+    static_assert(std::all_of(STORAGE_LAYOUT.begin(), STORAGE_LAYOUT.end(),
+                      [](const StorageZone_t& zone) { return (zone.first_sector + zone.sectors_count) > legacy_end; }),
+        "Every zone needs a sector outside of the legacy slots to import them.");
+
+    auto get_slot = [this](uint blob_id) {
+        return flash.data() + get_sector_start(STORAGE_LOG_FIRST_SECTOR) + (blob_id * BLOB_SLOT_SIZE_BYTES);
+    };
+    /* A log sector reusing the space may hold the magic of a blob payload where a slot was */
+    auto is_slot_used = [this, &get_slot](uint blob_id) {
+        if (blob_id >= legacy_blobs_count)
+            return false;
+        const uint32_t slot_start = get_sector_start(STORAGE_LOG_FIRST_SECTOR) + (blob_id * BLOB_SLOT_SIZE_BYTES);
+        uint32_t sector_magic;
+        uint32_t magic;
+        std::memcpy(&sector_magic, flash.data() + get_sector_start(get_sector_id(slot_start)), sizeof(sector_magic));
+        std::memcpy(&magic, get_slot(blob_id), sizeof(magic));
+        return (sector_magic != LOG_SECTOR_MAGIC) && (magic == BLOB_MAGIC);
+    };
+
+    /* The slots are erased only once all of them are in the log, until then the import starts over at every boot */
+    bool found       = false;
+    bool is_imported = true;
+    for (uint blob_id = 0; blob_id < blobs_count; ++blob_id) {
+        if (!is_slot_used(blob_id))
+            continue;
+        found = true;
+        is_imported &= (index[blob_id].base_offset != LOG_OFFSET_NONE);
+    }
+    if (!found)
+        return false;
+    if (is_imported) {
+        for (uint id = STORAGE_LOG_FIRST_SECTOR; id < legacy_end; ++id) {
+            erase_sector(id);
+        }
+        return false;
+    }
+
+    for (uint id = legacy_end; id < STORAGE_SECTORS_COUNT; ++id) {
+        if (!is_erased(get_sector_start(id), FLASH_SECTOR_SIZE))
+            erase_sector(id);
+    }
+
+    reset_index();
+    for (auto& zone : zones) {
+        reset_zone(zone, std::max(zone.layout.first_sector, legacy_end));
+    }
+
+    for (uint blob_id = 0; blob_id < blobs_count; ++blob_id) {
+        if (!is_slot_used(blob_id))
+            continue;
+
+        /* Trailing 0xFF bytes are restored by get_blob, there is no need to keep them */
+        const uint8_t* slot = get_slot(blob_id);
+        uint32_t length     = BLOB_LAYOUT[blob_id].max_size;
+        while ((length > sizeof(uint32_t)) && (slot[length - 1] == 0xFF)) {
+            length--;
+        }
+
+        /* The slots hold the layouts from before schemas were introduced, schema 0 */
+        (void)commit_record(blob_id, LogRecordKind::FULL, 0, static_cast<uint16_t>(length), get_schema_flags(0), 0,
+            [slot](uint32_t position, std::span<uint8_t> window) {
+                std::copy_n(slot + position, window.size(), window.begin());
+            });
+    }
+
+    for (uint id = STORAGE_LOG_FIRST_SECTOR; id < legacy_end; ++id) {
+        erase_sector(id);
+    }
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+/*                                   Records                                  */
+/* -------------------------------------------------------------------------- */
+
+LogRecordHeader_t Storage::read_record(uint32_t offset) const {
+    LogRecordHeader_t record;
+    std::memcpy(&record, flash.data() + offset, sizeof(record));
+    return record;
+}
+
+bool Storage::is_record_valid(const LogRecordHeader_t& record, uint32_t offset, uint32_t limit) const {
+    if ((record.magic != LOG_RECORD_MAGIC) || (record.blob_id >= blobs_count)) {
+        return false;
+    }
+
+    if ((record.kind != LogRecordKind::FULL) && (record.kind != LogRecordKind::DELTA) &&
+        (record.kind != LogRecordKind::EXTENT)) {
+        return false;
+    }
+
+    if ((record.kind == LogRecordKind::EXTENT) && (record.length != sizeof(LogExtent_t))) {
+        return false;
+    }
+
+    if ((record.flags & ~(LOG_RECORD_FLAG_CHAINED | LOG_RECORD_FLAG_CLEAR_ONLY | LOG_RECORD_SCHEMA_MASK)) != 0) {
+        return false;
+    }
+
+    /* The offset of a FULL record only marks where its clear-only tail starts */
+    const bool is_clear_only = (record.flags & LOG_RECORD_FLAG_CLEAR_ONLY) != 0;
+    if (is_clear_only && ((record.kind != LogRecordKind::FULL) || (record.offset > record.length))) {
+        return false;
+    }
+    const uint32_t blob_offset = is_clear_only ? 0 : record.offset;
+
+    return (record.length <= BLOB_SLOT_SIZE_BYTES) && ((blob_offset + record.length) <= BLOB_SLOT_SIZE_BYTES) &&
+           ((offset + get_log_record_size(record.length)) <= limit);
+}
+
+bool Storage::is_record_intact(const LogRecordHeader_t& record, uint32_t offset) const {
+    const std::span<const uint8_t> payload(flash.data() + offset + sizeof(record), get_crc_length(record));
+    return (calculate_record_crc(record, payload) == record.crc);
+}
+
+bool Storage::get_next_record(const LogZone_t& zone, uint32_t& offset) const {
+    uint sector_id = get_sector_id(offset);
+    uint32_t next  = offset + get_log_record_size(read_record(offset).length);
+
+    while (next >= sector_end[sector_id]) {
+        if (sector_id == zone.head_sector)
+            return false;
+        sector_id = next_sector(zone, sector_id);
+        next      = get_sector_start(sector_id) + sizeof(LogSectorHeader_t);
+    }
+
+    offset = next;
+    return true;
+}
+
+uint32_t Storage::get_record_blob_size(const LogRecordHeader_t& record, uint32_t offset) const {
+    if (record.kind != LogRecordKind::EXTENT)
+        return record.length;
+
+    LogExtent_t extent;
+    std::memcpy(&extent, flash.data() + offset + sizeof(record), sizeof(extent));
+    return extent.size;
+}
+
+LogExtent_t Storage::read_extent(uint blob_id) const {
+    LogExtent_t extent;
+    std::memcpy(&extent, flash.data() + index[blob_id].base_offset + sizeof(LogRecordHeader_t), sizeof(extent));
+    return extent;
+}
+
+std::span<const uint8_t> Storage::get_base_payload(uint blob_id) const {
+    const BlobIndexEntry_t& entry = index[blob_id];
+    const uint32_t offset =
+        is_extent_blob(blob_id) ? read_extent(blob_id).offset : (entry.base_offset + sizeof(LogRecordHeader_t));
+    return std::span<const uint8_t>(flash.data() + offset, entry.size);
+}
+
+uint32_t Storage::materialize(uint blob_id, std::span<uint8_t> blob) const {
+    materialize_range(blob_id, 0, blob);
+    return (index[blob_id].base_offset != LOG_OFFSET_NONE) ? index[blob_id].size : 0;
+}
+
+void Storage::materialize_range(uint blob_id, uint32_t start, std::span<uint8_t> window) const {
+    const BlobIndexEntry_t& entry = index[blob_id];
+    std::fill(window.begin(), window.end(), 0xFF);
+    if (entry.base_offset == LOG_OFFSET_NONE)
+        return;
+
+    /* Copies the part of [first, first + length) falling into the window */
+    const uint32_t end = start + static_cast<uint32_t>(window.size());
+    auto apply         = [&](const uint8_t* bytes, uint32_t first, uint32_t length) {
+        const uint32_t from = std::max(first, start);
+        const uint32_t to   = std::min(first + length, end);
+        if (from < to)
+            std::copy(bytes + (from - first), bytes + (to - first), window.begin() + (from - start));
+    };
+
+    apply(get_base_payload(blob_id).data(), 0, entry.size);
+    if (is_extent_blob(blob_id))
+        return;
+
+    /* Versions of a blob are consecutive, anything past a gap was dropped by the boot scan */
+    uint32_t offset  = entry.base_offset;
+    uint32_t version = read_record(offset).version;
+    while ((version != entry.version) && get_next_record(get_zone(blob_id), offset)) {
+        const LogRecordHeader_t record = read_record(offset);
+        if (record.blob_id != blob_id)
+            continue;
+        if ((record.version != version + 1) || (record.kind != LogRecordKind::DELTA))
+            break;
+        version = record.version;
+
+        apply(flash.data() + offset + sizeof(record), record.offset, std::min<uint32_t>(record.length, entry.size));
     }
+}
+
+template <typename Fill>
+void Storage::write_record(uint32_t offset, const LogRecordHeader_t& header, Fill&& fill_payload) {
+    const uint8_t* header_bytes = reinterpret_cast<const uint8_t*>(&header);
+    const uint32_t payload      = offset + sizeof(header);
+    const uint32_t end          = payload + header.length;
+
+    /* A torn clear-only tail would pass the CRC, such a record gets its header only once complete */
+    const bool is_header_last = (header.flags & LOG_RECORD_FLAG_CLEAR_ONLY) != 0;
+
+    /* Bytes left as 0xFF are not affected by programming, records are appended page by page */
+    for (uint32_t page_start = offset & ~(FLASH_PAGE_SIZE - 1); page_start < end; page_start += FLASH_PAGE_SIZE) {
+        page.fill(0xFF);
+        const uint32_t page_end = page_start + FLASH_PAGE_SIZE;
 
-    BlobBuff_t blob_copy{};
-    std::copy(blob.begin(), blob.end(), blob_copy.begin());
+        const uint32_t header_first = std::max(offset, page_start);
+        const uint32_t header_last  = std::min(payload, page_end);
+        if ((header_first < header_last) && !is_header_last) {
+            std::copy(header_bytes + (header_first - offset), header_bytes + (header_last - offset),
+                page.begin() + (header_first - page_start));
+        }
+
+        const uint32_t payload_first = std::max(payload, page_start);
+        const uint32_t payload_last  = std::min(end, page_end);
+        if (payload_first < payload_last) {
+            fill_payload(payload_first - payload,
+                std::span<uint8_t>(page.data() + (payload_first - page_start), payload_last - payload_first));
+        }
 
-    /* Fulfill rest of the sector with 0xFF */
-    if (blob.size() < BLOB_SLOT_SIZE_BYTES) {
-        std::memset(blob_copy.data() + blob.size(), 0xFF, BLOB_SLOT_SIZE_BYTES - blob.size());
+        flash.program(page_start, page);
     }
 
-    sector[blob_id % blobs_per_sector] = std::move(blob_copy);
+    if (is_header_last) {
+        const uint32_t page_start = offset & ~(FLASH_PAGE_SIZE - 1);
+        page.fill(0xFF);
+        std::copy(header_bytes, header_bytes + sizeof(header), page.begin() + (offset - page_start));
+        flash.program(page_start, page);
+    }
+}
+
+StorageStatus Storage::reserve(LogZone_t& zone, uint32_t record_size) {
+    if (zone.head_offset == LOG_OFFSET_NONE)
+        open_sector(zone, zone.head_sector);
+    if (!is_head_full(zone, record_size))
+        return StorageStatus::SUCCESS;
+
+    if (!compacting) {
+        for (uint i = 0; (i < zone.layout.sectors_count) && (free_sectors(zone) <= zone.layout.reserved_sectors);
+             ++i) {
+            compact_tail(zone);
+        }
+        /* Relocated blobs may have left some space in a freshly opened sector */
+        if (!is_head_full(zone, record_size))
+            return StorageStatus::SUCCESS;
+    }
+
+    if (free_sectors(zone) == 0)
+        return StorageStatus::NO_SPACE;
+
+    open_sector(zone, next_sector(zone, zone.head_sector));
 
     return StorageStatus::SUCCESS;
 }
 
-void Storage::save_sector(uint sector_id) const {
-    if (sector.size() * BLOB_SLOT_SIZE_BYTES != FLASH_SECTOR_SIZE) {
+void Storage::compact_tail(LogZone_t& zone) {
+    if (zone.tail_sector == zone.head_sector)
+        return;
+
+    const uint victim    = zone.tail_sector;
+    StorageStatus status = StorageStatus::SUCCESS;
+    compacting           = true;
+
+    /* Blobs based in the oldest sector are rewritten at the head as a single FULL record */
+    for (uint blob_id = 0; (blob_id < blobs_count) && (status == StorageStatus::SUCCESS); ++blob_id) {
+        const uint32_t base_offset = index[blob_id].base_offset;
+        if ((base_offset == LOG_OFFSET_NONE) || (get_sector_id(base_offset) != victim))
+            continue;
+
+        status = append_copy(blob_id);
+    }
+
+    compacting = false;
+
+    /* Keep the sector when anything failed to move, it still holds the only copy */
+    if (status != StorageStatus::SUCCESS)
         return;
+
+    retire_sector(victim);
+    sector_end[victim] = 0;
+    zone.tail_sector   = next_sector(zone, victim);
+}
+
+StorageStatus Storage::append_record(
+    uint blob_id, LogRecordKind kind, uint16_t offset, std::span<const uint8_t> payload, uint8_t flags) {
+    flags |= get_schema_flags(BLOB_LAYOUT[blob_id].schema);
+    return commit_record(blob_id, kind, offset, static_cast<uint16_t>(payload.size()), flags, 0,
+        [payload](uint32_t position, std::span<uint8_t> window) {
+            std::copy_n(payload.begin() + position, window.size(), window.begin());
+        });
+}
+
+StorageStatus Storage::append_copy(uint blob_id, uint32_t min_version) {
+    const uint8_t flags = get_schema_flags(index[blob_id].schema);
+    if (is_extent_blob(blob_id)) {
+        /* Only the pointer moves, the content stays in its slot */
+        return commit_record(blob_id, LogRecordKind::EXTENT, 0, sizeof(LogExtent_t), flags, min_version,
+            [this, blob_id](uint32_t position, std::span<uint8_t> window) {
+                const LogExtent_t extent = read_extent(blob_id);
+                std::copy_n(reinterpret_cast<const uint8_t*>(&extent) + position, window.size(), window.begin());
+            });
+    }
+
+    /* A clear-only tail stays programmable in place at the new location */
+    const LogRecordHeader_t base = read_record(index[blob_id].base_offset);
+    const uint8_t clear_only     = base.flags & LOG_RECORD_FLAG_CLEAR_ONLY;
+    return commit_record(blob_id, LogRecordKind::FULL, clear_only ? base.offset : 0,
+        static_cast<uint16_t>(index[blob_id].size), flags | clear_only, min_version,
+        [this, blob_id](uint32_t position, std::span<uint8_t> window) { materialize_range(blob_id, position, window); });
+}
+
+template <typename Fill>
+StorageStatus Storage::commit_record(uint blob_id, LogRecordKind kind, uint16_t offset, uint16_t length,
+    uint8_t flags, uint32_t min_version, Fill&& fill_payload) {
+    const uint32_t record_size = get_log_record_size(length);
+    LogZone_t& zone            = get_zone(blob_id);
+
+    /* Compaction may move this very blob, the version is only known afterwards */
+    const StorageStatus status = reserve(zone, record_size);
+    if (status != StorageStatus::SUCCESS)
+        return status;
+
+    BlobIndexEntry_t& entry  = index[blob_id];
+    LogRecordHeader_t header = {
+        .magic   = LOG_RECORD_MAGIC,
+        .flags   = flags,
+        .blob_id = static_cast<uint8_t>(blob_id),
+        .kind    = kind,
+        .offset  = offset,
+        .length  = length,
+        .version = std::max(entry.version, min_version) + 1,
+        .crc     = 0,
+    };
+
+    /* The payload is produced one page at a time, never as a whole */
+    const uint32_t crc_length = get_crc_length(header);
+    uint32_t crc              = calculate_record_crc(header, {});
+    for (uint32_t position = 0; position < crc_length; position += FLASH_PAGE_SIZE) {
+        const std::span<uint8_t> window(page.data(), std::min<uint32_t>(FLASH_PAGE_SIZE, length - position));
+        fill_payload(position, window);
+        crc = crc32_update(crc, window.first(std::min<size_t>(window.size(), crc_length - position)));
     }
-    const uintptr_t sector_addr = STORAGE_FLASH_OFFSET + (sector_id * FLASH_SECTOR_SIZE);
+    header.crc = crc;
 
-    const uint32_t interrupts = save_and_disable_interrupts();
-    flash_range_program(sector_addr, reinterpret_cast<const uint8_t*>(sector.data()), FLASH_SECTOR_SIZE);
-    restore_interrupts(interrupts);
+    write_record(zone.head_offset, header, fill_payload);
+
+    if (kind != LogRecordKind::DELTA) {
+        entry.base_offset = zone.head_offset;
+        entry.size        = get_record_blob_size(header, zone.head_offset);
+        entry.schema      = get_record_schema(flags);
+    }
+    entry.version = header.version;
+
+    zone.head_offset += record_size;
+    sector_end[zone.head_sector] = zone.head_offset;
+
+    return StorageStatus::SUCCESS;
 }
 
-StorageStatus Storage::_save_blob(BlobType blob_type, std::span<uint8_t> blob) {
+uint32_t Storage::calculate_record_crc(const LogRecordHeader_t& header, std::span<const uint8_t> payload) {
+    const uint32_t crc =
+        crc32_update(0, std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(&header), offsetof(LogRecordHeader_t, crc)));
+    return crc32_update(crc, payload);
+}
+
+/* -------------------------------------------------------------------------- */
+/*                                   Extents                                  */
+/* -------------------------------------------------------------------------- */
+
+uint32_t Storage::get_extent_slot_start(uint blob_id, uint slot) {
+    return get_sector_start(get_extent_first_sector(blob_id) + (slot * get_extent_slot_sectors(blob_id)));
+}
+
+template <typename Fill>
+StorageStatus Storage::write_extent(uint blob_id, uint32_t size, uint8_t flags, Fill&& fill_content) {
+    /* The slot in use keeps the current content until the new EXTENT record is in the log */
+    const bool is_stored     = (index[blob_id].base_offset != LOG_OFFSET_NONE);
+    const uint32_t old_start = is_stored ? read_extent(blob_id).offset : LOG_OFFSET_NONE;
+    const uint slot          = (old_start == get_extent_slot_start(blob_id, 0)) ? 1 : 0;
+    const uint32_t start     = get_extent_slot_start(blob_id, slot);
+
+    for (uint32_t offset = 0; offset < size; offset += FLASH_SECTOR_SIZE) {
+        prepare_sector(get_sector_id(start + offset));
+    }
+
+    uint32_t crc = 0;
+    for (uint32_t position = 0; position < size; position += FLASH_PAGE_SIZE) {
+        const std::span<uint8_t> window(page.data(), std::min<uint32_t>(FLASH_PAGE_SIZE, size - position));
+        page.fill(0xFF);
+        fill_content(position, window);
+        crc = crc32_update(crc, window);
+        flash.program(start + position, page);
+    }
+
+    const LogExtent_t extent   = { start, size, crc };
+    const StorageStatus status = append_record(blob_id, LogRecordKind::EXTENT, 0,
+        std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(&extent), sizeof(extent)), flags);
+
+    /* Whichever slot the log does not point at is erased in the background */
+    if (status != StorageStatus::SUCCESS) {
+        retire_extent_slot(blob_id, start);
+    } else if (is_stored) {
+        retire_extent_slot(blob_id, old_start);
+    }
+
+    return status;
+}
+
+void Storage::retire_extent_slot(uint blob_id, uint32_t slot_start) {
+    const uint first = get_sector_id(slot_start);
+    for (uint sector_id = first; sector_id < first + get_extent_slot_sectors(blob_id); ++sector_id) {
+        if (!is_erased(get_sector_start(sector_id), FLASH_SECTOR_SIZE))
+            retire_sector(sector_id);
+    }
+}
+
+bool Storage::is_extent_identical(uint blob_id, std::span<const uint8_t> blob) const {
+    const BlobIndexEntry_t& entry = index[blob_id];
+    if ((entry.base_offset == LOG_OFFSET_NONE) || !is_current_schema(blob_id) || (entry.size != blob.size()))
+        return false;
+
+    const std::span<const uint8_t> content = get_base_payload(blob_id);
+    return std::equal(content.begin(), content.end(), blob.begin());
+}
+
+void Storage::verify_extents(const LogZone_t& zone, ScanState_t& state) {
+    for (uint blob_id = 0; blob_id < blobs_count; ++blob_id) {
+        BlobIndexEntry_t& entry = index[blob_id];
+        if (!is_extent_blob(blob_id) || (&get_zone(blob_id) != &zone) || (entry.base_offset == LOG_OFFSET_NONE))
+            continue;
+
+        /* Slots are reused, so only the newest EXTENT record can be checked against its content */
+        const LogExtent_t extent = read_extent(blob_id);
+        const bool is_in_slot    = (extent.size <= get_extent_slot_sectors(blob_id) * FLASH_SECTOR_SIZE) &&
+                                ((extent.offset == get_extent_slot_start(blob_id, 0)) ||
+                                    (extent.offset == get_extent_slot_start(blob_id, 1)));
+        if (is_in_slot && (crc32_update(0, get_base_payload(blob_id)) == extent.crc))
+            continue;
+
+        /* There is no older copy to fall back to, the blob is gone */
+        boot_report.corrupted_records++;
+        entry.base_offset = LOG_OFFSET_NONE;
+        state.damaged_blobs |= (1u << blob_id);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/*                                    Blobs                                   */
+/* -------------------------------------------------------------------------- */
+
+StorageStatus Storage::_get_blob(BlobType blob_type, std::span<uint8_t> blob) const {
+    const uint blob_id = static_cast<uint>(blob_type);
+    if (blob_id >= blobs_count) {
+        return StorageStatus::INVALID_ID;
+    }
+
+    if (is_pending(blob_id)) {
+        const uint8_t* staged  = staging.data() + get_blob_staging_offset(blob_id);
+        const size_t copy_size = std::min(blob.size(), static_cast<size_t>(staged_size[blob_id]));
+        std::copy(staged, staged + copy_size, blob.begin());
+        std::fill(blob.begin() + static_cast<std::ptrdiff_t>(copy_size), blob.end(), 0xFF);
+        return StorageStatus::SUCCESS;
+    }
+
+    /* An outdated layout is never handed out, it has to be migrated first */
+    if ((index[blob_id].base_offset == LOG_OFFSET_NONE) || !is_current_schema(blob_id)) {
+        std::fill(blob.begin(), blob.end(), 0xFF);
+        return StorageStatus::NOT_FOUND;
+    }
+
+    (void)materialize(blob_id, blob);
+
+    return StorageStatus::SUCCESS;
+}
+
+StorageStatus Storage::_save_blob(BlobType blob_type, std::span<uint8_t> blob, size_t clear_only_offset) {
     const uint blob_id   = static_cast<uint>(blob_type);
-    StorageStatus status = StorageStatus::ERROR;
+    StorageStatus status = StorageStatus::SUCCESS;
 
-    if (blob_id > max_blob_id) {
+    if (blob_id >= blobs_count) {
         return StorageStatus::INVALID_ID;
     }
 
+    if ((blob.size() > BLOB_LAYOUT[blob_id].max_size) ||
+        ((clear_only_offset != clear_only_none) && (clear_only_offset > blob.size()))) {
+        return StorageStatus::INVALID_INPUT;
+    }
+
+    const uint64_t start_us = time_us_64();
     mutex_enter_blocking(&mutex);
+    clear_only_offsets[blob_id] = static_cast<uint16_t>(clear_only_offset);
+
+    if (is_extent_blob(blob_id)) {
+        /* Never staged, RAM for a copy of a blob of any size is not there */
+        if (is_extent_identical(blob_id, blob)) {
+            stats.writes_elided++;
+        } else {
+            status = write_extent(blob_id, static_cast<uint32_t>(blob.size()), get_schema_flags(BLOB_LAYOUT[blob_id].schema),
+                [blob](uint32_t position, std::span<uint8_t> window) {
+                    std::copy_n(blob.begin() + position, window.size(), window.begin());
+                });
+            stats.writes_performed += (status == StorageStatus::SUCCESS) ? 1 : 0;
+        }
+    } else if (write_back) {
+        status = stage_blob(blob_id, static_cast<uint16_t>(blob.size()), 0, blob);
+    } else {
+        const std::optional<RecordPlan_t> plan = plan_record(blob_id, blob);
+        if (plan) {
+            status = write_plan(blob_id, *plan, blob, LOG_RECORD_FLAG_NONE);
+        }
+
+        if (!plan) {
+            stats.writes_elided++;
+        } else if (status == StorageStatus::SUCCESS) {
+            stats.writes_performed++;
+        }
+    }
 
-    const uint sector_id = get_sector_id(blob_type);
+    FlashTimings::add_sample(save_latency, static_cast<uint32_t>(time_us_64() - start_us));
+    mutex_exit(&mutex);
+
+    return status;
+}
 
-    do {
-        status = read_sector(sector_id);
-        if (StorageStatus::SUCCESS != status) {
+StorageStatus Storage::_patch_blob(
+    BlobType blob_type, std::span<const uint8_t> blob, std::ptrdiff_t offset, size_t length) {
+    const uint blob_id = static_cast<uint>(blob_type);
+    if (blob_id >= blobs_count) {
+        return StorageStatus::INVALID_ID;
+    }
+
+    if (is_extent_blob(blob_id) || (blob.size() > BLOB_LAYOUT[blob_id].max_size) || (offset < 0) ||
+        ((static_cast<size_t>(offset) + length) > blob.size())) {
+        return StorageStatus::INVALID_INPUT;
+    }
+
+    const uint16_t size                  = static_cast<uint16_t>(blob.size());
+    const uint16_t first                 = static_cast<uint16_t>(offset);
+    const std::span<const uint8_t> bytes = blob.subspan(first, length);
+    StorageStatus status                 = StorageStatus::SUCCESS;
+
+    const uint64_t start_us = time_us_64();
+    mutex_enter_blocking(&mutex);
+
+    /* The rest of the blob comes from its newest version, which has to have the same layout */
+    const BlobIndexEntry_t& entry = index[blob_id];
+    const bool is_stored = (entry.base_offset != LOG_OFFSET_NONE) && (entry.size == size) && is_current_schema(blob_id);
+    if (is_pending(blob_id) ? (staged_size[blob_id] != size) : !is_stored) {
+        status = StorageStatus::NOT_FOUND;
+    } else if (write_back) {
+        status = stage_blob(blob_id, size, first, bytes);
+    } else if (is_patch_identical(blob_id, first, bytes)) {
+        stats.writes_elided++;
+    } else {
+        const bool in_place = (first >= clear_only_offsets[blob_id]) && can_program_in_place(blob_id, first, bytes);
+        status = write_plan(blob_id, { LogRecordKind::DELTA, first, static_cast<uint16_t>(length), in_place }, blob,
+            LOG_RECORD_FLAG_NONE);
+        stats.writes_performed += (status == StorageStatus::SUCCESS) ? 1 : 0;
+    }
+
+    FlashTimings::add_sample(save_latency, static_cast<uint32_t>(time_us_64() - start_us));
+    mutex_exit(&mutex);
+
+    return status;
+}
+
+bool Storage::is_patch_identical(uint blob_id, uint16_t offset, std::span<const uint8_t> bytes) {
+    for (uint32_t position = 0; position < bytes.size(); position += FLASH_PAGE_SIZE) {
+        const std::span<uint8_t> window(page.data(), std::min<size_t>(FLASH_PAGE_SIZE, bytes.size() - position));
+        materialize_range(blob_id, offset + position, window);
+        if (!std::equal(window.begin(), window.end(), bytes.begin() + position))
+            return false;
+    }
+    return true;
+}
+
+StorageStatus Storage::stage_blob(uint blob_id, uint16_t size, uint16_t offset, std::span<const uint8_t> bytes) {
+    const uint64_t now_ms = get_time_ms();
+    if (is_pending(blob_id)) {
+        stats.writes_coalesced++;
+    } else if (pending_blobs == 0) {
+        first_pending_ms = now_ms;
+    }
+
+    /* A patch with nothing staged yet applies to the stored version */
+    staged_size[blob_id] = size;
+    if (!is_pending(blob_id) && (bytes.size() != size))
+        (void)materialize(blob_id, get_staged(blob_id));
+
+    pending_blobs |= (1u << blob_id);
+    std::copy(bytes.begin(), bytes.end(), get_staged(blob_id).begin() + offset);
+    last_save_ms = now_ms;
+
+    /* Periodic saves can keep the quiet period from ever passing */
+    if ((now_ms - first_pending_ms) >= write_back->max_staleness_ms)
+        return commit_pending();
+
+    return StorageStatus::SUCCESS;
+}
+
+std::optional<Storage::RecordPlan_t> Storage::plan_record(uint blob_id, std::span<const uint8_t> blob) {
+    const uint16_t size           = static_cast<uint16_t>(blob.size());
+    const uint16_t tail_offset    = clear_only_offsets[blob_id];
+    const BlobIndexEntry_t& entry = index[blob_id];
+    const RecordPlan_t full       = { LogRecordKind::FULL, 0, size, false };
+    if ((entry.base_offset == LOG_OFFSET_NONE) || (entry.size != size) || !is_current_schema(blob_id)) {
+        return full;
+    }
+
+    /* The stored version is compared a page at a time, from both ends */
+    uint16_t first = 0;
+    while (first < size) {
+        const uint16_t length = std::min<uint16_t>(FLASH_PAGE_SIZE, static_cast<uint16_t>(size - first));
+        materialize_range(blob_id, first, std::span<uint8_t>(page.data(), length));
+        uint16_t matching = 0;
+        while ((matching < length) && (page[matching] == blob[first + matching])) {
+            matching++;
+        }
+        first = static_cast<uint16_t>(first + matching);
+        if (matching != length)
             break;
+    }
+
+    /* Identical to the stored version, nothing to program */
+    if (first == size) {
+        return std::nullopt;
+    }
+
+    uint16_t last = size;
+    while (last > first) {
+        const uint16_t length = std::min<uint16_t>(FLASH_PAGE_SIZE, static_cast<uint16_t>(last - first));
+        const uint16_t start  = static_cast<uint16_t>(last - length);
+        materialize_range(blob_id, start, std::span<uint8_t>(page.data(), length));
+        uint16_t matching = 0;
+        while ((matching < length) && (page[length - 1u - matching] == blob[last - 1u - matching])) {
+            matching++;
         }
+        last = static_cast<uint16_t>(last - matching);
+        if (matching != length)
+            break;
+    }
+
+    const uint16_t delta_size = static_cast<uint16_t>(last - first);
+    if (tail_offset != clear_only_none) {
+        if ((first >= tail_offset) && can_program_in_place(blob_id, first, blob.subspan(first, delta_size)))
+            return RecordPlan_t{ LogRecordKind::DELTA, first, delta_size, true };
+
+        /* The tail has to be in a FULL record of its own to be programmed in place by the next saves */
+        if ((last > tail_offset) || !is_clear_only_base(blob_id, tail_offset))
+            return full;
+    }
+
+    if (delta_size > (size / 2)) {
+        return full;
+    }
+
+    return RecordPlan_t{ LogRecordKind::DELTA, first, delta_size, false };
+}
+
+bool Storage::is_clear_only_base(uint blob_id, uint16_t tail_offset) const {
+    const LogRecordHeader_t base = read_record(index[blob_id].base_offset);
+    return ((base.flags & LOG_RECORD_FLAG_CLEAR_ONLY) != 0) && (base.offset == tail_offset);
+}
+
+bool Storage::can_program_in_place(uint blob_id, uint16_t offset, std::span<const uint8_t> bytes) const {
+    /* Deltas would hide whatever gets programmed into the FULL record */
+    const BlobIndexEntry_t& entry = index[blob_id];
+    if (!is_clear_only_base(blob_id, clear_only_offsets[blob_id]) ||
+        (read_record(entry.base_offset).version != entry.version))
+        return false;
+
+    const uint8_t* stored = get_base_payload(blob_id).data() + offset;
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        if ((stored[i] & bytes[i]) != bytes[i])
+            return false;
+    }
+    return true;
+}
+
+void Storage::program_in_place(uint blob_id, uint16_t offset, std::span<const uint8_t> bytes) {
+    const uint32_t payload = index[blob_id].base_offset + static_cast<uint32_t>(sizeof(LogRecordHeader_t));
+    const uint32_t first   = payload + offset;
+    const uint32_t last    = first + static_cast<uint32_t>(bytes.size());
+
+    /* Bytes outside of the range are left as 0xFF, programming does not touch them */
+    for (uint32_t page_start = first & ~(FLASH_PAGE_SIZE - 1); page_start < last; page_start += FLASH_PAGE_SIZE) {
+        const uint32_t from = std::max(first, page_start);
+        const uint32_t to   = std::min(last, page_start + FLASH_PAGE_SIZE);
+        page.fill(0xFF);
+        std::copy(bytes.begin() + (from - first), bytes.begin() + (to - first), page.begin() + (from - page_start));
+        flash.program(page_start, page);
+    }
+
+}
+
+StorageStatus Storage::write_plan(
+    uint blob_id, const RecordPlan_t& plan, std::span<const uint8_t> blob, uint8_t flags) {
+    if (plan.in_place) {
+        program_in_place(blob_id, plan.offset, blob.subspan(plan.offset, plan.length));
+        stats.writes_in_place++;
+        return StorageStatus::SUCCESS;
+    }
+
+    const uint16_t tail_offset = clear_only_offsets[blob_id];
+    if ((plan.kind == LogRecordKind::FULL) && (tail_offset != clear_only_none))
+        return append_record(blob_id, LogRecordKind::FULL, tail_offset, blob, flags | LOG_RECORD_FLAG_CLEAR_ONLY);
+
+    return append_record(blob_id, plan.kind, plan.offset, blob.subspan(plan.offset, plan.length), flags);
+}
 
-        status = update_blob_in_sector(blob_type, blob);
-        if (StorageStatus::SUCCESS != status) {
+StorageStatus Storage::migrate(BlobType blob_type, std::span<const BlobMigration_t> migrations) {
+    const uint blob_id = static_cast<uint>(blob_type);
+    if (blob_id >= blobs_count) {
+        return StorageStatus::INVALID_ID;
+    }
+
+    mutex_enter_blocking(&mutex);
+
+    /* A staged save already has the current layout and replaces the stored one on commit */
+    StorageStatus status          = StorageStatus::SUCCESS;
+    const BlobIndexEntry_t& entry = index[blob_id];
+    while ((status == StorageStatus::SUCCESS) && (entry.base_offset != LOG_OFFSET_NONE) && !is_pending(blob_id) &&
+           (entry.schema < BLOB_LAYOUT[blob_id].schema)) {
+        const auto migration = std::find_if(migrations.begin(), migrations.end(),
+            [&entry](const BlobMigration_t& m) { return m.from_schema == entry.schema; });
+        if ((migration == migrations.end()) || (migration->new_size > BLOB_LAYOUT[blob_id].max_size)) {
+            status = StorageStatus::INVALID_INPUT;
             break;
         }
 
-        erase(sector_id);
-        save_sector(sector_id);
-    } while (0);
+        /* The old blob is read in place, so its deltas are folded into a single record first */
+        if (read_record(entry.base_offset).version != entry.version) {
+            status = append_copy(blob_id);
+            continue;
+        }
+
+        /* Compaction may move the old blob while the space is reserved, its payload is looked up late */
+        const uint8_t flags = get_schema_flags(static_cast<uint8_t>(entry.schema + 1));
+        auto fill           = [this, blob_id, migration](uint32_t position, std::span<uint8_t> window) {
+            std::fill(window.begin(), window.end(), 0xFF);
+            migration->migrate(get_base_payload(blob_id), position, window);
+        };
+        status = is_extent_blob(blob_id)
+                     ? write_extent(blob_id, migration->new_size, flags, fill)
+                     : commit_record(blob_id, LogRecordKind::FULL, 0, static_cast<uint16_t>(migration->new_size),
+                           flags, 0, fill);
+    }
+
+    /* Newer than this firmware knows */
+    if ((status == StorageStatus::SUCCESS) && (entry.base_offset != LOG_OFFSET_NONE) && !is_pending(blob_id) &&
+        !is_current_schema(blob_id)) {
+        status = StorageStatus::INVALID_INPUT;
+    }
+
+    mutex_exit(&mutex);
+
+    return status;
+}
+
+/* -------------------------------------------------------------------------- */
+/*                                 Write-back                                 */
+/* -------------------------------------------------------------------------- */
+
+void Storage::enable_write_back(WriteBackPolicy_t policy) {
+    mutex_enter_blocking(&mutex);
+    write_back = policy;
+    mutex_exit(&mutex);
+}
+
+StorageStatus Storage::disable_write_back() {
+    mutex_enter_blocking(&mutex);
+    const StorageStatus status = commit_pending();
+    write_back.reset();
+    mutex_exit(&mutex);
+
+    return status;
+}
+
+StorageStatus Storage::flush() {
+    const uint64_t start_us = time_us_64();
+    mutex_enter_blocking(&mutex);
+    const StorageStatus status = commit_pending();
+    FlashTimings::add_sample(save_latency, static_cast<uint32_t>(time_us_64() - start_us));
+    mutex_exit(&mutex);
+
+    return status;
+}
+
+void Storage::task() {
+    if (write_back && (pending_blobs != 0)) {
+        const uint64_t now_ms = get_time_ms();
+        if (((now_ms - last_save_ms) >= write_back->quiet_ms) ||
+            ((now_ms - first_pending_ms) >= write_back->max_staleness_ms)) {
+            (void)flush();
+        }
+        /* Saves are still coming in, an erase now would only hold up their commit */
+        return;
+    }
 
+    /* A single sector per call, the rest of the main loop runs in between */
+    mutex_enter_blocking(&mutex);
+    (void)erase_dirty_sector();
     mutex_exit(&mutex);
+}
 
+StorageStatus Storage::commit_pending() {
+    StorageStatus status = StorageStatus::SUCCESS;
+    for (auto& zone : zones) {
+        const StorageStatus zone_status = commit_zone(zone);
+        if (status == StorageStatus::SUCCESS)
+            status = zone_status;
+    }
     return status;
 }
+
+StorageStatus Storage::commit_zone(LogZone_t& zone) {
+    std::array<std::optional<RecordPlan_t>, blobs_count> plans{};
+    uint32_t commit_size = 0;
+    uint planned         = 0;
+    uint last_blob_id    = blobs_count;
+
+    for (uint blob_id = 0; blob_id < blobs_count; ++blob_id) {
+        if (!is_pending(blob_id) || (&get_zone(blob_id) != &zone))
+            continue;
+
+        plans[blob_id] = plan_record(blob_id, get_staged(blob_id));
+        if (!plans[blob_id]) {
+            stats.writes_elided++;
+            continue;
+        }
+        planned++;
+        last_blob_id = blob_id;
+    }
+
+    for (auto& plan : plans) {
+        if (!plan)
+            continue;
+        /* Programming in place is not undone when the rest of the commit gets cut short */
+        plan->in_place = plan->in_place && (planned == 1);
+        commit_size += plan->in_place ? 0 : get_log_record_size(plan->length);
+    }
+
+    /* Space for the whole commit is reserved up front so it is never split between sectors */
+    StorageStatus status = (commit_size > 0) ? reserve(zone, commit_size) : StorageStatus::SUCCESS;
+    for (uint blob_id = 0; (blob_id < blobs_count) && (status == StorageStatus::SUCCESS); ++blob_id) {
+        if (!plans[blob_id])
+            continue;
+
+        const uint8_t flags = (blob_id == last_blob_id) ? LOG_RECORD_FLAG_NONE : LOG_RECORD_FLAG_CHAINED;
+        status              = write_plan(blob_id, *plans[blob_id], get_staged(blob_id), flags);
+        if (status == StorageStatus::SUCCESS)
+            stats.writes_performed++;
+    }
+
+    if (status != StorageStatus::SUCCESS)
+        return status;
+
+    for (uint blob_id = 0; blob_id < blobs_count; ++blob_id) {
+        if (&get_zone(blob_id) == &zone)
+            pending_blobs &= ~(1u << blob_id);
+    }
+
+    return StorageStatus::SUCCESS;
+}
@@ -0,0 +1,1346 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <memory>
+
+#include "clear_only_counters.hpp"
+#include "crc32.hpp"
+#include "emulated_flash.hpp"
+#include "storage.hpp"
+
+namespace {
+
+/* Same shape as the time tracker blob, the hottest one in the firmware */
+struct TrackingEntry {
+    uint64_t start_time_us;
+    uint64_t work_time_us;
+    uint64_t meeting_time_us;
+    bool flags[4];
+    uint8_t date[8];
+};
+
+struct TrackerData {
+    uint32_t magic;
+    TrackingEntry entries[31];
+    uint32_t active_session;
+    uint64_t medium_threshold_ms;
+    uint64_t long_threshold_ms;
+};
+
+struct KeysData {
+    uint32_t magic;
+    uint8_t colors[10];
+    uint32_t keys_count;
+};
+
+constexpr uint32_t LOG_START = STORAGE_LOG_FIRST_SECTOR * FLASH_SECTOR_SIZE;
+
+/* Tracker blob counting its checkpoints in a clear-only tail, folded into the entry when full */
+struct CountedTrackerData {
+    TrackerData tracker;
+    ThermometerCounter<128> checkpoints;
+};
+
+/* Test blob of schema 1, schema 0 had the layout of KeysData */
+struct SchemaDataV1 {
+    uint32_t magic;
+    uint8_t colors[10];
+    uint32_t keys_count;
+    uint32_t long_press_ms;
+};
+
+void migrate_schema_v0(std::span<const uint8_t> old_blob, uint32_t offset, std::span<uint8_t> window) {
+    const uint32_t long_press_ms = 800;
+    copy_to_window(window, offset, 0, old_blob.first(std::min(old_blob.size(), sizeof(KeysData))));
+    copy_to_window(window, offset, offsetof(SchemaDataV1, long_press_ms),
+        std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(&long_press_ms), sizeof(long_press_ms)));
+}
+
+constexpr BlobMigration_t SCHEMA_MIGRATIONS[] = {
+    { 0, sizeof(SchemaDataV1), migrate_schema_v0 },
+};
+
+/* The tracker blob kept its layout, only the schema moves on */
+void migrate_tracker_v0(std::span<const uint8_t> old_blob, uint32_t offset, std::span<uint8_t> window) {
+    copy_to_window(window, offset, 0, old_blob.first(std::min(old_blob.size(), sizeof(TrackerData))));
+}
+
+constexpr BlobMigration_t TRACKER_MIGRATIONS[] = {
+    { 0, sizeof(TrackerData), migrate_tracker_v0 },
+    { 1, sizeof(TrackerData), migrate_tracker_v0 },
+};
+
+/* Appends a record the way the firmware without schemas wrote it, returns the next offset */
+uint32_t write_golden_record(std::span<uint8_t> image, uint32_t offset, BlobType blob_type, LogRecordKind kind,
+    uint32_t version, uint16_t blob_offset, std::span<const uint8_t> payload) {
+    LogRecordHeader_t header = { LOG_RECORD_MAGIC, LOG_RECORD_FLAG_NONE, static_cast<uint8_t>(blob_type), kind,
+        blob_offset, static_cast<uint16_t>(payload.size()), version, 0 };
+    const auto* header_bytes = reinterpret_cast<const uint8_t*>(&header);
+    header.crc = crc32_update(crc32_update(0, std::span(header_bytes, offsetof(LogRecordHeader_t, crc))), payload);
+
+    std::memcpy(image.data() + offset, &header, sizeof(header));
+    std::ranges::copy(payload, image.begin() + offset + sizeof(header));
+    return offset + get_log_record_size(static_cast<uint32_t>(payload.size()));
+}
+
+template <typename T> std::span<const uint8_t> as_bytes(const T& value) {
+    return std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(&value), sizeof(value));
+}
+
+} // namespace
+
+class StorageTest : public ::testing::Test {
+  protected:
+    EmulatedFlash flash{ STORAGE_SIZE };
+
+    std::unique_ptr<Storage> boot() {
+        auto storage = std::make_unique<Storage>(flash);
+        EXPECT_EQ(storage->init(), StorageStatus::SUCCESS);
+        return storage;
+    }
+};
+
+TEST_F(StorageTest, FreshStorageHasNoBlobs) {
+    auto storage = boot();
+
+    KeysData keys;
+    EXPECT_EQ(storage->get_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::NOT_FOUND);
+    EXPECT_EQ(keys.magic, 0xFFFFFFFF);
+    EXPECT_EQ(storage->get_init_count(), 1);
+}
+
+TEST_F(StorageTest, InitCountPersistsAcrossReboots) {
+    for (uint32_t i = 1; i <= 5; ++i) {
+        auto storage = boot();
+        EXPECT_EQ(storage->get_init_count(), i);
+    }
+}
+
+TEST_F(StorageTest, NewestVersionIsResolvedAfterReboot) {
+    TrackerData data{};
+    data.magic = BLOB_MAGIC;
+    {
+        auto storage = boot();
+        for (uint64_t i = 0; i < 100; ++i) {
+            data.entries[i % 31].work_time_us = i * 1000;
+            data.active_session               = static_cast<uint32_t>(i % 31);
+            ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+        }
+    }
+
+    auto storage = boot();
+    TrackerData restored;
+    ASSERT_EQ(storage->get_blob(BlobType::TIME_TRACKER_DATA, restored), StorageStatus::SUCCESS);
+    EXPECT_EQ(std::memcmp(&data, &restored, sizeof(data)), 0);
+}
+
+TEST_F(StorageTest, CompactionKeepsColdBlobs) {
+    KeysData keys{ BLOB_MAGIC, { 1, 2, 3 }, 3 };
+    TrackerData data{};
+    data.magic = BLOB_MAGIC;
+
+    auto storage = boot();
+    ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+
+    for (uint64_t i = 0; i < 5000; ++i) {
+        /* Rewriting the whole blob defeats the deltas and forces the log to wrap many times */
+        std::memset(&data.entries, static_cast<int>(i), sizeof(data.entries));
+        ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+    }
+    EXPECT_GT(flash.get_erase_count(), STORAGE_SECTORS_COUNT);
+
+    storage = boot();
+    KeysData restored_keys;
+    TrackerData restored_data;
+    ASSERT_EQ(storage->get_blob(BlobType::KEYS_CONFIG, restored_keys), StorageStatus::SUCCESS);
+    ASSERT_EQ(storage->get_blob(BlobType::TIME_TRACKER_DATA, restored_data), StorageStatus::SUCCESS);
+    EXPECT_EQ(std::memcmp(&keys, &restored_keys, sizeof(keys)), 0);
+    EXPECT_EQ(std::memcmp(&data, &restored_data, sizeof(data)), 0);
+}
+
+TEST_F(StorageTest, ErasedStorageStartsEmpty) {
+    KeysData keys{ BLOB_MAGIC, { 1 }, 1 };
+    auto storage = boot();
+    ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+
+    storage->erase();
+    EXPECT_EQ(storage->get_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::NOT_FOUND);
+
+    storage = boot();
+    EXPECT_EQ(storage->get_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::NOT_FOUND);
+    EXPECT_EQ(storage->get_init_count(), 1);
+}
+
+TEST_F(StorageTest, LegacySlotsAreImported) {
+    /* Layout of the fixed 2 KB slots used before the log */
+    const StorageConfig_t legacy_config = { BLOB_MAGIC, 41 };
+    KeysData legacy_keys{ BLOB_MAGIC, { 7, 7, 7 }, 3 };
+    uint8_t* slots = flash.raw().data() + LOG_START;
+    std::memcpy(slots, &legacy_config, sizeof(legacy_config));
+    std::memcpy(slots + 2 * BLOB_SLOT_SIZE_BYTES, &legacy_keys, sizeof(legacy_keys));
+
+    auto storage = boot();
+    EXPECT_EQ(storage->get_init_count(), 42);
+
+    /* The slots predate schemas, they are imported as schema 0 */
+    KeysData keys;
+    ASSERT_EQ(storage->get_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+    EXPECT_EQ(std::memcmp(&keys, &legacy_keys, sizeof(legacy_keys)), 0);
+}
+
+TEST_F(StorageTest, PowerCutDuringLegacyImportKeepsEverySlot) {
+    const StorageConfig_t legacy_config = { BLOB_MAGIC, 41 };
+    KeysData legacy_keys{ BLOB_MAGIC, { 7, 7, 7 }, 3 };
+    TrackerData legacy_tracker{};
+    legacy_tracker.magic                   = BLOB_MAGIC;
+    legacy_tracker.active_session          = 3;
+    legacy_tracker.entries[3].work_time_us = 123'456'789;
+
+    for (uint32_t cut = 0;; ++cut) {
+        flash.restore_power();
+        std::ranges::fill(flash.raw(), 0xFF);
+        uint8_t* slots = flash.raw().data() + LOG_START;
+        std::memcpy(slots, &legacy_config, sizeof(legacy_config));
+        std::memcpy(slots + 2 * BLOB_SLOT_SIZE_BYTES, &legacy_keys, sizeof(legacy_keys));
+        std::memcpy(slots + 3 * BLOB_SLOT_SIZE_BYTES, &legacy_tracker, sizeof(legacy_tracker));
+
+        /* The hot and the cold blobs go to different zones, a cut may land between them */
+        flash.cut_power_after(cut);
+        (void)Storage(flash).init();
+        const bool was_cut = flash.is_power_lost();
+        flash.restore_power();
+        auto storage = boot();
+
+        KeysData keys;
+        TrackerData tracker;
+        ASSERT_EQ(storage->get_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS)
+            << "Power cut after " << cut << " operations";
+        EXPECT_EQ(std::memcmp(&keys, &legacy_keys, sizeof(legacy_keys)), 0)
+            << "Power cut after " << cut << " operations";
+        ASSERT_EQ(storage->migrate(BlobType::TIME_TRACKER_DATA, TRACKER_MIGRATIONS), StorageStatus::SUCCESS)
+            << "Power cut after " << cut << " operations";
+        ASSERT_EQ(storage->get_blob(BlobType::TIME_TRACKER_DATA, tracker), StorageStatus::SUCCESS);
+        EXPECT_EQ(std::memcmp(&tracker, &legacy_tracker, sizeof(legacy_tracker)), 0)
+            << "Power cut after " << cut << " operations";
+
+        /* The slots are gone once everything is in the log */
+        uint32_t magic;
+        std::memcpy(&magic, slots + 3 * BLOB_SLOT_SIZE_BYTES, sizeof(magic));
+        EXPECT_NE(magic, BLOB_MAGIC) << "Power cut after " << cut << " operations";
+
+        if (!was_cut)
+            break;
+    }
+}
+
+TEST_F(StorageTest, TrackingDayErasesDropByOrderOfMagnitude) {
+    /* 8 hours of tracking with a checkpoint every 4 seconds */
+    constexpr uint32_t checkpoints = 8 * 3600 / 4;
+
+    TrackerData data{};
+    data.magic   = BLOB_MAGIC;
+    auto storage = boot();
+    ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+
+    const uint32_t erases_before = flash.get_erase_count();
+    for (uint32_t i = 0; i < checkpoints; ++i) {
+        data.entries[0].work_time_us += 4'000'000;
+        ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+    }
+    const uint32_t erases = flash.get_erase_count() - erases_before;
+
+    /* Read-modify-erase-program needed one sector erase per checkpoint */
+    std::printf("Sector erases for %u checkpoints: %u (previously %u)\n", checkpoints, erases, checkpoints);
+    EXPECT_LE(erases * 10, checkpoints);
+
+    storage = boot();
+    TrackerData restored;
+    ASSERT_EQ(storage->get_blob(BlobType::TIME_TRACKER_DATA, restored), StorageStatus::SUCCESS);
+    EXPECT_EQ(restored.entries[0].work_time_us, data.entries[0].work_time_us);
+}
+
+TEST_F(StorageTest, LayoutSeparatesHotBlobs) {
+    for (uint id = 0; id < static_cast<uint>(BlobType::BLOBS_COUNT); ++id) {
+        const bool is_hot = (BLOB_LAYOUT[id].write_class == WriteClass::HOT);
+        EXPECT_EQ(is_hot, get_blob_zone(id) != 0);
+        for (uint other = 0; other < id; ++other) {
+            EXPECT_TRUE(!is_hot || (get_blob_zone(id) != get_blob_zone(other)));
+        }
+    }
+
+    /* Extent slots and erase counters come first, the log takes the rest */
+    uint next_sector = STORAGE_LOG_FIRST_SECTOR;
+    for (const auto& zone : STORAGE_LAYOUT) {
+        EXPECT_EQ(zone.first_sector, next_sector);
+        next_sector += zone.sectors_count;
+    }
+    EXPECT_EQ(next_sector, STORAGE_SECTORS_COUNT);
+}
+
+TEST_F(StorageTest, HotCheckpointsDoNotEraseColdBlobs) {
+    KeysData keys{ BLOB_MAGIC, { 1, 2, 3 }, 3 };
+    TrackerData data{};
+    data.magic   = BLOB_MAGIC;
+    auto storage = boot();
+    ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+
+    const std::vector<uint32_t> erases_before = [this] {
+        std::vector<uint32_t> erases;
+        for (uint sector_id = 0; sector_id < STORAGE_SECTORS_COUNT; ++sector_id) {
+            erases.push_back(flash.get_sector_erase_count(sector_id));
+        }
+        return erases;
+    }();
+
+    for (uint32_t i = 0; i < 8 * 3600 / 4; ++i) {
+        data.entries[0].work_time_us += 4'000'000;
+        ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+        if ((i % 900) == 0) {
+            /* Occasional colour change from the terminal */
+            keys.colors[0] = static_cast<uint8_t>(i);
+            ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+        }
+    }
+
+    std::array<uint32_t, static_cast<uint>(BlobType::BLOBS_COUNT)> erases_per_blob{};
+    for (uint id = 0; id < erases_per_blob.size(); ++id) {
+        const StorageZone_t& zone = STORAGE_LAYOUT[get_blob_zone(id)];
+        for (uint sector_id = zone.first_sector; sector_id < zone.first_sector + zone.sectors_count; ++sector_id) {
+            erases_per_blob[id] += flash.get_sector_erase_count(sector_id) - erases_before[sector_id];
+        }
+        std::printf("Sector erases of blob %u: %u\n", id, erases_per_blob[id]);
+    }
+
+    EXPECT_GT(erases_per_blob[static_cast<uint>(BlobType::TIME_TRACKER_DATA)], 0);
+    EXPECT_EQ(erases_per_blob[static_cast<uint>(BlobType::KEYS_CONFIG)], 0);
+    EXPECT_EQ(erases_per_blob[static_cast<uint>(BlobType::STORAGE_CONFIG)], 0);
+
+    storage = boot();
+    KeysData restored_keys;
+    ASSERT_EQ(storage->get_blob(BlobType::KEYS_CONFIG, restored_keys), StorageStatus::SUCCESS);
+    EXPECT_EQ(std::memcmp(&keys, &restored_keys, sizeof(keys)), 0);
+}
+
+TEST_F(StorageTest, IdenticalSavesAreElided) {
+    KeysData keys{ BLOB_MAGIC, { 1, 2, 3 }, 3 };
+    auto storage = boot();
+    ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+
+    const uint32_t programs_before = flash.get_program_count();
+    const StorageStats_t before    = storage->get_stats();
+    for (uint32_t i = 0; i < 10; ++i) {
+        ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+    }
+    EXPECT_EQ(flash.get_program_count(), programs_before);
+    EXPECT_EQ(storage->get_stats().writes_elided, before.writes_elided + 10);
+    EXPECT_EQ(storage->get_stats().writes_performed, before.writes_performed);
+
+    keys.colors[0] = 7;
+    ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+    EXPECT_GT(flash.get_program_count(), programs_before);
+    EXPECT_EQ(storage->get_stats().writes_performed, before.writes_performed + 1);
+}
+
+TEST_F(StorageTest, WriteBackCoalescesSavesUntilQuietPeriod) {
+    KeysData keys{ BLOB_MAGIC, { 1, 2, 3 }, 3 };
+    auto storage = boot();
+    set_mock_time_us_64(0);
+    storage->enable_write_back({ 1000, 5000 });
+
+    const uint32_t programs_before = flash.get_program_count();
+    for (uint8_t i = 0; i < 10; ++i) {
+        keys.colors[0] = i;
+        ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+    }
+    EXPECT_EQ(flash.get_program_count(), programs_before);
+
+    KeysData pending;
+    ASSERT_EQ(storage->get_blob(BlobType::KEYS_CONFIG, pending), StorageStatus::SUCCESS);
+    EXPECT_EQ(pending.colors[0], 9);
+
+    set_mock_time_us_64(999'000);
+    storage->task();
+    EXPECT_EQ(flash.get_program_count(), programs_before);
+
+    set_mock_time_us_64(1'000'000);
+    storage->task();
+    EXPECT_EQ(flash.get_program_count(), programs_before + 1);
+    EXPECT_EQ(storage->get_stats().writes_coalesced, 9);
+
+    storage = boot();
+    KeysData restored;
+    ASSERT_EQ(storage->get_blob(BlobType::KEYS_CONFIG, restored), StorageStatus::SUCCESS);
+    EXPECT_EQ(restored.colors[0], 9);
+}
+
+TEST_F(StorageTest, WriteBackStalenessIsBounded) {
+    TrackerData data{};
+    data.magic   = BLOB_MAGIC;
+    auto storage = boot();
+    set_mock_time_us_64(0);
+    storage->enable_write_back({ 1000, 5000 });
+
+    /* Saves every 500 ms never leave a quiet period */
+    uint64_t committed_at_ms = 0;
+    for (uint64_t now_ms = 0; now_ms <= 5000; now_ms += 500) {
+        set_mock_time_us_64(now_ms * 1000);
+        data.entries[0].work_time_us = now_ms;
+        const uint32_t programs      = flash.get_program_count();
+        ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+        storage->task();
+        if ((committed_at_ms == 0) && (flash.get_program_count() != programs))
+            committed_at_ms = now_ms;
+    }
+    EXPECT_EQ(committed_at_ms, 5000);
+}
+
+TEST_F(StorageTest, CommitOfSeveralBlobsIsAtomic) {
+    KeysData keys{ BLOB_MAGIC, { 1, 2, 3 }, 3 };
+    KeysData features{ BLOB_MAGIC, { 4, 5, 6 }, 3 };
+    {
+        auto storage = boot();
+        ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+        ASSERT_EQ(storage->save_blob(BlobType::FEATURES_HANDLER_CONFIG, features), StorageStatus::SUCCESS);
+    }
+
+    {
+        auto storage = boot();
+        storage->enable_write_back();
+        keys.colors[0]     = 7;
+        features.colors[0] = 8;
+        ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+        ASSERT_EQ(storage->save_blob(BlobType::FEATURES_HANDLER_CONFIG, features), StorageStatus::SUCCESS);
+        ASSERT_EQ(storage->flush(), StorageStatus::SUCCESS);
+    }
+
+    /* Power is lost before the last record of the commit got programmed */
+    const std::span<uint8_t> image = flash.raw();
+    uint32_t chained_offset     = LOG_OFFSET_NONE;
+    for (uint32_t offset = 0; offset < image.size(); offset += LOG_RECORD_ALIGN) {
+        LogRecordHeader_t record;
+        std::memcpy(&record, image.data() + offset, sizeof(record));
+        if ((record.magic == LOG_RECORD_MAGIC) && (record.flags & LOG_RECORD_FLAG_CHAINED)) {
+            chained_offset = offset;
+        }
+    }
+    ASSERT_NE(chained_offset, LOG_OFFSET_NONE);
+
+    LogRecordHeader_t chained;
+    std::memcpy(&chained, image.data() + chained_offset, sizeof(chained));
+    const uint32_t last_offset = chained_offset + get_log_record_size(chained.length);
+    LogRecordHeader_t last;
+    std::memcpy(&last, image.data() + last_offset, sizeof(last));
+    ASSERT_EQ(last.flags & LOG_RECORD_FLAG_CHAINED, 0);
+    std::fill_n(image.begin() + last_offset, get_log_record_size(last.length), 0xFF);
+
+    auto storage = boot();
+    KeysData restored_keys;
+    KeysData restored_features;
+    ASSERT_EQ(storage->get_blob(BlobType::KEYS_CONFIG, restored_keys), StorageStatus::SUCCESS);
+    ASSERT_EQ(storage->get_blob(BlobType::FEATURES_HANDLER_CONFIG, restored_features), StorageStatus::SUCCESS);
+    EXPECT_EQ(restored_keys.colors[0], 1);
+    EXPECT_EQ(restored_features.colors[0], 4);
+
+    /* The sealed head keeps accepting new records */
+    keys.colors[0] = 9;
+    ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+    storage = boot();
+    ASSERT_EQ(storage->get_blob(BlobType::KEYS_CONFIG, restored_keys), StorageStatus::SUCCESS);
+    EXPECT_EQ(restored_keys.colors[0], 9);
+}
+
+TEST(Crc32Test, MatchesZlibCheckValue) {
+    const uint8_t check[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+    EXPECT_EQ(crc32_update(0, check), 0xCBF43926);
+    EXPECT_EQ(crc32_update(crc32_update(0, std::span(check, 4)), std::span(check + 4, 5)), 0xCBF43926);
+}
+
+TEST_F(StorageTest, CorruptedRecordFallsBackToPreviousVersion) {
+    KeysData keys{ BLOB_MAGIC, { 1, 2, 3 }, 3 };
+    {
+        auto storage = boot();
+        ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+        keys.colors[0] = 7;
+        ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+    }
+
+    /* Flip a bit in the payload of the newest keys record */
+    const std::span<uint8_t> image = flash.raw();
+    uint32_t newest_offset      = LOG_OFFSET_NONE;
+    for (uint32_t offset = 0; offset < image.size(); offset += LOG_RECORD_ALIGN) {
+        LogRecordHeader_t record;
+        std::memcpy(&record, image.data() + offset, sizeof(record));
+        if ((record.magic == LOG_RECORD_MAGIC) && (record.blob_id == static_cast<uint8_t>(BlobType::KEYS_CONFIG)))
+            newest_offset = offset;
+    }
+    ASSERT_NE(newest_offset, LOG_OFFSET_NONE);
+    image[newest_offset + sizeof(LogRecordHeader_t)] &= 0xFE;
+
+    auto storage = boot();
+    KeysData restored;
+    ASSERT_EQ(storage->get_blob(BlobType::KEYS_CONFIG, restored), StorageStatus::SUCCESS);
+    EXPECT_EQ(restored.colors[0], 1);
+    EXPECT_EQ(storage->get_boot_report().corrupted_records, 1);
+    EXPECT_EQ(storage->get_boot_report().recovered_blobs, 1);
+
+    /* The rewritten copy supersedes the corrupted one */
+    keys.colors[1] = 9;
+    ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+    storage = boot();
+    ASSERT_EQ(storage->get_blob(BlobType::KEYS_CONFIG, restored), StorageStatus::SUCCESS);
+    EXPECT_EQ(std::memcmp(&keys, &restored, sizeof(keys)), 0);
+    EXPECT_EQ(storage->get_boot_report().recovered_blobs, 0);
+}
+
+TEST_F(StorageTest, PowerCutsNeverCorruptBlobs) {
+    constexpr uint32_t steps = 40;
+
+    for (uint32_t cut = 0;; ++cut) {
+        flash.restore_power();
+        std::ranges::fill(flash.raw(), 0xFF);
+
+        TrackerData data{};
+        data.magic = BLOB_MAGIC;
+        KeysData keys{ BLOB_MAGIC, {}, 3 };
+        KeysData features{ BLOB_MAGIC, {}, 3 };
+        auto storage = boot();
+        storage->enable_write_back();
+
+        /* Whole tracker rewrites wrap the hot zone, cold blobs are committed in pairs */
+        flash.cut_power_after(cut);
+        for (uint8_t step = 1; (step <= steps) && !flash.is_power_lost(); ++step) {
+            std::memset(&data.entries, step, sizeof(data.entries));
+            ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+            if ((step % 5) == 0) {
+                keys.colors[0]     = step;
+                features.colors[0] = step;
+                ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+                ASSERT_EQ(storage->save_blob(BlobType::FEATURES_HANDLER_CONFIG, features), StorageStatus::SUCCESS);
+            }
+            ASSERT_EQ(storage->flush(), StorageStatus::SUCCESS);
+        }
+
+        const bool was_cut = flash.is_power_lost();
+        flash.restore_power();
+        storage = boot();
+
+        /* Blobs never committed before the cut read back as all 0xFF */
+        TrackerData restored_data;
+        (void)storage->get_blob(BlobType::TIME_TRACKER_DATA, restored_data);
+        const uint8_t* entries = reinterpret_cast<const uint8_t*>(&restored_data.entries);
+        EXPECT_TRUE(std::all_of(entries, entries + sizeof(restored_data.entries),
+            [entries](uint8_t byte) { return byte == entries[0]; }))
+            << "Power cut after " << cut << " operations";
+
+        KeysData restored_keys;
+        KeysData restored_features;
+        (void)storage->get_blob(BlobType::KEYS_CONFIG, restored_keys);
+        (void)storage->get_blob(BlobType::FEATURES_HANDLER_CONFIG, restored_features);
+        EXPECT_EQ(restored_keys.colors[0], restored_features.colors[0]) << "Power cut after " << cut << " operations";
+
+        if (!was_cut)
+            break;
+    }
+}
+
+TEST(EmulatedFlashTest, ImageFilePersistsBetweenInstances) {
+    const std::string path = ::testing::TempDir() + "storage_flash_image.bin";
+    std::remove(path.c_str());
+    KeysData keys{ BLOB_MAGIC, { 1, 2, 3 }, 3 };
+    {
+        EmulatedFlash flash(STORAGE_SIZE, path);
+        Storage storage(flash);
+        ASSERT_EQ(storage.init(), StorageStatus::SUCCESS);
+        ASSERT_EQ(storage.save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+    }
+
+    EmulatedFlash flash(STORAGE_SIZE, path);
+    Storage storage(flash);
+    ASSERT_EQ(storage.init(), StorageStatus::SUCCESS);
+    KeysData restored;
+    ASSERT_EQ(storage.get_blob(BlobType::KEYS_CONFIG, restored), StorageStatus::SUCCESS);
+    EXPECT_EQ(std::memcmp(&keys, &restored, sizeof(keys)), 0);
+    EXPECT_EQ(storage.get_init_count(), 2);
+    std::remove(path.c_str());
+}
+
+TEST_F(StorageTest, TrackingDayBenchmark) {
+    /* 8 hours of tracking, time tracker checkpoints every 4 seconds and a color change every minute */
+    constexpr uint32_t checkpoints = 8 * 3600 / 4;
+
+    TrackerData data{};
+    data.magic = BLOB_MAGIC;
+    KeysData keys{ BLOB_MAGIC, {}, 3 };
+    auto storage = boot();
+    storage->enable_write_back();
+
+    uint64_t saved_bytes = 0;
+    for (uint32_t i = 0; i < checkpoints; ++i) {
+        set_mock_time_us_64(static_cast<uint64_t>(i) * 4'000'000);
+        data.entries[0].work_time_us += 4'000'000;
+        ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+        saved_bytes += sizeof(data);
+        if ((i % 15) == 0) {
+            keys.colors[i % 3] = static_cast<uint8_t>(i);
+            ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+            saved_bytes += sizeof(keys);
+        }
+        storage->task();
+    }
+    ASSERT_EQ(storage->flush(), StorageStatus::SUCCESS);
+
+    const uint64_t programmed_bytes = static_cast<uint64_t>(flash.get_program_count()) * FLASH_PAGE_SIZE;
+    std::printf("Saved %llu bytes, programmed %llu bytes, %u erases (max %u per sector), flash busy for %llu ms\n",
+        static_cast<unsigned long long>(saved_bytes), static_cast<unsigned long long>(programmed_bytes),
+        flash.get_erase_count(), flash.get_max_sector_erase_count(),
+        static_cast<unsigned long long>(flash.get_busy_time_us() / 1000));
+    EXPECT_LT(programmed_bytes * 10, saved_bytes);
+}
+
+TEST(FlashTimingsTest, DurationsFallIntoPowerOfTwoBuckets) {
+    EXPECT_EQ(FlashTimings::get_bucket(0), 0u);
+    EXPECT_EQ(FlashTimings::get_bucket(127), 0u);
+    EXPECT_EQ(FlashTimings::get_bucket(128), 1u);
+    EXPECT_EQ(FlashTimings::get_bucket(400), 2u);
+    EXPECT_EQ(FlashTimings::get_bucket(45000), 9u);
+    EXPECT_EQ(FlashTimings::get_bucket(UINT32_MAX), FLASH_TIMING_BUCKETS_COUNT - 1u);
+
+    FlashTimings timings;
+    timings.record(FlashTimingType::ERASE, 45000);
+    timings.record(FlashTimingType::ERASE, 50000);
+    const FlashTimingHistogram_t& erase = timings.get(FlashTimingType::ERASE);
+    EXPECT_EQ(erase.count, 2u);
+    EXPECT_EQ(erase.max_us, 50000u);
+    EXPECT_EQ(erase.total_us, 95000u);
+    EXPECT_EQ(erase.buckets[9], 2u);
+    EXPECT_EQ(timings.get(FlashTimingType::PROGRAM).count, 0u);
+}
+
+TEST(FlashTimingsTest, PercentileIsUpperLimitOfItsBucket) {
+    FlashTimingHistogram_t histogram{};
+    EXPECT_EQ(FlashTimings::get_percentile_us(histogram, 99), 0u);
+    for (uint i = 0; i < 99; ++i)
+        FlashTimings::add_sample(histogram, 400);
+    FlashTimings::add_sample(histogram, 45000);
+    EXPECT_EQ(FlashTimings::get_percentile_us(histogram, 50), 512u);
+    EXPECT_EQ(FlashTimings::get_percentile_us(histogram, 99), 512u);
+    EXPECT_EQ(FlashTimings::get_percentile_us(histogram, 100), 45000u);
+}
+
+TEST_F(StorageTest, FlashTimingsCoverEveryOperation) {
+    auto storage = boot();
+    KeysData keys{ BLOB_MAGIC, { 1, 2, 3 }, 3 };
+    for (uint8_t i = 0; i < 100; ++i) {
+        keys.colors[0] = i;
+        ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+    }
+    storage->erase();
+    while (storage->get_dirty_sectors() > 0) {
+        storage->task();
+    }
+
+    const FlashTimings& timings = storage->get_flash_timings();
+    const FlashTimingHistogram_t& erase   = timings.get(FlashTimingType::ERASE);
+    const FlashTimingHistogram_t& program = timings.get(FlashTimingType::PROGRAM);
+    const FlashTimingHistogram_t& lockout = timings.get(FlashTimingType::CORE_LOCKOUT);
+    EXPECT_EQ(erase.count, flash.get_erase_count());
+    EXPECT_GT(erase.count, 0u);
+    EXPECT_GT(program.count, 0u);
+    EXPECT_EQ(lockout.count, erase.count + program.count);
+    EXPECT_EQ(erase.total_us + program.total_us, flash.get_busy_time_us());
+    /* Even erasing the whole storage keeps interrupts off for a single sector at a time */
+    EXPECT_EQ(erase.max_us, W25Q16JV_TIMING.sector_erase_us);
+}
+
+TEST_F(StorageTest, LogWrittenBeforeSchemasIsMigratedOnce) {
+    /* Golden image of the log without schemas: a FULL record and a DELTA changing color 0 */
+    const StorageConfig_t config = { BLOB_MAGIC, 5 };
+    const KeysData old_keys{ BLOB_MAGIC, { 1, 2, 3 }, 3 };
+    const uint8_t new_color = 9;
+    const LogSectorHeader_t sector = { LOG_SECTOR_MAGIC, 1, UINT32_MAX, UINT32_MAX };
+    const std::span<uint8_t> image = flash.raw();
+    std::memcpy(image.data() + LOG_START, &sector, sizeof(sector));
+    uint32_t offset = LOG_START + sizeof(sector);
+    offset = write_golden_record(image, offset, BlobType::STORAGE_CONFIG, LogRecordKind::FULL, 1, 0, as_bytes(config));
+    offset = write_golden_record(
+        image, offset, BlobType::TEST_SCHEMA_DATA, LogRecordKind::FULL, 1, 0, as_bytes(old_keys));
+    (void)write_golden_record(image, offset, BlobType::TEST_SCHEMA_DATA, LogRecordKind::DELTA, 2,
+        offsetof(KeysData, colors), as_bytes(new_color));
+
+    auto storage = boot();
+    EXPECT_EQ(storage->get_init_count(), 6);
+    SchemaDataV1 keys;
+    EXPECT_EQ(storage->get_blob(BlobType::TEST_SCHEMA_DATA, keys), StorageStatus::NOT_FOUND);
+    EXPECT_EQ(storage->migrate(BlobType::TEST_SCHEMA_DATA, {}), StorageStatus::INVALID_INPUT);
+
+    ASSERT_EQ(storage->migrate(BlobType::TEST_SCHEMA_DATA, SCHEMA_MIGRATIONS), StorageStatus::SUCCESS);
+    ASSERT_EQ(storage->get_blob(BlobType::TEST_SCHEMA_DATA, keys), StorageStatus::SUCCESS);
+    EXPECT_EQ(keys.magic, BLOB_MAGIC);
+    EXPECT_EQ(keys.colors[0], new_color);
+    EXPECT_EQ(keys.colors[2], 3);
+    EXPECT_EQ(keys.keys_count, 3);
+    EXPECT_EQ(keys.long_press_ms, 800);
+
+    /* The upgraded record is what the next boot finds, nothing is migrated again */
+    storage                       = boot();
+    const uint32_t programs       = flash.get_program_count();
+    ASSERT_EQ(storage->migrate(BlobType::TEST_SCHEMA_DATA, SCHEMA_MIGRATIONS), StorageStatus::SUCCESS);
+    EXPECT_EQ(flash.get_program_count(), programs);
+    SchemaDataV1 restored;
+    ASSERT_EQ(storage->get_blob(BlobType::TEST_SCHEMA_DATA, restored), StorageStatus::SUCCESS);
+    EXPECT_EQ(std::memcmp(&keys, &restored, sizeof(keys)), 0);
+}
+
+struct ExtentData {
+    uint32_t magic;
+    uint8_t bytes[9000];
+};
+
+TEST_F(StorageTest, ExtentBlobSpansSeveralSectors) {
+    static_assert(sizeof(ExtentData) > FLASH_SECTOR_SIZE);
+    ExtentData data{ BLOB_MAGIC, {} };
+    for (uint32_t i = 0; i < sizeof(data.bytes); ++i)
+        data.bytes[i] = static_cast<uint8_t>(i * 7);
+
+    auto storage = boot();
+    ASSERT_EQ(storage->save_blob(BlobType::TEST_EXTENT_DATA, data), StorageStatus::SUCCESS);
+    const uint32_t erases = flash.get_erase_count();
+    ASSERT_EQ(storage->save_blob(BlobType::TEST_EXTENT_DATA, data), StorageStatus::SUCCESS);
+    EXPECT_EQ(flash.get_erase_count(), erases);
+    EXPECT_EQ(storage->get_stats().writes_elided, 1);
+
+    /* Slots are used in turns, the retired one is erased in the background */
+    data.bytes[8999] = 1;
+    ASSERT_EQ(storage->save_blob(BlobType::TEST_EXTENT_DATA, data), StorageStatus::SUCCESS);
+    const uint first_sector = get_extent_first_sector(static_cast<uint>(BlobType::TEST_EXTENT_DATA));
+    const uint slot_sectors = get_extent_slot_sectors(static_cast<uint>(BlobType::TEST_EXTENT_DATA));
+    EXPECT_EQ(flash.get_erase_count(), erases);
+    EXPECT_EQ(storage->get_dirty_sectors(), slot_sectors);
+    while (storage->get_dirty_sectors() != 0)
+        storage->task();
+    for (uint sector = first_sector; sector < first_sector + STORAGE_EXTENT_SLOTS_COUNT * slot_sectors; ++sector)
+        EXPECT_EQ(flash.get_sector_erase_count(sector), (sector < first_sector + slot_sectors) ? 1u : 0u)
+            << "Sector " << sector;
+
+    storage = boot();
+    ExtentData restored;
+    ASSERT_EQ(storage->get_blob(BlobType::TEST_EXTENT_DATA, restored), StorageStatus::SUCCESS);
+    EXPECT_EQ(std::memcmp(&data, &restored, sizeof(data)), 0);
+}
+
+TEST_F(StorageTest, ExtentWriteCutShortKeepsPreviousContent) {
+    ExtentData data{ BLOB_MAGIC, {} };
+    std::memset(data.bytes, 1, sizeof(data.bytes));
+    for (uint32_t cut = 0;; ++cut) {
+        flash.restore_power();
+        std::ranges::fill(flash.raw(), 0xFF);
+        auto storage = boot();
+        data.bytes[0] = 1;
+        ASSERT_EQ(storage->save_blob(BlobType::TEST_EXTENT_DATA, data), StorageStatus::SUCCESS);
+
+        flash.cut_power_after(cut);
+        std::memset(data.bytes, 2, sizeof(data.bytes));
+        ASSERT_EQ(storage->save_blob(BlobType::TEST_EXTENT_DATA, data), StorageStatus::SUCCESS);
+        const bool was_cut = flash.is_power_lost();
+        flash.restore_power();
+
+        storage = boot();
+        ExtentData restored;
+        ASSERT_EQ(storage->get_blob(BlobType::TEST_EXTENT_DATA, restored), StorageStatus::SUCCESS);
+        EXPECT_TRUE(std::all_of(std::begin(restored.bytes), std::end(restored.bytes),
+            [&restored](uint8_t byte) { return byte == restored.bytes[0]; }))
+            << "Power cut after " << cut << " operations";
+
+        std::memset(data.bytes, 1, sizeof(data.bytes));
+        if (!was_cut)
+            break;
+    }
+}
+
+TEST_F(StorageTest, CorruptedExtentIsDropped) {
+    ExtentData data{ BLOB_MAGIC, {} };
+    {
+        auto storage = boot();
+        ASSERT_EQ(storage->save_blob(BlobType::TEST_EXTENT_DATA, data), StorageStatus::SUCCESS);
+    }
+    const uint first_sector = get_extent_first_sector(static_cast<uint>(BlobType::TEST_EXTENT_DATA));
+    flash.raw()[first_sector * FLASH_SECTOR_SIZE + 100] ^= 0x01;
+
+    auto storage = boot();
+    ExtentData restored;
+    EXPECT_EQ(storage->get_blob(BlobType::TEST_EXTENT_DATA, restored), StorageStatus::NOT_FOUND);
+    EXPECT_EQ(storage->get_boot_report().corrupted_records, 1);
+    ASSERT_EQ(storage->save_blob(BlobType::TEST_EXTENT_DATA, data), StorageStatus::SUCCESS);
+    ASSERT_EQ(storage->get_blob(BlobType::TEST_EXTENT_DATA, restored), StorageStatus::SUCCESS);
+}
+
+TEST_F(StorageTest, BootIndexBuildBenchmark) {
+    /* A log left full of tracker checkpoints and color changes, the worst case of the boot scan */
+    TrackerData data{};
+    data.magic = BLOB_MAGIC;
+    KeysData keys{ BLOB_MAGIC, {}, 3 };
+    ExtentData extent{ BLOB_MAGIC, {} };
+    {
+        auto storage = boot();
+        ASSERT_EQ(storage->save_blob(BlobType::TEST_EXTENT_DATA, extent), StorageStatus::SUCCESS);
+        for (uint32_t i = 0; i < 2000; ++i) {
+            data.entries[i % 4].work_time_us += 4'000'000;
+            ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+            keys.colors[i % 3] = static_cast<uint8_t>(i);
+            ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+        }
+    }
+
+    constexpr uint32_t boots = 20;
+    const auto start         = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < boots; ++i)
+        (void)boot();
+    const auto elapsed_us =
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    std::printf("Boot index build: %lld us per boot over %u KB of storage\n",
+        static_cast<long long>(elapsed_us / boots), STORAGE_SIZE / 1024);
+
+    auto storage = boot();
+    TrackerData restored;
+    ASSERT_EQ(storage->get_blob(BlobType::TIME_TRACKER_DATA, restored), StorageStatus::SUCCESS);
+    EXPECT_EQ(std::memcmp(&data, &restored, sizeof(data)), 0);
+    EXPECT_EQ(storage->get_blob(BlobType::TEST_EXTENT_DATA, extent), StorageStatus::SUCCESS);
+}
+
+TEST_F(StorageTest, SavesOnlyProgramWhileSparesAreErasedInBackground) {
+    TrackerData data{};
+    data.magic   = BLOB_MAGIC;
+    auto storage = boot();
+
+    /* The hot zone wraps several times, task() runs between the saves as the main loop would */
+    for (uint32_t i = 0; i < 2000; ++i) {
+        data.entries[i % 4].work_time_us += 4'000'000;
+        ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+        storage->task();
+    }
+    EXPECT_EQ(storage->get_stats().inline_erases, 0);
+    EXPECT_EQ(storage->get_dirty_sectors(), 0u);
+    EXPECT_GT(storage->get_spare_sectors(), 0u);
+    const FlashTimingHistogram_t& latency = storage->get_save_latency();
+    EXPECT_LT(latency.max_us, W25Q16JV_TIMING.sector_erase_us);
+    std::printf("Save latency p99 %u us, max %u us\n", FlashTimings::get_percentile_us(latency, 99), latency.max_us);
+
+    /* Without any idle time the saves end up erasing for themselves */
+    for (uint32_t i = 0; i < 2000; ++i) {
+        data.entries[i % 4].work_time_us += 4'000'000;
+        ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+    }
+    EXPECT_GT(storage->get_stats().inline_erases, 0);
+    EXPECT_GE(latency.max_us, W25Q16JV_TIMING.sector_erase_us);
+
+    storage = boot();
+    TrackerData restored;
+    ASSERT_EQ(storage->get_blob(BlobType::TIME_TRACKER_DATA, restored), StorageStatus::SUCCESS);
+    EXPECT_EQ(std::memcmp(&data, &restored, sizeof(data)), 0);
+}
+
+TEST_F(StorageTest, EraseCountsPersistWithoutErasing) {
+    TrackerData data{};
+    data.magic = BLOB_MAGIC;
+    {
+        auto storage = boot();
+        for (uint32_t i = 0; i < 2000; ++i) {
+            data.entries[i % 4].work_time_us += 4'000'000;
+            ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+            storage->task();
+        }
+    }
+
+    /* Every erase done through the storage is counted, none of the wear sectors had to be erased */
+    auto storage                           = boot();
+    const std::span<const uint32_t> counts = storage->get_erase_counts();
+    for (uint sector_id = 0; sector_id < STORAGE_SECTORS_COUNT; ++sector_id)
+        EXPECT_EQ(counts[sector_id], flash.get_sector_erase_count(sector_id)) << "Sector " << sector_id;
+    for (uint sector_id = STORAGE_WEAR_FIRST_SECTOR; sector_id < STORAGE_LOG_FIRST_SECTOR; ++sector_id)
+        EXPECT_EQ(flash.get_sector_erase_count(sector_id), 0u);
+
+    const StorageWearReport_t fresh = storage->get_wear_report();
+    EXPECT_EQ(fresh.total_erases, flash.get_erase_count());
+    EXPECT_EQ(fresh.max_erase_count, flash.get_max_sector_erase_count());
+    EXPECT_EQ(fresh.boot_erases, 0u);
+    EXPECT_EQ(fresh.hours_left, UINT32_MAX);
+
+    /* Erasing every used sector once in 10 minutes projects 100k cycles far ahead */
+    const std::vector<uint32_t> before(counts.begin(), counts.end());
+    set_mock_time_us_64(time_us_64() + 600'000'000);
+    storage->erase();
+    while (storage->get_dirty_sectors() > 0) {
+        storage->task();
+    }
+
+    uint32_t erased    = 0;
+    uint32_t most_worn = 0;
+    for (uint sector_id = 0; sector_id < STORAGE_SECTORS_COUNT; ++sector_id) {
+        if (counts[sector_id] == before[sector_id])
+            continue;
+        EXPECT_EQ(counts[sector_id], before[sector_id] + 1) << "Sector " << sector_id;
+        erased++;
+        most_worn = std::max(most_worn, counts[sector_id]);
+    }
+    const StorageWearReport_t report = storage->get_wear_report();
+    EXPECT_GT(erased, 0u);
+    EXPECT_EQ(report.boot_erases, erased);
+    const uint64_t expected_hours = (FLASH_ENDURANCE_CYCLES - most_worn) / 6;
+    EXPECT_NEAR(report.hours_left, expected_hours, expected_hours / 100);
+}
+
+TEST_F(StorageTest, FullWearJournalIsFolded) {
+    (void)boot();
+
+    /* A journal filled up with erases of the first log sector */
+    const uint32_t capacity = FLASH_SECTOR_SIZE - WEAR_JOURNAL_START;
+    uint8_t* journal        = flash.raw().data() + (STORAGE_WEAR_FIRST_SECTOR * FLASH_SECTOR_SIZE);
+    std::fill_n(journal + WEAR_JOURNAL_START, capacity, static_cast<uint8_t>(STORAGE_LOG_FIRST_SECTOR));
+    auto storage = boot();
+    EXPECT_EQ(storage->get_erase_counts()[STORAGE_LOG_FIRST_SECTOR], capacity);
+
+    TrackerData data{};
+    data.magic = BLOB_MAGIC;
+    for (uint32_t i = 0; i < 2000; ++i) {
+        data.entries[i % 4].work_time_us += 4'000'000;
+        ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+        storage->task();
+    }
+
+    storage = boot();
+    const std::span<const uint32_t> counts = storage->get_erase_counts();
+    for (uint sector_id = 0; sector_id < STORAGE_SECTORS_COUNT; ++sector_id) {
+        const uint32_t journaled = (sector_id == STORAGE_LOG_FIRST_SECTOR) ? capacity : 0;
+        EXPECT_EQ(counts[sector_id], flash.get_sector_erase_count(sector_id) + journaled) << "Sector " << sector_id;
+    }
+    /* The full journal was folded into the second wear sector and erased in the background */
+    EXPECT_EQ(flash.get_sector_erase_count(STORAGE_WEAR_FIRST_SECTOR), 1u);
+}
+
+TEST_F(StorageTest, BootsProgramOneBitAndEraseNothing) {
+    (void)boot();
+    const uint32_t erases   = flash.get_erase_count();
+    const uint32_t programs = flash.get_program_count();
+
+    /* Past a full boot page, which gets folded into the other wear sector */
+    constexpr uint32_t boots = WEAR_BOOTS_PER_SECTOR + 10;
+    for (uint32_t i = 2; i <= boots; ++i) {
+        auto storage = boot();
+        ASSERT_EQ(storage->get_init_count(), i);
+        EXPECT_EQ(storage->get_boot_report().erases, 0u);
+    }
+    EXPECT_EQ(flash.get_erase_count(), erases);
+    /* A page per boot, the fold rewrites the header instead */
+    EXPECT_LE(flash.get_program_count() - programs, boots + 1);
+
+    /* Counting starts over with the storage */
+    auto storage = boot();
+    storage->erase();
+    storage = boot();
+    EXPECT_EQ(storage->get_init_count(), 1);
+}
+
+TEST(ClearOnlyCountersTest, UpdatesOnlyClearBits) {
+    ThermometerCounter<2> counter;
+    counter.reset();
+    EXPECT_EQ(counter.get(), 0);
+
+    const auto erased = counter.bits;
+    ASSERT_TRUE(counter.increment(3));
+    EXPECT_EQ(counter.get(), 3);
+    EXPECT_EQ(erased[0] & counter.bits[0], counter.bits[0]);
+
+    /* A torn program may have cleared any of the bits, the count is still how many there are */
+    counter.bits = { 0xFE, 0x7F };
+    ASSERT_TRUE(counter.increment());
+    EXPECT_EQ(counter.get(), 3);
+    EXPECT_FALSE(counter.increment(14));
+    EXPECT_TRUE(counter.is_full());
+
+    FlagBitmap<10> flags;
+    flags.reset();
+    flags.set(9);
+    EXPECT_TRUE(flags.is_set(9));
+    EXPECT_FALSE(flags.is_set(0));
+    EXPECT_EQ(flags.bits[0], 0xFF);
+
+    flags.clear(9);
+    EXPECT_FALSE(flags.is_set(9));
+    EXPECT_EQ(flags.bits[1], 0xFF);
+}
+
+TEST_F(StorageTest, TrackingDayCountersAreProgrammedInPlace) {
+    /* The same 8 hours as TrackingDayErasesDropByOrderOfMagnitude */
+    constexpr uint32_t checkpoints   = 8 * 3600 / 4;
+    constexpr uint64_t checkpoint_us = 4'000'000;
+    constexpr size_t tail_offset     = offsetof(CountedTrackerData, checkpoints);
+
+    EmulatedFlash binary_flash(STORAGE_SIZE);
+    Storage binary_storage(binary_flash);
+    ASSERT_EQ(binary_storage.init(), StorageStatus::SUCCESS);
+    TrackerData binary{};
+    binary.magic = BLOB_MAGIC;
+    ASSERT_EQ(binary_storage.save_blob(BlobType::TIME_TRACKER_DATA, binary), StorageStatus::SUCCESS);
+
+    auto storage = boot();
+    CountedTrackerData data{};
+    data.tracker.magic = BLOB_MAGIC;
+    data.checkpoints.reset();
+    ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data, tail_offset), StorageStatus::SUCCESS);
+
+    const uint32_t binary_erases_before = binary_flash.get_erase_count();
+    const uint32_t erases_before        = flash.get_erase_count();
+    uint32_t folds                      = 0;
+    for (uint32_t i = 0; i < checkpoints; ++i) {
+        binary.entries[0].work_time_us += checkpoint_us;
+        ASSERT_EQ(binary_storage.save_blob(BlobType::TIME_TRACKER_DATA, binary), StorageStatus::SUCCESS);
+        binary_storage.task();
+
+        /* A full counter is folded into the entry, the only saves appending a record */
+        if (!data.checkpoints.increment()) {
+            data.tracker.entries[0].work_time_us += data.checkpoints.capacity * checkpoint_us;
+            data.checkpoints.reset();
+            ASSERT_TRUE(data.checkpoints.increment());
+            folds++;
+        }
+        ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data, tail_offset), StorageStatus::SUCCESS);
+        storage->task();
+    }
+    const uint32_t binary_erases = binary_flash.get_erase_count() - binary_erases_before;
+    const uint32_t erases        = flash.get_erase_count() - erases_before;
+
+    std::printf("Sector erases for %u checkpoints: %u with a clear-only counter, %u with a binary one\n", checkpoints,
+        erases, binary_erases);
+    EXPECT_EQ(storage->get_stats().writes_in_place, checkpoints - folds);
+    EXPECT_LE(erases * 10, binary_erases);
+
+    storage = boot();
+    CountedTrackerData restored;
+    ASSERT_EQ(storage->get_blob(BlobType::TIME_TRACKER_DATA, restored), StorageStatus::SUCCESS);
+    EXPECT_EQ(restored.tracker.entries[0].work_time_us + restored.checkpoints.get() * checkpoint_us,
+        binary.entries[0].work_time_us);
+}
+
+TEST_F(StorageTest, PowerCutsNeverMoveClearOnlyCountersBack) {
+    struct CountedData {
+        uint32_t folded;
+        uint32_t renames;
+        uint8_t name[600]; /* Puts the counter a few pages after the record header */
+        ThermometerCounter<1> count;
+    };
+    constexpr uint32_t steps = 40;
+    auto get_total           = [](const CountedData& data) { return data.folded + data.count.get(); };
+
+    for (uint32_t cut = 0;; ++cut) {
+        flash.restore_power();
+        std::ranges::fill(flash.raw(), 0xFF);
+
+        CountedData data{};
+        data.count.reset();
+        auto storage = boot();
+        ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data, offsetof(CountedData, count)),
+            StorageStatus::SUCCESS);
+
+        /* Folds and renames are new FULL records, the rest of the saves are programmed in place */
+        uint32_t saved     = 0;
+        uint32_t attempted = 0;
+        flash.cut_power_after(cut);
+        for (uint32_t step = 0; (step < steps) && !flash.is_power_lost(); ++step) {
+            if (!data.count.increment()) {
+                data.folded += data.count.capacity;
+                data.count.reset();
+                ASSERT_TRUE(data.count.increment());
+            }
+            if ((step % 5) == 0) {
+                data.renames++;
+                std::memset(data.name, static_cast<int>(data.renames), sizeof(data.name));
+            }
+            attempted = get_total(data);
+            ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data, offsetof(CountedData, count)),
+                StorageStatus::SUCCESS);
+            saved = flash.is_power_lost() ? saved : attempted;
+        }
+
+        const bool was_cut = flash.is_power_lost();
+        flash.restore_power();
+        storage = boot();
+
+        CountedData restored;
+        ASSERT_EQ(storage->get_blob(BlobType::TIME_TRACKER_DATA, restored), StorageStatus::SUCCESS);
+        EXPECT_GE(get_total(restored), saved) << "Power cut after " << cut << " operations";
+        EXPECT_LE(get_total(restored), attempted) << "Power cut after " << cut << " operations";
+
+        if (!was_cut)
+            break;
+    }
+}
+
+TEST_F(StorageTest, PatchProgramsOnlyTheMember) {
+    TrackerData data{};
+    data.magic   = BLOB_MAGIC;
+    auto storage = boot();
+    KeysData keys{ BLOB_MAGIC, {}, 3 };
+    EXPECT_EQ(storage->patch(BlobType::KEYS_CONFIG, keys, keys.colors), StorageStatus::NOT_FOUND);
+    ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+
+    /* Changing one entry costs a page program or two, no erase */
+    const uint32_t programs = flash.get_program_count();
+    const uint32_t erases   = flash.get_erase_count();
+    data.entries[3].work_time_us = 42;
+    ASSERT_EQ(storage->patch(BlobType::TIME_TRACKER_DATA, data, data.entries[3]), StorageStatus::SUCCESS);
+    EXPECT_LE(flash.get_program_count() - programs, 2);
+    EXPECT_EQ(flash.get_erase_count(), erases);
+
+    ASSERT_EQ(storage->patch(BlobType::TIME_TRACKER_DATA, data, data.entries[3]), StorageStatus::SUCCESS);
+    EXPECT_EQ(storage->get_stats().writes_elided, 1);
+    EXPECT_EQ(storage->patch(BlobType::TIME_TRACKER_DATA, data, keys), StorageStatus::INVALID_INPUT);
+
+    storage = boot();
+    TrackerData restored;
+    ASSERT_EQ(storage->get_blob(BlobType::TIME_TRACKER_DATA, restored), StorageStatus::SUCCESS);
+    EXPECT_EQ(std::memcmp(&data, &restored, sizeof(data)), 0);
+}
+
+TEST_F(StorageTest, PatchInWriteBackModeKeepsTheRestOfTheStoredBlob) {
+    TrackerData data{};
+    data.magic   = BLOB_MAGIC;
+    auto storage = boot();
+    ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+    storage->enable_write_back();
+
+    /* Only the patched entry gets staged, the other change stays in RAM */
+    data.entries[0].work_time_us = 7;
+    data.entries[1].work_time_us = 8;
+    ASSERT_EQ(storage->patch(BlobType::TIME_TRACKER_DATA, data, data.entries[1]), StorageStatus::SUCCESS);
+    data.entries[1].meeting_time_us = 9;
+    ASSERT_EQ(storage->patch(BlobType::TIME_TRACKER_DATA, data, data.entries[1]), StorageStatus::SUCCESS);
+    EXPECT_EQ(storage->get_stats().writes_coalesced, 1);
+    ASSERT_EQ(storage->flush(), StorageStatus::SUCCESS);
+
+    storage = boot();
+    TrackerData restored;
+    ASSERT_EQ(storage->get_blob(BlobType::TIME_TRACKER_DATA, restored), StorageStatus::SUCCESS);
+    EXPECT_EQ(restored.entries[0].work_time_us, 0);
+    EXPECT_EQ(restored.entries[1].work_time_us, 8);
+    EXPECT_EQ(restored.entries[1].meeting_time_us, 9);
+}
+
+TEST_F(StorageTest, EraseDropsBlobsAndErasesInBackground) {
+    TrackerData data{};
+    data.magic = BLOB_MAGIC;
+    KeysData keys{ BLOB_MAGIC, { 1 }, 1 };
+    ExtentData extent{};
+    extent.magic = BLOB_MAGIC;
+    auto storage = boot();
+    ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+    ASSERT_EQ(storage->save_blob(BlobType::TEST_EXTENT_DATA, extent), StorageStatus::SUCCESS);
+    for (uint32_t i = 0; i < 500; ++i) {
+        data.entries[i % 4].work_time_us += 4'000'000;
+        ASSERT_EQ(storage->save_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::SUCCESS);
+    }
+
+    /* The logs are dropped by programs alone, only the wear sector the counters move to may be erased */
+    const uint32_t inline_erases = storage->get_stats().inline_erases;
+    uint32_t erases              = flash.get_erase_count();
+    storage->erase();
+    EXPECT_LE(flash.get_erase_count(), erases + 1);
+    EXPECT_EQ(storage->get_stats().inline_erases, inline_erases);
+    EXPECT_GT(storage->get_dirty_sectors(), 1u);
+    EXPECT_EQ(storage->get_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::NOT_FOUND);
+
+    /* Dropped for good even if the device restarts before the sectors are erased, or after some of them are */
+    storage->task();
+    storage->task();
+    storage = boot();
+    EXPECT_EQ(storage->get_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::NOT_FOUND);
+    EXPECT_EQ(storage->get_blob(BlobType::TIME_TRACKER_DATA, data), StorageStatus::NOT_FOUND);
+    EXPECT_EQ(storage->get_blob(BlobType::TEST_EXTENT_DATA, extent), StorageStatus::NOT_FOUND);
+    EXPECT_EQ(storage->get_boot_report().erases, 0u);
+
+    erases     = flash.get_erase_count();
+    uint calls = 0;
+    for (; storage->get_dirty_sectors() > 0; ++calls) {
+        storage->task();
+    }
+    EXPECT_EQ(flash.get_erase_count() - erases, calls);
+    EXPECT_EQ(storage->get_spare_sectors(), STORAGE_LOG_SECTORS_COUNT - STORAGE_ZONES_COUNT);
+}
+
+TEST_F(StorageTest, PowerCutDuringEraseNeverBringsBackOlderVersions) {
+    for (uint32_t cut = 0;; ++cut) {
+        flash.restore_power();
+        std::ranges::fill(flash.raw(), 0xFF);
+
+        /* Older versions of the keys are left in several sectors, reclaimed ones included */
+        KeysData keys{ BLOB_MAGIC, {}, 3 };
+        auto storage = boot();
+        for (uint32_t i = 0; i < 400; ++i) {
+            keys.colors[i % 10] = static_cast<uint8_t>(i);
+            keys.keys_count     = i;
+            ASSERT_EQ(storage->save_blob(BlobType::KEYS_CONFIG, keys), StorageStatus::SUCCESS);
+        }
+
+        flash.cut_power_after(cut);
+        storage->erase();
+        const bool was_cut = flash.is_power_lost();
+        flash.restore_power();
+        storage = boot();
+
+        KeysData restored;
+        if (storage->get_blob(BlobType::KEYS_CONFIG, restored) == StorageStatus::SUCCESS) {
+            EXPECT_EQ(std::memcmp(&keys, &restored, sizeof(keys)), 0) << "Power cut after " << cut << " operations";
+        }
+
+        if (!was_cut)
+            break;
+    }
+}
+
+TEST_F(StorageTest, EventsRoundTripWithTheirTimes) {
+    auto storage = boot();
+    EXPECT_EQ(storage->append_event(1'000'000, 0, 1), StorageStatus::SUCCESS);
+    EXPECT_EQ(storage->append_event(1'000'250, 0, 2), StorageStatus::SUCCESS);
+    /* Set back and then far ahead, both rebase the time */
+    EXPECT_EQ(storage->append_event(500'000, 1, 1), StorageStatus::SUCCESS);
+    EXPECT_EQ(storage->append_event(10'000'000'000, 1, 2), StorageStatus::SUCCESS);
+    EXPECT_EQ(storage->append_event(10'000'000'007, 0, 1), StorageStatus::SUCCESS);
+    EXPECT_EQ(storage->append_event(0, 0, EVENT_TYPE_TIME), StorageStatus::INVALID_INPUT);
+
+    std::array<StorageEvent_t, 8> events;
+    uint32_t next = 0;
+    ASSERT_EQ(storage->read_events(0, events, next), 5u);
+    const std::array<uint64_t, 5> times = { 1'000'000, 1'000'250, 500'000, 10'000'000'000, 10'000'000'007 };
+    for (uint i = 0; i < 5; ++i) {
+        EXPECT_EQ(events[i].time_ms, times[i]) << "Event " << i;
+        EXPECT_GT(events[i].sequence, (i > 0) ? events[i - 1].sequence : 0) << "Event " << i;
+    }
+    EXPECT_EQ(events[2].key, 1);
+    EXPECT_EQ(events[3].type, 2);
+    EXPECT_EQ(next, storage->get_event_range().next_sequence);
+
+    /* Reading on from the last sequence returns nothing new */
+    EXPECT_EQ(storage->read_events(next, events, next), 0u);
+}
+
+TEST_F(StorageTest, EventsOnlyProgram) {
+    auto storage             = boot();
+    const uint32_t erases    = flash.get_erase_count();
+    const uint32_t writes    = flash.get_program_count();
+    constexpr uint32_t count = EVENT_RECORDS_PER_SECTOR * (STORAGE_EVENT_SECTORS_COUNT - 1);
+    for (uint32_t i = 0; i < count; ++i) {
+        ASSERT_EQ(storage->append_event(1'000'000 + (i * 60'000), i % 2, 1 + (i % 2)), StorageStatus::SUCCESS);
+    }
+
+    /* A page program per event and per opened sector, the time records take a slot in each of them */
+    EXPECT_EQ(flash.get_erase_count(), erases);
+    EXPECT_EQ(flash.get_program_count() - writes, count + STORAGE_EVENT_SECTORS_COUNT);
+}
+
+TEST_F(StorageTest, FullEventRingDropsOldestEvents) {
+    auto storage             = boot();
+    constexpr uint32_t count = EVENT_RECORDS_PER_SECTOR * (STORAGE_EVENT_SECTORS_COUNT + 2);
+    for (uint32_t i = 0; i < count; ++i) {
+        ASSERT_EQ(storage->append_event(i * 1000ULL, 0, 1), StorageStatus::SUCCESS);
+        storage->task();
+    }
+
+    /* Paging through returns every event still in the ring, in order and without gaps in time */
+    const StorageEventRange_t range = storage->get_event_range();
+    EXPECT_GT(range.oldest_sequence, 0u);
+    std::array<StorageEvent_t, 32> events;
+    uint32_t next     = 0;
+    uint32_t read     = 0;
+    uint64_t last_ms  = 0;
+    uint32_t last_seq = 0;
+    for (uint32_t n = storage->read_events(0, events, next); n > 0; n = storage->read_events(next, events, next)) {
+        for (uint32_t i = 0; i < n; ++i) {
+            if (read > 0) {
+                EXPECT_EQ(events[i].time_ms, last_ms + 1000);
+                EXPECT_GT(events[i].sequence, last_seq);
+            }
+            last_ms  = events[i].time_ms;
+            last_seq = events[i].sequence;
+            read++;
+        }
+    }
+    EXPECT_EQ(last_ms, (count - 1) * 1000ULL);
+    EXPECT_EQ(next, range.next_sequence);
+    EXPECT_GE(read, EVENT_RECORDS_PER_SECTOR * (STORAGE_EVENT_SECTORS_COUNT - 2));
+    EXPECT_LT(read, count);
+}
+
+TEST_F(StorageTest, EventsContinueAfterReboot) {
+    auto storage = boot();
+    ASSERT_EQ(storage->append_event(5'000'000, 0, 1), StorageStatus::SUCCESS);
+    ASSERT_EQ(storage->append_event(5'000'500, 0, 2), StorageStatus::SUCCESS);
+    const uint32_t next = storage->get_event_range().next_sequence;
+
+    storage = boot();
+    EXPECT_EQ(storage->get_event_range().next_sequence, next);
+    ASSERT_EQ(storage->append_event(5'000'900, 1, 1), StorageStatus::SUCCESS);
+
+    std::array<StorageEvent_t, 8> events;
+    uint32_t after = 0;
+    ASSERT_EQ(storage->read_events(0, events, after), 3u);
+    EXPECT_EQ(events[2].time_ms, 5'000'900u);
+    EXPECT_EQ(events[2].sequence, next);
+}
+
+TEST_F(StorageTest, TornEventIsSkipped) {
+    auto storage = boot();
+    ASSERT_EQ(storage->append_event(2'000'000, 0, 1), StorageStatus::SUCCESS);
+    ASSERT_EQ(storage->append_event(2'000'100, 0, 2), StorageStatus::SUCCESS);
+
+    /* The second event cut short in the middle of its program, with only some of its bits cleared */
+    const uint32_t second = (STORAGE_EVENT_FIRST_SECTOR * FLASH_SECTOR_SIZE) + sizeof(EventSectorHeader_t) +
+                            (2 * sizeof(EventRecord_t));
+    flash.raw()[second] &= 0x0F;
+
+    storage = boot();
+    ASSERT_EQ(storage->append_event(2'000'200, 1, 1), StorageStatus::SUCCESS);
+    std::array<StorageEvent_t, 8> events;
+    uint32_t next = 0;
+    ASSERT_EQ(storage->read_events(0, events, next), 2u);
+    EXPECT_EQ(events[0].time_ms, 2'000'000u);
+    EXPECT_EQ(events[1].time_ms, 2'000'200u);
+    EXPECT_EQ(events[1].sequence, events[0].sequence + 2);
+}
+
+TEST_F(StorageTest, EraseDropsEvents) {
+    auto storage = boot();
+    ASSERT_EQ(storage->append_event(3'000'000, 0, 1), StorageStatus::SUCCESS);
+    storage->erase();
+
+    std::array<StorageEvent_t, 8> events;
+    uint32_t next = 0;
+    EXPECT_EQ(storage->read_events(0, events, next), 0u);
+
+    /* Dropped for good even if the device restarts before the sectors are erased */
+    storage = boot();
+    EXPECT_EQ(storage->read_events(0, events, next), 0u);
+    ASSERT_EQ(storage->append_event(3'000'100, 0, 1), StorageStatus::SUCCESS);
+    ASSERT_EQ(storage->read_events(0, events, next), 1u);
+    EXPECT_EQ(events[0].time_ms, 3'000'100u);
+}
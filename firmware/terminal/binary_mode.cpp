@@ -23,11 +23,14 @@
 #include "features_handler.hpp"
 #include "features_handler_types.hpp"
 #include "time_tracker_types.hpp"
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <cstring>
 
-BinaryMode::BinaryMode(Time& time_, FeaturesHandler& f_handler_)
-: time(time_), binary_mode(false), f_handler(f_handler_) {}
+BinaryMode::BinaryMode(Time& time_, FeaturesHandler& f_handler_, Storage& storage_)
+: time(time_), binary_mode(false), f_handler(f_handler_), storage(storage_), stream_command(BinaryCommandID::UNKNOWN),
+  stream_offset(0), stream_chunk(0), stream_chunks_count(0) {}
 
 std::span<uint8_t> BinaryMode::handle(uint8_t ch) {
     binary_buffer.push_back(ch);
@@ -44,7 +47,9 @@ std::span<uint8_t> BinaryMode::handle(uint8_t ch) {
         const size_t full_packet_size = BINARY_MODE_HEADER_SIZE_BYTES + payload_length + BINARY_MODE_CRC_32_SIZE_BYTES;
 
         if (binary_buffer.size() == full_packet_size) {
-            response = handle_binary_packet(binary_buffer);
+            /* A new command ends the stream still in progress */
+            stream_chunks_count = 0;
+            response            = handle_binary_packet(binary_buffer);
             binary_buffer.clear();
             binary_mode = false;
         }
@@ -105,6 +110,9 @@ BinCmdResponse BinaryMode::handle_binary_packet(const std::vector<uint8_t>& pack
         case BinaryCommandID::GET_TIME_REPORT:
             response = handle_get_time_report_cmd(payload, command_type);
             break;
+        case BinaryCommandID::GET_ALL_TIME_REPORTS:
+            response = handle_get_all_time_reports_cmd(payload, command_type);
+            break;
         case BinaryCommandID::GET_TIME_SESSION_ID:
             response = handle_get_time_session_id_cmd(payload, command_type);
             break;
@@ -117,6 +125,18 @@ BinCmdResponse BinaryMode::handle_binary_packet(const std::vector<uint8_t>& pack
         case BinaryCommandID::TIME_SET_LONG_THRESHOLD:
             response = handle_set_time_long_threshold_cmd(payload, command_type);
             break;
+        case BinaryCommandID::GET_FLASH_TIMINGS:
+            response = handle_get_flash_timings_cmd(payload, command_type);
+            break;
+        case BinaryCommandID::GET_WEAR_STATS:
+            response = handle_get_wear_stats_cmd(payload, command_type);
+            break;
+        case BinaryCommandID::TIME_PERSISTENCE_POLICY:
+            response = handle_time_persistence_policy_cmd(payload, command_type);
+            break;
+        case BinaryCommandID::GET_TIME_EVENTS:
+            response = handle_get_time_events_cmd(payload, command_type);
+            break;
         case BinaryCommandID::UNKNOWN:
         default: break;
     }
@@ -124,6 +144,41 @@ BinCmdResponse BinaryMode::handle_binary_packet(const std::vector<uint8_t>& pack
     return response;
 }
 
+std::span<uint8_t> BinaryMode::poll() {
+    if (!is_streaming())
+        return {};
+
+    /* Every chunk is a frame of its own with its index, the chunks count and a part of the data */
+    const size_t length =
+        std::min<size_t>(stream_buffer.size() - stream_offset, BINARY_MODE_STREAM_CHUNK_DATA_SIZE_BYTES);
+    constexpr size_t header_size = BINARY_MODE_STREAM_CHUNK_HEADER_SIZE_BYTES;
+    std::array<uint8_t, header_size + BINARY_MODE_STREAM_CHUNK_DATA_SIZE_BYTES> chunk;
+    chunk[0] = stream_chunk++;
+    chunk[1] = stream_chunks_count;
+    std::copy_n(stream_buffer.begin() + stream_offset, length, chunk.begin() + header_size);
+    stream_offset += length;
+
+    return create_binary_response(stream_command, BinaryCommandStatus::SUCCESS,
+        std::span<uint8_t>(chunk.data(), header_size + length));
+}
+
+BinCmdResponse BinaryMode::start_stream(BinaryCommandID command_id) {
+    /* An empty stream still sends a single chunk */
+    constexpr size_t chunk_size = BINARY_MODE_STREAM_CHUNK_DATA_SIZE_BYTES;
+    const size_t chunks_count   = std::max<size_t>(1, (stream_buffer.size() + chunk_size - 1) / chunk_size);
+    if (chunks_count > UINT8_MAX) {
+        stream_buffer.clear();
+        return create_binary_response(command_id, BinaryCommandStatus::ERROR);
+    }
+
+    /* The first chunk is the response to the command, poll() sends the rest */
+    stream_command      = command_id;
+    stream_offset       = 0;
+    stream_chunk        = 0;
+    stream_chunks_count = static_cast<uint8_t>(chunks_count);
+    return poll();
+}
+
 uint32_t BinaryMode::calculate_crc32(const uint8_t* data, size_t length) {
     uint32_t crc = 0xFFFFFFFF;
     for (size_t i = 0; i < length; ++i) {
@@ -138,7 +193,8 @@ uint32_t BinaryMode::calculate_crc32(const uint8_t* data, size_t length) {
 std::span<uint8_t> BinaryMode::create_binary_response(BinaryCommandID command_id,
     BinaryCommandStatus status,
     std::span<uint8_t> payload) {
-    std::vector<uint8_t> response;
+    std::vector<uint8_t>& response = response_buffer;
+    response.clear();
 
     response.push_back(BINARY_HEADER_2);
     response.push_back(BINARY_HEADER_1);
@@ -218,6 +274,40 @@ BinCmdResponse BinaryMode::handle_get_time_report_cmd(const std::vector<uint8_t>
         std::span<uint8_t>(response_payload));
 }
 
+BinCmdResponse BinaryMode::handle_get_all_time_reports_cmd(const std::vector<uint8_t>& payload,
+    BinaryCommandType cmd_type) {
+    if (cmd_type != BinaryCommandType::READ) {
+        return create_binary_response(BinaryCommandID::GET_ALL_TIME_REPORTS, BinaryCommandStatus::UNSUPPORTED_CMP_TYPE);
+    }
+
+    if (!payload.empty()) {
+        return create_binary_response(BinaryCommandID::GET_ALL_TIME_REPORTS, BinaryCommandStatus::INVALID_PAYLOAD);
+    }
+
+    /* A snapshot of every session which tracked anything, the session id followed by its entry */
+    stream_buffer.clear();
+    for (uint32_t session_id = 0; session_id < MAX_TIME_TRACKER_ENTRIES_COUNT; ++session_id) {
+        const auto result = f_handler.get_cmd(FeatureType::TIME_TRACKER, GetTimeTrackerEntryCmd{ session_id });
+        if (result.first != FeatureCmdStatus::SUCCESS) {
+            stream_buffer.clear();
+            return create_binary_response(BinaryCommandID::GET_ALL_TIME_REPORTS, BinaryCommandStatus::ERROR);
+        }
+
+        const auto& entry       = std::get<TimeTrackingEntry_t>(result.second);
+        const DateTime_t& date  = entry.tracking_date;
+        const bool is_populated = (entry.work_time_us != 0) || (entry.meeting_time_us != 0) || (date.year != 0) ||
+            (date.month != 0) || (date.day != 0);
+        if (!is_populated)
+            continue;
+
+        const auto* bytes = reinterpret_cast<const uint8_t*>(&entry);
+        stream_buffer.push_back(static_cast<uint8_t>(session_id));
+        stream_buffer.insert(stream_buffer.end(), bytes, bytes + sizeof(entry));
+    }
+
+    return start_stream(BinaryCommandID::GET_ALL_TIME_REPORTS);
+}
+
 BinCmdResponse BinaryMode::handle_get_time_session_id_cmd(const std::vector<uint8_t>& payload,
     BinaryCommandType cmd_type) {
     if (cmd_type != BinaryCommandType::READ) {
@@ -307,3 +397,127 @@ BinCmdResponse BinaryMode::handle_set_time_long_threshold_cmd(const std::vector<
 
     return create_binary_response(BinaryCommandID::TIME_SET_LONG_THRESHOLD, BinaryCommandStatus::SUCCESS);
 }
+
+BinCmdResponse BinaryMode::handle_time_persistence_policy_cmd(const std::vector<uint8_t>& payload,
+    BinaryCommandType cmd_type) {
+    /* Maximum interval in milliseconds followed by the save on transitions flag */
+    constexpr size_t policy_payload_size = sizeof(uint32_t) + sizeof(uint8_t);
+
+    if (cmd_type == BinaryCommandType::READ) {
+        if (!payload.empty()) {
+            return create_binary_response(BinaryCommandID::TIME_PERSISTENCE_POLICY, BinaryCommandStatus::INVALID_PAYLOAD);
+        }
+
+        const auto result = f_handler.get_cmd(FeatureType::TIME_TRACKER, GetTimeTrackerPersistencePolicyCmd{});
+        if (result.first != FeatureCmdStatus::SUCCESS) {
+            return create_binary_response(BinaryCommandID::TIME_PERSISTENCE_POLICY, BinaryCommandStatus::ERROR);
+        }
+
+        const auto& policy = std::get<TimeTrackerPersistencePolicy_t>(result.second);
+        std::vector<uint8_t> response_payload(policy_payload_size);
+        std::memcpy(response_payload.data(), &policy.max_interval_ms, sizeof(policy.max_interval_ms));
+        response_payload[sizeof(uint32_t)] = policy.save_on_transitions ? 1 : 0;
+
+        return create_binary_response(BinaryCommandID::TIME_PERSISTENCE_POLICY, BinaryCommandStatus::SUCCESS,
+            std::span<uint8_t>(response_payload));
+    }
+
+    if ((payload.size() != policy_payload_size) || (payload[sizeof(uint32_t)] > 1)) {
+        return create_binary_response(BinaryCommandID::TIME_PERSISTENCE_POLICY, BinaryCommandStatus::INVALID_PAYLOAD);
+    }
+
+    TimeTrackerPersistencePolicy_t policy;
+    std::memcpy(&policy.max_interval_ms, payload.data(), sizeof(policy.max_interval_ms));
+    policy.save_on_transitions = (payload[sizeof(uint32_t)] == 1);
+
+    const auto status = f_handler.set_cmd(FeatureType::TIME_TRACKER, SetTimeTrackerPersistencePolicyCmd{ policy });
+    if (status == FeatureCmdStatus::INVALID_PAYLOAD) {
+        return create_binary_response(BinaryCommandID::TIME_PERSISTENCE_POLICY, BinaryCommandStatus::INVALID_PAYLOAD);
+    } else if (status != FeatureCmdStatus::SUCCESS) {
+        return create_binary_response(BinaryCommandID::TIME_PERSISTENCE_POLICY, BinaryCommandStatus::ERROR);
+    }
+
+    return create_binary_response(BinaryCommandID::TIME_PERSISTENCE_POLICY, BinaryCommandStatus::SUCCESS);
+}
+
+BinCmdResponse BinaryMode::handle_get_time_events_cmd(const std::vector<uint8_t>& payload,
+    BinaryCommandType cmd_type) {
+    if (cmd_type != BinaryCommandType::READ) {
+        return create_binary_response(BinaryCommandID::GET_TIME_EVENTS, BinaryCommandStatus::UNSUPPORTED_CMP_TYPE);
+    }
+
+    uint32_t first_sequence;
+    if (payload.size() != sizeof(first_sequence)) {
+        return create_binary_response(BinaryCommandID::GET_TIME_EVENTS, BinaryCommandStatus::INVALID_PAYLOAD);
+    }
+    std::memcpy(&first_sequence, payload.data(), sizeof(first_sequence));
+
+    /* The range and the sequence to continue from, followed by a page of events */
+    std::array<StorageEvent_t, BINARY_MODE_EVENTS_PAGE_SIZE> events;
+    uint32_t next_sequence          = 0;
+    const uint32_t count            = storage.read_events(first_sequence, events, next_sequence);
+    const StorageEventRange_t range = storage.get_event_range();
+
+    constexpr size_t header_size = sizeof(range.oldest_sequence) + sizeof(next_sequence) + sizeof(uint8_t);
+    std::vector<uint8_t> response_payload(header_size + (count * BINARY_MODE_EVENT_SIZE_BYTES));
+    uint8_t* out = response_payload.data();
+    std::memcpy(out, &range.oldest_sequence, sizeof(range.oldest_sequence));
+    out += sizeof(range.oldest_sequence);
+    std::memcpy(out, &next_sequence, sizeof(next_sequence));
+    out += sizeof(next_sequence);
+    *out++ = static_cast<uint8_t>(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        std::memcpy(out, &events[i].sequence, sizeof(events[i].sequence));
+        std::memcpy(out + 4, &events[i].time_ms, sizeof(events[i].time_ms));
+        out[12] = events[i].key;
+        out[13] = events[i].type;
+        out += BINARY_MODE_EVENT_SIZE_BYTES;
+    }
+
+    return create_binary_response(BinaryCommandID::GET_TIME_EVENTS, BinaryCommandStatus::SUCCESS,
+        std::span<uint8_t>(response_payload));
+}
+
+BinCmdResponse BinaryMode::handle_get_flash_timings_cmd(const std::vector<uint8_t>& payload,
+    BinaryCommandType cmd_type) {
+    if (cmd_type != BinaryCommandType::READ) {
+        return create_binary_response(BinaryCommandID::GET_FLASH_TIMINGS, BinaryCommandStatus::UNSUPPORTED_CMP_TYPE);
+    }
+
+    if (!payload.empty()) {
+        return create_binary_response(BinaryCommandID::GET_FLASH_TIMINGS, BinaryCommandStatus::INVALID_PAYLOAD);
+    }
+
+    /* Histograms one after another, in FlashTimingType order */
+    const FlashTimings& timings = storage.get_flash_timings();
+    constexpr size_t types_count = static_cast<size_t>(FlashTimingType::TYPES_COUNT);
+    std::vector<uint8_t> response_payload(types_count * sizeof(FlashTimingHistogram_t));
+    for (size_t type = 0; type < types_count; ++type) {
+        const FlashTimingHistogram_t& histogram = timings.get(static_cast<FlashTimingType>(type));
+        std::memcpy(response_payload.data() + (type * sizeof(histogram)), &histogram, sizeof(histogram));
+    }
+
+    return create_binary_response(BinaryCommandID::GET_FLASH_TIMINGS, BinaryCommandStatus::SUCCESS,
+        std::span<uint8_t>(response_payload));
+}
+
+BinCmdResponse BinaryMode::handle_get_wear_stats_cmd(const std::vector<uint8_t>& payload,
+    BinaryCommandType cmd_type) {
+    if (cmd_type != BinaryCommandType::READ) {
+        return create_binary_response(BinaryCommandID::GET_WEAR_STATS, BinaryCommandStatus::UNSUPPORTED_CMP_TYPE);
+    }
+
+    if (!payload.empty()) {
+        return create_binary_response(BinaryCommandID::GET_WEAR_STATS, BinaryCommandStatus::INVALID_PAYLOAD);
+    }
+
+    /* The report followed by the erase count of every sector */
+    const StorageWearReport_t report       = storage.get_wear_report();
+    const std::span<const uint32_t> counts = storage.get_erase_counts();
+    std::vector<uint8_t> response_payload(sizeof(report) + counts.size_bytes());
+    std::memcpy(response_payload.data(), &report, sizeof(report));
+    std::memcpy(response_payload.data() + sizeof(report), counts.data(), counts.size_bytes());
+
+    return create_binary_response(BinaryCommandID::GET_WEAR_STATS, BinaryCommandStatus::SUCCESS,
+        std::span<uint8_t>(response_payload));
+}
@@ -22,6 +22,7 @@
 #pragma once
 
 #include "features_handler.hpp"
+#include "storage.hpp"
 #include "time.hpp"
 #include <cstdint>
 #include <span>
@@ -30,6 +31,14 @@
 #define BINARY_MODE_HEADER_SIZE_BYTES 8
 #define BINARY_MODE_LENGTH_FIELD_SIZE_BYTES 4
 #define BINARY_MODE_CRC_32_SIZE_BYTES 4
+#define BINARY_MODE_EVENTS_PAGE_SIZE 32
+#define BINARY_MODE_EVENT_SIZE_BYTES 14
+/* Whole frame of a streamed response, matches CFG_TUD_CDC_TX_BUFSIZE so a chunk fits into the empty CDC FIFO */
+#define BINARY_MODE_STREAM_CHUNK_SIZE_BYTES 64
+#define BINARY_MODE_STREAM_CHUNK_HEADER_SIZE_BYTES 2
+#define BINARY_MODE_STREAM_CHUNK_DATA_SIZE_BYTES                                                         \
+    (BINARY_MODE_STREAM_CHUNK_SIZE_BYTES - BINARY_MODE_HEADER_SIZE_BYTES - BINARY_MODE_CRC_32_SIZE_BYTES - \
+        BINARY_MODE_STREAM_CHUNK_HEADER_SIZE_BYTES)
 
 constexpr uint8_t BINARY_HEADER_1 = 0xAA;
 constexpr uint8_t BINARY_HEADER_2 = 0xBB;
@@ -46,6 +55,11 @@ enum class BinaryCommandID : uint8_t {
     TIME_NEW_SESSION          = 0x04,
     TIME_SET_MEDIUM_THRESHOLD = 0x05,
     TIME_SET_LONG_THRESHOLD   = 0x06,
+    GET_FLASH_TIMINGS         = 0x07,
+    GET_WEAR_STATS            = 0x08,
+    TIME_PERSISTENCE_POLICY   = 0x09,
+    GET_TIME_EVENTS           = 0x0A,
+    GET_ALL_TIME_REPORTS      = 0x0B,
     UNKNOWN                   = 0xFF,
 };
 
@@ -61,18 +75,30 @@ using BinCmdResponse = std::span<uint8_t>;
 
 class BinaryMode {
   public:
-    BinaryMode(Time& time, FeaturesHandler& f_handler_);
+    BinaryMode(Time& time, FeaturesHandler& f_handler_, Storage& storage_);
     ~BinaryMode() = default;
 
     std::span<uint8_t> handle(uint8_t ch);
     bool is_binary_mode();
     void check_binary_mode(uint8_t ch);
+    bool is_streaming() const { return stream_chunk < stream_chunks_count; }
+    /* Next chunk of a streamed response, empty once all of them were sent */
+    std::span<uint8_t> poll();
 
   private:
     Time& time;
     bool binary_mode;
     FeaturesHandler& f_handler;
+    Storage& storage;
     std::vector<uint8_t> binary_buffer;
+    std::vector<uint8_t> response_buffer; /* The last response, valid until the next one is created */
+
+    /* Streamed response, sent in chunks by poll() */
+    BinaryCommandID stream_command;
+    std::vector<uint8_t> stream_buffer;
+    size_t stream_offset;
+    uint8_t stream_chunk;
+    uint8_t stream_chunks_count;
 
     /* -------------------------------------------------------------------------- */
     /*                              Commands handling                             */
@@ -81,17 +107,25 @@ class BinaryMode {
     BinCmdResponse create_binary_response(BinaryCommandID command_id, BinaryCommandStatus status, std::span<uint8_t> payload = {});
     std::span<uint8_t> handle_binary_packet(const std::vector<uint8_t>& packet);
     uint32_t calculate_crc32(const uint8_t* data, size_t length);
+    BinCmdResponse start_stream(BinaryCommandID command_id);
 
     BinCmdResponse handle_sync_time_cmd(const std::vector<uint8_t>& payload, BinaryCommandType cmd_type);
 
     /* Feature GET commands */
     BinCmdResponse handle_get_time_report_cmd(const std::vector<uint8_t>& payload, BinaryCommandType cmd_type);
+    BinCmdResponse handle_get_all_time_reports_cmd(const std::vector<uint8_t>& payload, BinaryCommandType cmd_type);
     BinCmdResponse handle_get_time_session_id_cmd(const std::vector<uint8_t>& payload, BinaryCommandType cmd_type);
 
     /* Feature SET commands */
     BinCmdResponse handle_set_time_new_session_cmd(const std::vector<uint8_t>& payload, BinaryCommandType cmd_type);
     BinCmdResponse handle_set_time_medium_threshold_cmd(const std::vector<uint8_t>& payload, BinaryCommandType cmd_type);
     BinCmdResponse handle_set_time_long_threshold_cmd(const std::vector<uint8_t>& payload, BinaryCommandType cmd_type);
+    BinCmdResponse handle_time_persistence_policy_cmd(const std::vector<uint8_t>& payload, BinaryCommandType cmd_type);
+    BinCmdResponse handle_get_time_events_cmd(const std::vector<uint8_t>& payload, BinaryCommandType cmd_type);
+
+    /* Diagnostics */
+    BinCmdResponse handle_get_flash_timings_cmd(const std::vector<uint8_t>& payload, BinaryCommandType cmd_type);
+    BinCmdResponse handle_get_wear_stats_cmd(const std::vector<uint8_t>& payload, BinaryCommandType cmd_type);
     // clang-format on
     /* -------------------------------------------------------------------------- */
 };
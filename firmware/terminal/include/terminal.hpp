@@ -39,8 +39,10 @@ class Terminal {
     BinaryMode binary_mode;
 
   public:
-    Terminal(Storage& storage, KeysConfig& keys, FeaturesHandler& f_handler, Time& time);
+    Terminal(Storage& storage, KeysConfig& keys, FeaturesHandler& f_handler, Time& time, WorkQueue& work_queue,
+        const BootTimings_t& boot_timings);
     ~Terminal() = default;
 
     std::span<uint8_t> terminal(char byte);
+    std::span<uint8_t> poll();
 };
@@ -30,6 +30,7 @@
 #include "features_handler.hpp"
 #include "keys_config.hpp"
 #include "storage.hpp"
+#include "work_queue.hpp"
 
 enum class Command {
     RESET,
@@ -39,24 +40,51 @@ enum class Command {
     TIME,
     LONG_PRESS_MS,
     FACTORY_INIT,
+    STORAGE,
+    WEAR,
+    BOOT,
+    QUEUE,
     UNKNOWN,
 };
 
+/* Command still running in the background, see TextMode::poll() */
+enum class TextModeJob {
+    NONE,
+    ERASE,
+    FACTORY_INIT,
+};
+
+/* Time each part of the firmware took to start, filled by main() */
+typedef struct {
+    uint32_t storage_us;
+    uint32_t keys_us;
+    uint32_t leds_us;
+    uint32_t features_us;
+    uint32_t usb_us;
+} BootTimings_t;
+
 class TextMode {
   public:
-    TextMode(Storage& storage, KeysConfig& keys, FeaturesHandler& f_handler);
+    TextMode(Storage& storage, KeysConfig& keys, FeaturesHandler& f_handler, WorkQueue& work_queue,
+        const BootTimings_t& boot_timings);
     ~TextMode() = default;
 
     std::span<uint8_t> handle(char ch);
+    std::span<uint8_t> poll();
 
   private:
     Storage& storage;
     KeysConfig& keys;
     FeaturesHandler& f_handler;
+    WorkQueue& work_queue;
+    const BootTimings_t& boot_timings;
 
     std::string output_buffer;
     std::string text_buffer;
 
+    TextModeJob job       = TextModeJob::NONE;
+    uint job_sectors_left = 0;
+
     static constexpr std::string start_string = "\r3-key>";
     static constexpr size_t max_chars         = 128;
 
@@ -68,6 +96,7 @@ class TextMode {
     bool dispatch_cmd(Command command, const std::vector<std::string>& params);
     bool handle_cmd(const std::string& command_str);
     void add_log(std::string log);
+    void add_flash_timing_log(const std::string& name, const FlashTimingHistogram_t& histogram);
 
     /* Command strings mapping */
     std::map<std::string, Command> command_map = {
@@ -78,6 +107,10 @@ class TextMode {
         { "feature", Command::FEATURE },
         { "time", Command::TIME },
         { "long_press_ms", Command::LONG_PRESS_MS },
+        { "storage", Command::STORAGE },
+        { "wear", Command::WEAR },
+        { "boot", Command::BOOT },
+        { "queue", Command::QUEUE },
     };
 
     /* Commands handling */
@@ -86,4 +119,8 @@ class TextMode {
     bool handle_feature_cmd(const std::vector<std::string>& params);
     bool handle_time_cmd(const std::vector<std::string>& params);
     bool handle_long_press_ms_cmd(const std::vector<std::string>& params);
+    bool handle_storage_cmd(const std::vector<std::string>& params);
+    bool handle_wear_cmd(const std::vector<std::string>& params);
+    bool handle_boot_cmd(const std::vector<std::string>& params);
+    bool handle_queue_cmd(const std::vector<std::string>& params);
 };
@@ -22,8 +22,9 @@
 #include "terminal.hpp"
 #include "binary_mode.hpp"
 
-Terminal::Terminal(Storage& storage, KeysConfig& keys, FeaturesHandler& f_handler, Time& time)
-: text_mode(storage, keys, f_handler), binary_mode(time, f_handler) {}
+Terminal::Terminal(Storage& storage, KeysConfig& keys, FeaturesHandler& f_handler, Time& time,
+    WorkQueue& work_queue, const BootTimings_t& boot_timings)
+: text_mode(storage, keys, f_handler, work_queue, boot_timings), binary_mode(time, f_handler, storage) {}
 
 std::span<uint8_t> Terminal::terminal(char byte) {
     binary_mode.check_binary_mode(static_cast<uint8_t>(byte));
@@ -34,3 +35,11 @@ std::span<uint8_t> Terminal::terminal(char byte) {
         return text_mode.handle(byte);
     }
 }
+
+std::span<uint8_t> Terminal::poll() {
+    if (binary_mode.is_streaming())
+        return binary_mode.poll();
+
+    /* Nothing unsolicited is sent in the middle of a binary exchange */
+    return binary_mode.is_binary_mode() ? std::span<uint8_t>() : text_mode.poll();
+}
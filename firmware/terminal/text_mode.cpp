@@ -25,8 +25,9 @@
 #include "time_tracker.hpp"
 #include <sstream>
 
-TextMode::TextMode(Storage& storage_, KeysConfig& keys_, FeaturesHandler& f_handler_)
-: storage(storage_), keys(keys_), f_handler(f_handler_) {
+TextMode::TextMode(Storage& storage_, KeysConfig& keys_, FeaturesHandler& f_handler_, WorkQueue& work_queue_,
+    const BootTimings_t& boot_timings_)
+: storage(storage_), keys(keys_), f_handler(f_handler_), work_queue(work_queue_), boot_timings(boot_timings_) {
     text_buffer = start_string;
 }
 
@@ -58,6 +59,29 @@ std::span<uint8_t> TextMode::handle(char ch) {
     return std::span<uint8_t>(reinterpret_cast<uint8_t*>(output_buffer.data()), output_buffer.size());
 }
 
+/* Progress of a running job, printed above the line being typed */
+std::span<uint8_t> TextMode::poll() {
+    if (job == TextModeJob::NONE)
+        return {};
+
+    /* Sectors are erased by Storage::task(), one per main loop iteration */
+    const uint sectors_left = storage.get_dirty_sectors();
+    const bool is_saved     = (job != TextModeJob::FACTORY_INIT) || !storage.has_pending_blobs();
+    std::string log;
+    if ((sectors_left == 0) && is_saved) {
+        log = (job == TextModeJob::ERASE) ? "Flash storage erased" : "Factory init done";
+        job = TextModeJob::NONE;
+    } else if (sectors_left != job_sectors_left) {
+        log = std::to_string(sectors_left) + " sectors left to erase";
+    } else {
+        return {};
+    }
+    job_sectors_left = sectors_left;
+
+    output_buffer = "\r\n" + log + "\n" + text_buffer;
+    return std::span<uint8_t>(reinterpret_cast<uint8_t*>(output_buffer.data()), output_buffer.size());
+}
+
 bool TextMode::is_enter_pressed(char& ch) const {
     return (ch == '\r' || ch == '\n');
 }
@@ -94,11 +118,16 @@ bool TextMode::dispatch_cmd(Command command, const std::vector<std::string>& par
         }
         case Command::ERASE: {
             storage.erase();
-            add_log("Flash storage erased");
+            add_log("Erasing flash storage...");
+            job              = TextModeJob::ERASE;
+            job_sectors_left = 0;
             return true;
         }
         case Command::FACTORY_INIT: {
             f_handler.factory_init_features();
+            add_log("Factory init started...");
+            job              = TextModeJob::FACTORY_INIT;
+            job_sectors_left = 0;
             return true;
         }
         case Command::CHANGE_COLOR: {
@@ -113,6 +142,18 @@ bool TextMode::dispatch_cmd(Command command, const std::vector<std::string>& par
         case Command::LONG_PRESS_MS: {
             return handle_long_press_ms_cmd(params);
         }
+        case Command::STORAGE: {
+            return handle_storage_cmd(params);
+        }
+        case Command::WEAR: {
+            return handle_wear_cmd(params);
+        }
+        case Command::BOOT: {
+            return handle_boot_cmd(params);
+        }
+        case Command::QUEUE: {
+            return handle_queue_cmd(params);
+        }
         case Command::UNKNOWN:
         default: return false;
     }
@@ -236,8 +277,133 @@ bool TextMode::handle_long_press_ms_cmd(const std::vector<std::string>& params)
     return true;
 }
 
+bool TextMode::handle_storage_cmd(const std::vector<std::string>& params) {
+    if (params.size() > 1) {
+        add_log("Error: Too many arguments");
+        return false;
+    }
+
+    if (params.size() == 1) {
+        if (params[0] != "flash") {
+            add_log("Error: Unsupported argument");
+            return false;
+        }
+
+        const FlashTimings& timings = storage.get_flash_timings();
+        add_flash_timing_log("Erase", timings.get(FlashTimingType::ERASE));
+        add_flash_timing_log("Program", timings.get(FlashTimingType::PROGRAM));
+        add_flash_timing_log("Core1 paused", timings.get(FlashTimingType::CORE_LOCKOUT));
+        return true;
+    }
+
+    const StorageStats_t stats = storage.get_stats();
+    add_log("Writes performed: " + std::to_string(stats.writes_performed));
+    add_log("Writes elided: " + std::to_string(stats.writes_elided));
+    add_log("Writes coalesced: " + std::to_string(stats.writes_coalesced));
+    add_log("Writes in place: " + std::to_string(stats.writes_in_place));
+    add_log("Inline erases: " + std::to_string(stats.inline_erases));
+    add_log("Spare sectors: " + std::to_string(storage.get_spare_sectors()) + ", " +
+            std::to_string(storage.get_dirty_sectors()) + " to erase");
+    const FlashTimingHistogram_t& save_latency = storage.get_save_latency();
+    add_log("Save latency: p99 " + std::to_string(FlashTimings::get_percentile_us(save_latency, 99)) + "us, max " +
+            std::to_string(save_latency.max_us) + "us");
+
+    const StorageBootReport_t boot_report = storage.get_boot_report();
+    add_log("Boot validation: " + std::to_string(boot_report.validation_us) + "us");
+    add_log("Corrupted records: " + std::to_string(boot_report.corrupted_records));
+    add_log("Recovered blobs: " + std::to_string(boot_report.recovered_blobs));
+
+    return true;
+}
+
+bool TextMode::handle_wear_cmd(const std::vector<std::string>& params) {
+    if (!params.empty()) {
+        add_log("Error: Too many arguments");
+        return false;
+    }
+
+    std::string counts;
+    for (const uint32_t count : storage.get_erase_counts()) {
+        counts += " " + std::to_string(count);
+    }
+    add_log("Sector erases:" + counts);
+
+    const StorageWearReport_t report = storage.get_wear_report();
+    add_log("Erases: " + std::to_string(report.total_erases) + " total, " + std::to_string(report.boot_erases) +
+            " since boot");
+    add_log("Most worn sector: " + std::to_string(report.max_erase_count) + " of " +
+            std::to_string(FLASH_ENDURANCE_CYCLES) + " cycles");
+    if (report.hours_left == UINT32_MAX) {
+        add_log("Endurance limit: unknown, nothing erased since boot");
+    } else {
+        add_log("Endurance limit: in " + std::to_string(report.hours_left / 24) + " days at the rate since boot");
+    }
+
+    return true;
+}
+
+bool TextMode::handle_boot_cmd(const std::vector<std::string>& params) {
+    if (!params.empty()) {
+        add_log("Error: Too many arguments");
+        return false;
+    }
+
+    const uint32_t total_us = boot_timings.storage_us + boot_timings.keys_us + boot_timings.leds_us +
+                              boot_timings.features_us + boot_timings.usb_us;
+    add_log("Storage: " + std::to_string(boot_timings.storage_us) + "us");
+    add_log("Keys: " + std::to_string(boot_timings.keys_us) + "us");
+    add_log("LEDs: " + std::to_string(boot_timings.leds_us) + "us");
+    add_log("Features: " + std::to_string(boot_timings.features_us) + "us");
+    add_log("USB: " + std::to_string(boot_timings.usb_us) + "us");
+    add_log("Total: " + std::to_string(total_us) + "us");
+
+    const StorageBootReport_t boot_report = storage.get_boot_report();
+    add_log("Boot count: " + std::to_string(storage.get_init_count()) + ", " +
+            std::to_string(boot_report.erases) + " sectors erased");
+
+    return true;
+}
+
+bool TextMode::handle_queue_cmd(const std::vector<std::string>& params) {
+    if (!params.empty()) {
+        add_log("Error: Too many arguments");
+        return false;
+    }
+
+    const WorkQueueStats_t stats = work_queue.get_stats();
+    const uint64_t avg_us        = (stats.completed != 0) ? (stats.total_latency_us / stats.completed) : 0;
+    add_log("Work items: " + std::to_string(stats.posted) + " posted, " + std::to_string(stats.completed) +
+            " completed, " + std::to_string(stats.coalesced) + " coalesced, " + std::to_string(stats.dropped) +
+            " dropped");
+    add_log("Depth: " + std::to_string(work_queue.get_depth()) + " now, " + std::to_string(stats.max_depth) +
+            " max of " + std::to_string(WORK_QUEUE_CAPACITY));
+    add_log("Latency: avg " + std::to_string(avg_us) + "us, max " + std::to_string(stats.max_latency_us) + "us");
+
+    return true;
+}
+
+void TextMode::add_flash_timing_log(const std::string& name, const FlashTimingHistogram_t& histogram) {
+    const uint64_t avg_us = (histogram.count != 0) ? (histogram.total_us / histogram.count) : 0;
+    add_log(name + ": " + std::to_string(histogram.count) + " ops, avg " + std::to_string(avg_us) + "us, max " +
+            std::to_string(histogram.max_us) + "us");
+
+    /* Only the non-empty buckets, named by their upper limit */
+    std::string buckets;
+    for (size_t bucket = 0; bucket < FLASH_TIMING_BUCKETS_COUNT; ++bucket) {
+        if (histogram.buckets[bucket] == 0)
+            continue;
+        const bool is_last = (bucket == (FLASH_TIMING_BUCKETS_COUNT - 1));
+        const uint32_t limit_us = FlashTimings::get_bucket_limit_us(is_last ? (bucket - 1) : bucket);
+        buckets += (is_last ? " >=" : " <") + std::to_string(limit_us) + "us:";
+        buckets += std::to_string(histogram.buckets[bucket]);
+    }
+    if (!buckets.empty())
+        add_log(" " + buckets);
+}
+
 #define PICO_STDIO_USB_RESET_BOOTSEL_INTERFACE_DISABLE_MASK 0u
 
 void TextMode::reset_to_bootloader() const {
+    (void)storage.flush();
     reset_usb_boot(1u, PICO_STDIO_USB_RESET_BOOTSEL_INTERFACE_DISABLE_MASK);
 }
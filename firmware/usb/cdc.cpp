@@ -25,15 +25,32 @@
 #pragma GCC diagnostic pop
 #include "terminal.hpp"
 
-void CdcDevice::task() const {
+static_assert(BINARY_MODE_STREAM_CHUNK_SIZE_BYTES <= CFG_TUD_CDC_TX_BUFSIZE, "A chunk has to fit into the CDC FIFO.");
+
+/* The FIFO takes only what it has room for, nothing new is read or polled until the rest went out */
+bool CdcDevice::write_pending() {
+    if (!pending.empty()) {
+        const uint32_t written = tud_cdc_write(pending.data(), static_cast<uint32_t>(pending.size()));
+        tud_cdc_write_flush();
+        pending = pending.subspan(written);
+    }
+    return pending.empty();
+}
+
+void CdcDevice::task() {
+    if (!write_pending())
+        return;
+
     while (tud_cdc_available()) {
         const char c = static_cast<char>(tud_cdc_read_char());
 
-        const std::span<uint8_t> buffer_span = t.terminal(c);
-
-        tud_cdc_write(buffer_span.data(), buffer_span.size());
-        tud_cdc_write_flush();
+        pending = t.terminal(c);
+        if (!write_pending())
+            return;
     }
+
+    pending = t.poll();
+    write_pending();
 }
 
 void CdcDevice::log(const char* message) const {
@@ -33,9 +33,12 @@ class CdcDevice {
     explicit CdcDevice(Terminal& t_) : t(t_) {};
     ~CdcDevice() = default;
 
-    void task() const;
+    void task();
     void log(const char* message) const;
 
   private:
     Terminal& t;
+    std::span<uint8_t> pending; /* Part of the last response the CDC FIFO had no room for yet */
+
+    bool write_pending();
 };
@@ -0,0 +1,80 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#ifdef UNIT_TEST
+#include "mock_critical_section.hpp"
+#else
+#include "pico/critical_section.h"
+#endif
+
+#define WORK_QUEUE_CAPACITY 8U
+
+using WorkHandler = void (*)(void* context);
+using WorkClock   = uint64_t (*)();
+
+typedef struct {
+    WorkHandler handler;
+    void* context;
+    uint64_t posted_us;
+} WorkItem_t;
+
+typedef struct {
+    uint32_t posted;
+    uint32_t coalesced; /* Posts of an item which was still waiting */
+    uint32_t dropped;   /* Posts which found the queue full */
+    uint32_t completed;
+    uint32_t max_depth;
+    uint32_t max_latency_us; /* From posting an item to running it */
+    uint64_t total_latency_us;
+} WorkQueueStats_t;
+
+/*
+ * Work which must not run in an interrupt, like anything touching the storage, is posted here by
+ * the interrupt and run by the main loop. Posting only takes a short critical section, so it is safe
+ * from interrupts and from both cores. An item which is already waiting is not queued again.
+ */
+class WorkQueue {
+  public:
+    explicit WorkQueue(WorkClock clock_us_) : clock_us(clock_us_) { critical_section_init(&lock); }
+    ~WorkQueue() { critical_section_deinit(&lock); }
+    WorkQueue(const WorkQueue&)            = delete;
+    WorkQueue& operator=(const WorkQueue&) = delete;
+
+    bool post(WorkHandler handler, void* context);
+    uint32_t run();
+    WorkQueueStats_t get_stats();
+    uint32_t get_depth();
+
+  private:
+    WorkClock clock_us;
+    critical_section_t lock;
+    std::array<WorkItem_t, WORK_QUEUE_CAPACITY> items{};
+    uint32_t head  = 0;
+    uint32_t count = 0;
+    WorkQueueStats_t stats{};
+
+    bool is_waiting(WorkHandler handler, const void* context) const;
+};
@@ -0,0 +1,43 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/* Host tests have no interrupts, the lock only has to keep count of its nesting */
+typedef struct {
+    int depth;
+} critical_section_t;
+
+inline void critical_section_init(critical_section_t* crit_sec) {
+    crit_sec->depth = 0;
+}
+
+inline void critical_section_deinit(critical_section_t* crit_sec) {
+    (void)crit_sec;
+}
+
+inline void critical_section_enter_blocking(critical_section_t* crit_sec) {
+    crit_sec->depth++;
+}
+
+inline void critical_section_exit(critical_section_t* crit_sec) {
+    crit_sec->depth--;
+}
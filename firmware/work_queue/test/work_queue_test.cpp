@@ -0,0 +1,117 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "work_queue.hpp"
+
+namespace {
+
+uint64_t clock_now_us = 0;
+
+uint64_t get_clock_us() {
+    return clock_now_us;
+}
+
+std::vector<int> ran;
+
+void record_work(void* context) {
+    ran.push_back(*static_cast<int*>(context));
+}
+
+} // namespace
+
+class WorkQueueTest : public ::testing::Test {
+  protected:
+    WorkQueue queue{ get_clock_us };
+    int ids[WORK_QUEUE_CAPACITY + 1] = { 0, 1, 2, 3, 4, 5, 6, 7, 8 };
+
+    void SetUp() override {
+        clock_now_us = 0;
+        ran.clear();
+    }
+};
+
+TEST_F(WorkQueueTest, RunsPostedWorkInOrder) {
+    EXPECT_TRUE(queue.post(record_work, &ids[0]));
+    EXPECT_TRUE(queue.post(record_work, &ids[1]));
+    EXPECT_TRUE(ran.empty());
+
+    EXPECT_EQ(queue.run(), 2U);
+    EXPECT_EQ(ran, (std::vector<int>{ 0, 1 }));
+    EXPECT_EQ(queue.get_depth(), 0U);
+    EXPECT_EQ(queue.run(), 0U);
+}
+
+TEST_F(WorkQueueTest, CoalescesWorkStillWaiting) {
+    EXPECT_TRUE(queue.post(record_work, &ids[0]));
+    EXPECT_TRUE(queue.post(record_work, &ids[0]));
+    queue.run();
+    EXPECT_TRUE(queue.post(record_work, &ids[0]));
+    queue.run();
+
+    EXPECT_EQ(ran, (std::vector<int>{ 0, 0 }));
+    const WorkQueueStats_t stats = queue.get_stats();
+    EXPECT_EQ(stats.posted, 2U);
+    EXPECT_EQ(stats.coalesced, 1U);
+    EXPECT_EQ(stats.completed, 2U);
+}
+
+TEST_F(WorkQueueTest, DropsWorkWhenFull) {
+    for (uint32_t i = 0; i < WORK_QUEUE_CAPACITY; ++i) {
+        EXPECT_TRUE(queue.post(record_work, &ids[i]));
+    }
+    EXPECT_FALSE(queue.post(record_work, &ids[WORK_QUEUE_CAPACITY]));
+
+    EXPECT_EQ(queue.run(), WORK_QUEUE_CAPACITY);
+    const WorkQueueStats_t stats = queue.get_stats();
+    EXPECT_EQ(stats.dropped, 1U);
+    EXPECT_EQ(stats.max_depth, WORK_QUEUE_CAPACITY);
+}
+
+TEST_F(WorkQueueTest, WorkPostedWhileRunningWaitsForNextRun) {
+    static WorkQueue* self = nullptr;
+    self                   = &queue;
+    auto repost            = [](void* context) {
+        ran.push_back(*static_cast<int*>(context));
+        self->post(record_work, context);
+    };
+
+    queue.post(repost, &ids[3]);
+    EXPECT_EQ(queue.run(), 1U);
+    EXPECT_EQ(queue.get_depth(), 1U);
+    EXPECT_EQ(queue.run(), 1U);
+    EXPECT_EQ(ran, (std::vector<int>{ 3, 3 }));
+}
+
+TEST_F(WorkQueueTest, MeasuresLatencyFromPostToRun) {
+    clock_now_us = 1000;
+    queue.post(record_work, &ids[0]);
+    clock_now_us = 1300;
+    queue.post(record_work, &ids[1]);
+    clock_now_us = 2000;
+    queue.run();
+
+    const WorkQueueStats_t stats = queue.get_stats();
+    EXPECT_EQ(stats.max_latency_us, 1000U);
+    EXPECT_EQ(stats.total_latency_us, 1700U);
+}
@@ -0,0 +1,95 @@
+/*
+ * 3-key Project
+ *
+ * This file is part of the 3-key project.
+ *
+ * Copyright (C) 2025 Dominik Trochowski <dominik.trochowski@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "work_queue.hpp"
+
+bool WorkQueue::post(WorkHandler handler, void* context) {
+    const uint64_t now_us = clock_us();
+    bool is_posted        = true;
+
+    critical_section_enter_blocking(&lock);
+    if (is_waiting(handler, context)) {
+        /* It has not run yet, so it will see whatever made it due again */
+        stats.coalesced++;
+    } else if (count == WORK_QUEUE_CAPACITY) {
+        stats.dropped++;
+        is_posted = false;
+    } else {
+        items[(head + count) % WORK_QUEUE_CAPACITY] = { handler, context, now_us };
+        count++;
+        stats.posted++;
+        stats.max_depth = std::max(stats.max_depth, count);
+    }
+    critical_section_exit(&lock);
+
+    return is_posted;
+}
+
+uint32_t WorkQueue::run() {
+    /* Items posted while running wait for the next call, a busy interrupt cannot keep the loop here */
+    critical_section_enter_blocking(&lock);
+    const uint32_t pending = count;
+    critical_section_exit(&lock);
+
+    for (uint32_t i = 0; i < pending; ++i) {
+        critical_section_enter_blocking(&lock);
+        const WorkItem_t item = items[head];
+        head                  = (head + 1) % WORK_QUEUE_CAPACITY;
+        count--;
+        critical_section_exit(&lock);
+
+        const uint32_t latency_us = static_cast<uint32_t>(clock_us() - item.posted_us);
+        item.handler(item.context);
+
+        critical_section_enter_blocking(&lock);
+        stats.completed++;
+        stats.max_latency_us = std::max(stats.max_latency_us, latency_us);
+        stats.total_latency_us += latency_us;
+        critical_section_exit(&lock);
+    }
+
+    return pending;
+}
+
+WorkQueueStats_t WorkQueue::get_stats() {
+    critical_section_enter_blocking(&lock);
+    const WorkQueueStats_t copy = stats;
+    critical_section_exit(&lock);
+    return copy;
+}
+
+uint32_t WorkQueue::get_depth() {
+    critical_section_enter_blocking(&lock);
+    const uint32_t depth = count;
+    critical_section_exit(&lock);
+    return depth;
+}
+
+bool WorkQueue::is_waiting(WorkHandler handler, const void* context) const {
+    for (uint32_t i = 0; i < count; ++i) {
+        const WorkItem_t& item = items[(head + i) % WORK_QUEUE_CAPACITY];
+        if ((item.handler == handler) && (item.context == context))
+            return true;
+    }
+    return false;
+}
@@ -19,6 +19,10 @@ BINARY_HEADER_2 = 0xBB
 BIN_MODE_PAYLOAD_LENGTH_FIELD_SIZE_BYTES = 4
 BIN_MODE_RESPONSE_HEADER_SIZE_BYTES = 4 + BIN_MODE_PAYLOAD_LENGTH_FIELD_SIZE_BYTES
 BIN_MODE_CRC_32_SIZE_BYTES = 4
+BIN_MODE_STREAM_CHUNK_HEADER_SIZE_BYTES = 2
+
+MAX_TIME_TRACKER_ENTRIES_COUNT = 31
+TIME_TRACKING_ENTRY_SIZE_BYTES = 40  # sizeof(TimeTrackingEntry_t), padding included
 
 
 class CommandType(Enum):
@@ -33,6 +37,7 @@ class CommandID(Enum):
     NEW_SESSION = 0x04
     SET_MEDIUM_THRESHOLD = 0x05
     SET_LONG_THRESHOLD = 0x06
+    GET_ALL_TIME_REPORTS = 0x0B
 
 
 class DateTime(cstruct.CStruct):
@@ -121,23 +126,51 @@ def parse_response(response):
     return status, command_id
 
 
+def read_binary_response(ser):
+    response = ser.read(BIN_MODE_RESPONSE_HEADER_SIZE_BYTES)
+
+    if len(response) < BIN_MODE_RESPONSE_HEADER_SIZE_BYTES:
+        raise ValueError(f"Response too short: expected at least {BIN_MODE_RESPONSE_HEADER_SIZE_BYTES} bytes, got {len(response)}")
+
+    payload_length = struct.unpack('<I', response[4:8])[0]
+    expected_response_length = BIN_MODE_RESPONSE_HEADER_SIZE_BYTES + payload_length + BIN_MODE_CRC_32_SIZE_BYTES
+
+    response += ser.read(expected_response_length - len(response))
+
+    if len(response) != expected_response_length:
+        raise ValueError(f"Incomplete response received: expected {expected_response_length} bytes, got {len(response)}")
+
+    return response
+
+
 def send_binary_packet(serial_port, packet):
     with serial.Serial(serial_port, baudrate=UART_BAUD_RATE, timeout=1000) as ser:
         ser.write(packet)
-        response = ser.read(BIN_MODE_RESPONSE_HEADER_SIZE_BYTES)
-        
-        if len(response) < BIN_MODE_RESPONSE_HEADER_SIZE_BYTES:
-            raise ValueError(f"Response too short: expected at least {BIN_MODE_RESPONSE_HEADER_SIZE_BYTES} bytes, got {len(response)}")
+        return read_binary_response(ser)
 
-        payload_length = struct.unpack('<I', response[4:8])[0]
-        expected_response_length = BIN_MODE_RESPONSE_HEADER_SIZE_BYTES + payload_length + BIN_MODE_CRC_32_SIZE_BYTES
 
-        response += ser.read(expected_response_length - len(response))
-        
-        if len(response) != expected_response_length:
-            raise ValueError(f"Incomplete response received: expected {expected_response_length} bytes, got {len(response)}")
+def send_streamed_binary_packet(serial_port, packet, command_id):
+    # The response comes in chunks, each a frame of its own with its index and the chunks count
+    data = bytearray()
+    with serial.Serial(serial_port, baudrate=UART_BAUD_RATE, timeout=1000) as ser:
+        ser.write(packet)
+        chunk, chunks_count = 0, 1
+        while chunk < chunks_count:
+            response = read_binary_response(ser)
+            status, resp_command_id = parse_response(response)
+            if resp_command_id != command_id.value:
+                raise ValueError("Mismatched command ID in response")
+            if status != 0:
+                raise ValueError(f"Streamed command failed: {status}")
 
-        return response
+            payload = response[BIN_MODE_RESPONSE_HEADER_SIZE_BYTES:-BIN_MODE_CRC_32_SIZE_BYTES]
+            index, chunks_count = payload[0], payload[1]
+            if index != chunk:
+                raise ValueError(f"Chunk out of order: expected {chunk}, got {index}")
+            data.extend(payload[BIN_MODE_STREAM_CHUNK_HEADER_SIZE_BYTES:])
+            chunk += 1
+
+    return bytes(data)
 
 
 # ---------------------------------------------------------------------------- #
@@ -158,7 +191,7 @@ def sync_time(serial_port):
     log.info(f"Sync time status: {status}")
 
 
-def get_time_report(serial_port, session_id=None):
+def request_time_report(serial_port, session_id=None):
     payload = struct.pack('<I', session_id) if session_id is not None else struct.pack('<I', 0xFFFFFFFF)
 
     packet = create_binary_packet(CommandType.READ, CommandID.GET_TIME_REPORT, payload)
@@ -172,8 +205,49 @@ def get_time_report(serial_port, session_id=None):
         raise ValueError(f"Failed to get time report: {status}")
 
     payload_length = struct.unpack('<I', response[4:8])[0]
-    time_report_data = response[8:8 + payload_length]
-    parse_time_report_response(time_report_data)
+    return response[8:8 + payload_length]
+
+
+def get_time_report(serial_port, session_id=None):
+    parse_time_report_response(request_time_report(serial_port, session_id))
+
+
+def request_all_time_reports(serial_port):
+    packet = create_binary_packet(CommandType.READ, CommandID.GET_ALL_TIME_REPORTS, b'')
+    data = send_streamed_binary_packet(serial_port, packet, CommandID.GET_ALL_TIME_REPORTS)
+
+    # Every session which tracked anything, its id followed by its entry
+    record_size = 1 + TIME_TRACKING_ENTRY_SIZE_BYTES
+    if len(data) % record_size != 0:
+        raise ValueError(f"Invalid time reports length: {len(data)}")
+
+    return {data[offset]: data[offset + 1:offset + record_size] for offset in range(0, len(data), record_size)}
+
+
+def get_all_time_reports(serial_port):
+    for session_id, entry_data in request_all_time_reports(serial_port).items():
+        log.info(f"Session {session_id}:")
+        parse_time_report_response(entry_data)
+
+
+def benchmark_export(serial_port, repeat):
+    # Exports every session with a request per session and then with the single streamed command
+    loop_s, bulk_s = 0.0, 0.0
+    for _ in range(repeat):
+        start = time.perf_counter()
+        for session_id in range(MAX_TIME_TRACKER_ENTRIES_COUNT):
+            request_time_report(serial_port, session_id)
+        loop_s += time.perf_counter() - start
+
+        start = time.perf_counter()
+        sessions = request_all_time_reports(serial_port)
+        bulk_s += time.perf_counter() - start
+
+    loop_ms = loop_s / repeat * MILLISECONDS_IN_SECOND_COUNT
+    bulk_ms = bulk_s / repeat * MILLISECONDS_IN_SECOND_COUNT
+    log.info(f"Per-session loop: {loop_ms:.1f} ms for {MAX_TIME_TRACKER_ENTRIES_COUNT} sessions")
+    log.info(f"GET_ALL_TIME_REPORTS: {bulk_ms:.1f} ms for {len(sessions)} populated sessions")
+    log.info(f"Speedup: {loop_ms / bulk_ms:.1f}x")
 
 
 def parse_time_report_response(response):
@@ -270,6 +344,13 @@ def parse_arguments():
     get_time_report_parser.add_argument("-s", "--session_id", type=int, default=None,
                                         help="Session ID for the 'get_time_report' command (optional)")
 
+    subparsers.add_parser("get_all_time_reports", help="Get time reports of all populated sessions at once")
+
+    benchmark_parser = subparsers.add_parser("benchmark_export",
+                                             help="Compare exporting all sessions one by one and at once")
+    benchmark_parser.add_argument("-r", "--repeat", type=int, default=5,
+                                  help="Number of exports to average over (default: 5)")
+
     subparsers.add_parser("get_current_session_id", help="Get the current session ID")
 
     subparsers.add_parser("new_session", help="Start a new session")
@@ -304,6 +385,10 @@ def main():
         sync_time(pico_serial_port)
     elif args.command == "get_time_report":
         get_time_report(pico_serial_port, args.session_id)
+    elif args.command == "get_all_time_reports":
+        get_all_time_reports(pico_serial_port)
+    elif args.command == "benchmark_export":
+        benchmark_export(pico_serial_port, args.repeat)
     elif args.command == "get_current_session_id":
         get_current_session_id(pico_serial_port)
     elif args.command == "new_session":